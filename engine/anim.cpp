@@ -0,0 +1,442 @@
+#include "anim.h"
+#include "simd.h"
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Round up to a multiple of the SIMD width
+ */
+static inline size_t an_padded (size_t n)
+{
+    return (n + VF_WIDTH - 1) / VF_WIDTH * VF_WIDTH;
+}
+
+/**
+ * @brief Is any channel of a SIMD block requested?
+ * @param due Requests of a track
+ * @param i First channel of the block
+ */
+static inline bool an_block_due (const std::vector<unsigned char> & due, size_t i)
+{
+    for (unsigned l = 0; l < VF_WIDTH; l++)
+        if (due[i + l])
+            return true;
+    return false;
+}
+
+/**
+ * @brief Where in its period each channel is, in `[0, 1]`. Computed in
+ *        double precision so that it doesn't degrade as time goes by.
+ * @param inv_time 1 / period of each channel
+ * @param n Number of channels
+ * @param elapsed Number of ms since program start
+ * @param[out] out Phase of each channel
+ */
+static void an_phase (const double * inv_time, size_t n, unsigned elapsed, float * out)
+{
+    double e = elapsed;
+    size_t i = 0;
+
+#if defined(__AVX__)
+    __m256d ve = _mm256_set1_pd(e);
+    for (; i + 4 <= n; i += 4) {
+        __m256d p = _mm256_mul_pd(ve, _mm256_loadu_pd(inv_time + i));
+        p = _mm256_sub_pd(p, _mm256_floor_pd(p));
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(p));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128d ve = _mm_set1_pd(e);
+    for (; i + 2 <= n; i += 2) {
+        __m128d p = _mm_mul_pd(ve, _mm_loadu_pd(inv_time + i));
+        /* phases are never negative, so truncating is flooring */
+        p = _mm_sub_pd(p, _mm_cvtepi32_pd(_mm_cvttpd_epi32(p)));
+        _mm_storel_pi((__m64 *) (out + i), _mm_cvtpd_ps(p));
+    }
+#endif
+
+    for (; i < n; i++) {
+        double p = e * inv_time[i];
+        out[i] = p - floor(p);
+    }
+}
+
+/**
+ * @brief Sine and cosine of a full turn fraction, `2 * pi * p`
+ * @param p Fraction of a turn, in `[0, 1]`
+ * @param[out] s Sine
+ * @param[out] c Cosine
+ */
+static inline void an_sincos (vf p, vf * s, vf * c)
+{
+    const vf pi = vf_set1(M_PI);
+    const vf half_pi = vf_set1(M_PI / 2);
+
+    /* x in [-pi, pi]: sin(x + pi) = -sin(x), cos(x + pi) = -cos(x) */
+    vf x = vf_sub(vf_mul(p, vf_set1(2 * M_PI)), pi);
+
+    /* fold into [-pi/2, pi/2], where the polynomials are accurate */
+    vf hi = vf_gt(x, half_pi);
+    vf lo = vf_lt(x, vf_sub(vf_set1(0), half_pi));
+    x = vf_select(hi, vf_sub(pi, x), x);
+    x = vf_select(lo, vf_sub(vf_sub(vf_set1(0), pi), x), x);
+    vf flip = vf_or(hi, lo);
+
+    vf x2 = vf_mul(x, x);
+
+    /* Taylor series up to x^9 and x^10 */
+    vf sp = vf_set1(1.0f / 362880);
+    sp = vf_fmadd(sp, x2, vf_set1(-1.0f / 5040));
+    sp = vf_fmadd(sp, x2, vf_set1(1.0f / 120));
+    sp = vf_fmadd(sp, x2, vf_set1(-1.0f / 6));
+    sp = vf_fmadd(sp, x2, vf_set1(1));
+    sp = vf_mul(sp, x);
+
+    vf cp = vf_set1(-1.0f / 3628800);
+    cp = vf_fmadd(cp, x2, vf_set1(1.0f / 40320));
+    cp = vf_fmadd(cp, x2, vf_set1(-1.0f / 720));
+    cp = vf_fmadd(cp, x2, vf_set1(1.0f / 24));
+    cp = vf_fmadd(cp, x2, vf_set1(-1.0f / 2));
+    cp = vf_fmadd(cp, x2, vf_set1(1));
+    cp = vf_select(flip, vf_sub(vf_set1(0), cp), cp);
+
+    *s = vf_sub(vf_set1(0), sp);
+    *c = vf_sub(vf_set1(0), cp);
+}
+
+/**
+ * @brief Evaluate the rotation track, `VF_WIDTH` channels at a time
+ */
+static void an_evaluate_rotate (struct anim_tracks * anim)
+{
+    const float * phase = anim->phase.data();
+
+    for (size_t i = 0; i < anim->rot_x.size(); i += VF_WIDTH) {
+        if (!an_block_due(anim->rot_due, i))
+            continue;
+        anim->evaluated += VF_WIDTH;
+
+        vf s, c;
+        an_sincos(vf_load(phase + i), &s, &c);
+        vf t = vf_sub(vf_set1(1), c);
+
+        vf x = vf_load(&anim->rot_x[i]);
+        vf y = vf_load(&anim->rot_y[i]);
+        vf z = vf_load(&anim->rot_z[i]);
+
+        /* same as m4_rotate, column-major */
+        float m[9][VF_WIDTH];
+        vf_store(m[0], vf_fmadd(vf_mul(x, x), t, c));
+        vf_store(m[1], vf_fmadd(vf_mul(y, x), t, vf_mul(z, s)));
+        vf_store(m[2], vf_sub(vf_mul(vf_mul(x, z), t), vf_mul(y, s)));
+        vf_store(m[3], vf_sub(vf_mul(vf_mul(x, y), t), vf_mul(z, s)));
+        vf_store(m[4], vf_fmadd(vf_mul(y, y), t, c));
+        vf_store(m[5], vf_fmadd(vf_mul(y, z), t, vf_mul(x, s)));
+        vf_store(m[6], vf_fmadd(vf_mul(x, z), t, vf_mul(y, s)));
+        vf_store(m[7], vf_sub(vf_mul(vf_mul(y, z), t), vf_mul(x, s)));
+        vf_store(m[8], vf_fmadd(vf_mul(z, z), t, c));
+
+        for (unsigned l = 0; l < VF_WIDTH; l++) {
+            float * out = anim->rot_out[i + l].m;
+            out[0] = m[0][l]; out[1] = m[1][l]; out[2]  = m[2][l];
+            out[4] = m[3][l]; out[5] = m[4][l]; out[6]  = m[5][l];
+            out[8] = m[6][l]; out[9] = m[7][l]; out[10] = m[8][l];
+        }
+    }
+}
+
+/**
+ * @brief Evaluate the translation track, `VF_WIDTH` channels at a time
+ */
+static void an_evaluate_translate (struct anim_tracks * anim)
+{
+    const float * phase = anim->phase.data();
+    const float * coeffs = (const float *) anim->segments.data();
+    const unsigned n_coeffs = sizeof(struct cr_segment) / sizeof(float);
+
+    for (size_t i = 0; i < anim->tr_first.size(); i += VF_WIDTH) {
+        if (!an_block_due(anim->tr_due, i))
+            continue;
+        anim->evaluated += VF_WIDTH;
+
+        vf n = vf_load(&anim->tr_segments[i]);
+        vf t = vf_mul(vf_load(phase + i), n);
+        vf index = vf_min(vf_floor(t), vf_sub(n, vf_set1(1))); // which segment
+        t = vf_sub(t, index); // where within the segment
+
+        float findex[VF_WIDTH];
+        vf_store(findex, index);
+        unsigned seg[VF_WIDTH];
+        for (unsigned l = 0; l < VF_WIDTH; l++)
+            seg[l] = (anim->tr_first[i + l] + (unsigned) findex[l]) * n_coeffs;
+
+#define horner(f, O) \
+        do { \
+            vf a = vf_gather(coeffs + 0 + O, seg);      \
+            vf b = vf_gather(coeffs + 3 + O, seg);      \
+            vf c = vf_gather(coeffs + 6 + O, seg);      \
+            vf d = vf_gather(coeffs + 9 + O, seg);      \
+            vf r = vf_fmadd(vf_fmadd(vf_fmadd(a, t, b), t, c), t, d); \
+            vf_store(&anim->tr_ ## f[i], r);            \
+        } while (0)
+        horner(x, 0);
+        horner(y, 1);
+        horner(z, 2);
+#undef horner
+    }
+}
+
+/**
+ * @brief Evaluate the baked track. There are few baked channels and each
+ *        costs the same, so this one goes a channel at a time.
+ */
+static void an_evaluate_baked (struct anim_tracks * anim)
+{
+    for (unsigned i = 0; i < anim->n_bk; i++) {
+        if (!anim->bk_due[i])
+            continue;
+        anim->evaluated++;
+
+        unsigned n = anim->bk_n[i];
+        float t = anim->phase[i] * n;
+        unsigned k = std::min((unsigned) t, n - 1);
+        t -= k;
+
+        const struct an_key * k0 = &anim->bk_keys[anim->bk_first[i] + k];
+        const struct an_key * k1 = &anim->bk_keys[anim->bk_first[i] + (k + 1) % n];
+
+        /* keys are close together, so nlerp is as good as slerp */
+        float q[4];
+        float len = 0;
+        for (unsigned j = 0; j < 4; j++) {
+            q[j] = k0->rot[j] + (k1->rot[j] - k0->rot[j]) * t;
+            len += q[j] * q[j];
+        }
+        len = 1 / sqrtf(len);
+        float x = q[0] * len, y = q[1] * len, z = q[2] * len, w = q[3] * len;
+
+        const struct Point * s = &anim->bk_scale[i];
+        struct mat4 * out = &anim->bk_out[i];
+        out->m[0]  = (1 - 2 * (y * y + z * z)) * s->x;
+        out->m[1]  = (2 * (x * y + z * w)) * s->x;
+        out->m[2]  = (2 * (x * z - y * w)) * s->x;
+        out->m[4]  = (2 * (x * y - z * w)) * s->y;
+        out->m[5]  = (1 - 2 * (x * x + z * z)) * s->y;
+        out->m[6]  = (2 * (y * z + x * w)) * s->y;
+        out->m[8]  = (2 * (x * z + y * w)) * s->z;
+        out->m[9]  = (2 * (y * z - x * w)) * s->z;
+        out->m[10] = (1 - 2 * (x * x + y * y)) * s->z;
+        for (unsigned j = 0; j < 3; j++)
+            out->m[12 + j] = k0->pos[j] + (k1->pos[j] - k0->pos[j]) * t;
+    }
+}
+
+static inline float an_dot (struct Point a, struct Point b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline float an_length (struct Point a)
+{
+    return sqrtf(an_dot(a, a));
+}
+
+/**
+ * @brief Split a transform into translation, rotation and scale
+ * @param m The transform
+ * @param[out] key Its translation and rotation
+ * @param[out] scale Its scale
+ * @returns Whether it could be split, i.e., whether it doesn't shear
+ */
+static bool an_decompose (const struct mat4 * m, struct an_key * key, struct Point * scale)
+{
+    struct Point c0 = Point(m->m[0], m->m[1], m->m[2]);
+    struct Point c1 = Point(m->m[4], m->m[5], m->m[6]);
+    struct Point c2 = Point(m->m[8], m->m[9], m->m[10]);
+
+    float sx = an_length(c0);
+    float sy = an_length(c1);
+    float sz = an_length(c2);
+    if (sx == 0 || sy == 0 || sz == 0)
+        return false;
+
+    const float eps = 1e-3f;
+    if (fabsf(an_dot(c0, c1)) > eps * sx * sy
+            || fabsf(an_dot(c0, c2)) > eps * sx * sz
+            || fabsf(an_dot(c1, c2)) > eps * sy * sz)
+        return false;
+
+    /* a mirror is a negative scale, not a rotation */
+    if (an_dot(c0, crossProduct(c1, c2)) < 0)
+        sx = -sx;
+
+    c0 = c0 / sx;
+    c1 = c1 / sy;
+    c2 = c2 / sz;
+
+    /* rotation matrix to quaternion, from the largest component */
+    float tr = c0.x + c1.y + c2.z;
+    float * q = key->rot;
+    if (tr > 0) {
+        float s = sqrtf(tr + 1) * 2;
+        q[3] = s / 4;
+        q[0] = (c1.z - c2.y) / s;
+        q[1] = (c2.x - c0.z) / s;
+        q[2] = (c0.y - c1.x) / s;
+    } else if (c0.x > c1.y && c0.x > c2.z) {
+        float s = sqrtf(1 + c0.x - c1.y - c2.z) * 2;
+        q[3] = (c1.z - c2.y) / s;
+        q[0] = s / 4;
+        q[1] = (c1.x + c0.y) / s;
+        q[2] = (c2.x + c0.z) / s;
+    } else if (c1.y > c2.z) {
+        float s = sqrtf(1 + c1.y - c0.x - c2.z) * 2;
+        q[3] = (c2.x - c0.z) / s;
+        q[0] = (c1.x + c0.y) / s;
+        q[1] = s / 4;
+        q[2] = (c2.y + c1.z) / s;
+    } else {
+        float s = sqrtf(1 + c2.z - c0.x - c1.y) * 2;
+        q[3] = (c0.y - c1.x) / s;
+        q[0] = (c2.x + c0.z) / s;
+        q[1] = (c2.y + c1.z) / s;
+        q[2] = s / 4;
+    }
+
+    key->pos[0] = m->m[12];
+    key->pos[1] = m->m[13];
+    key->pos[2] = m->m[14];
+    *scale = Point(sx, sy, sz);
+    return true;
+}
+
+void an_clear (struct anim_tracks * anim)
+{
+    size_t budget = anim->bake_budget;
+    *anim = anim_tracks();
+    anim->bake_budget = budget;
+}
+
+unsigned an_add_rotate (struct anim_tracks * anim, struct Point axis, unsigned time)
+{
+    float len = sqrtf(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+
+    /* no axis means no rotation, so keep the angle at 0 */
+    anim->rot_x.push_back((len > 0) ? axis.x / len : 0);
+    anim->rot_y.push_back((len > 0) ? axis.y / len : 0);
+    anim->rot_z.push_back((len > 0) ? axis.z / len : 0);
+    anim->rot_inv_time.push_back((len > 0 && time > 0) ? 1.0 / time : 0);
+    return anim->n_rot++;
+}
+
+unsigned an_add_translate (struct anim_tracks * anim, const std::vector<struct cr_segment> & segments, unsigned time)
+{
+    anim->tr_first.push_back(anim->segments.size());
+    anim->tr_segments.push_back(segments.size());
+    anim->tr_inv_time.push_back((time > 0) ? 1.0 / time : 0);
+    anim->segments.insert(anim->segments.end(), segments.begin(), segments.end());
+    return anim->n_tr++;
+}
+
+size_t an_bake_room (const struct anim_tracks * anim)
+{
+    size_t used = anim->bk_keys.size() * sizeof(struct an_key);
+    return (used < anim->bake_budget) ?
+        (anim->bake_budget - used) / sizeof(struct an_key):
+        0;
+}
+
+bool an_add_baked (struct anim_tracks * anim, const std::vector<struct mat4> & samples, unsigned time, unsigned * ret)
+{
+    if (samples.size() < 2 || samples.size() > an_bake_room(anim) || time == 0)
+        return false;
+
+    std::vector<struct an_key> keys(samples.size());
+    struct Point scale;
+    for (unsigned i = 0; i < samples.size(); i++) {
+        struct Point s;
+        if (!an_decompose(&samples[i], &keys[i], &s))
+            return false;
+
+        if (i == 0) {
+            scale = s;
+        } else {
+            if (an_length(s - scale) > 1e-3f * an_length(scale))
+                return false;
+
+            /* keep to the same hemisphere, so interpolating takes the short way */
+            const float * p = keys[i - 1].rot;
+            float * q = keys[i].rot;
+            if (p[0] * q[0] + p[1] * q[1] + p[2] * q[2] + p[3] * q[3] < 0)
+                for (unsigned j = 0; j < 4; j++)
+                    q[j] = -q[j];
+        }
+    }
+
+    anim->bk_first.push_back(anim->bk_keys.size());
+    anim->bk_n.push_back(keys.size());
+    anim->bk_inv_time.push_back(1.0 / time);
+    anim->bk_scale.push_back(scale);
+    anim->bk_keys.insert(anim->bk_keys.end(), keys.begin(), keys.end());
+    *ret = anim->n_bk++;
+    return true;
+}
+
+void an_finish (struct anim_tracks * anim)
+{
+    size_t n = an_padded(anim->n_rot);
+    anim->rot_x.resize(n, 0);
+    anim->rot_y.resize(n, 1);
+    anim->rot_z.resize(n, 0);
+    anim->rot_inv_time.resize(n, 0);
+    anim->rot_out.resize(n, m4_identity());
+
+    n = (anim->n_tr > 0) ? an_padded(anim->n_tr) : 0;
+    anim->tr_first.resize(n, 0);
+    anim->tr_segments.resize(n, 1);
+    anim->tr_inv_time.resize(n, 0);
+    anim->tr_x.resize(n, 0);
+    anim->tr_y.resize(n, 0);
+    anim->tr_z.resize(n, 0);
+
+    anim->bk_out.resize(anim->n_bk, m4_identity());
+
+    anim->rot_due.resize(anim->rot_x.size(), 0);
+    anim->tr_due.resize(anim->tr_first.size(), 0);
+    anim->bk_due.resize(anim->n_bk, 0);
+
+    anim->phase.resize(std::max({ anim->rot_x.size(), anim->tr_first.size(), (size_t) anim->n_bk }));
+}
+
+void an_request (struct anim_tracks * anim, enum an_track track, unsigned channel)
+{
+    switch (track) {
+        case AN_ROTATE:    anim->rot_due[channel] = 1; break;
+        case AN_TRANSLATE: anim->tr_due[channel] = 1; break;
+        case AN_BAKED:     anim->bk_due[channel] = 1; break;
+    }
+}
+
+void an_evaluate (struct anim_tracks * anim, unsigned elapsed)
+{
+    anim->evaluated = 0;
+
+    an_phase(anim->rot_inv_time.data(), anim->rot_inv_time.size(), elapsed, anim->phase.data());
+    an_evaluate_rotate(anim);
+
+    an_phase(anim->tr_inv_time.data(), anim->tr_inv_time.size(), elapsed, anim->phase.data());
+    an_evaluate_translate(anim);
+
+    an_phase(anim->bk_inv_time.data(), anim->n_bk, elapsed, anim->phase.data());
+    an_evaluate_baked(anim);
+
+    std::fill(anim->rot_due.begin(), anim->rot_due.end(), 0);
+    std::fill(anim->tr_due.begin(), anim->tr_due.end(), 0);
+    std::fill(anim->bk_due.begin(), anim->bk_due.end(), 0);
+}
@@ -0,0 +1,153 @@
+#ifndef _ANIM_H
+#define _ANIM_H
+
+#include "../generator/generators.h"
+#include "mat4.h"
+
+#include <vector>
+
+/**
+ * A segment of a Catmull-Rom curve, as a cubic polynomial:
+ * `((a * t + b) * t + c) * t + d`, with `t` in `[0, 1]`
+ */
+struct cr_segment {
+    struct Point a;
+    struct Point b;
+    struct Point c;
+    struct Point d;
+};
+
+/**
+ * Default memory budget of baked channels' keys, in bytes
+ */
+#define AN_BAKE_BUDGET (1 << 20)
+
+/**
+ * A key of a baked channel: a position and a rotation (unit quaternion)
+ */
+struct an_key {
+    float pos[3];
+    float rot[4]; /*< x, y, z, w */
+};
+
+/**
+ * Animation tracks
+ */
+enum an_track {
+    AN_ROTATE,    /*< GT_ROTATE_ANIM channels */
+    AN_TRANSLATE, /*< GT_TRANSLATE_ANIM channels */
+    AN_BAKED,     /*< Baked channels */
+};
+
+/**
+ * Every animation channel of a scene, gathered by type into
+ * structure-of-arrays tracks so that a whole track is evaluated in one
+ * SIMD pass. Tracks are padded to a multiple of the SIMD width.
+ */
+struct anim_tracks {
+    /* GT_ROTATE_ANIM channels */
+    unsigned n_rot;                   /*< Number of rotation channels */
+    std::vector<float> rot_x;         /*< Axis (normalized) */
+    std::vector<float> rot_y;
+    std::vector<float> rot_z;
+    std::vector<double> rot_inv_time; /*< 1 / period (ms) */
+    std::vector<struct mat4> rot_out; /*< Evaluated rotations */
+
+    /* GT_TRANSLATE_ANIM channels */
+    unsigned n_tr;                           /*< Number of translation channels */
+    std::vector<unsigned> tr_first;          /*< First segment in `segments` */
+    std::vector<float> tr_segments;          /*< Number of segments */
+    std::vector<double> tr_inv_time;         /*< 1 / period (ms) */
+    std::vector<struct cr_segment> segments; /*< Segments of every curve */
+    std::vector<float> tr_x;                 /*< Evaluated positions */
+    std::vector<float> tr_y;
+    std::vector<float> tr_z;
+
+    /* baked channels: a whole animated local transform, sampled */
+    unsigned n_bk;                      /*< Number of baked channels */
+    std::vector<unsigned> bk_first;     /*< First key in `bk_keys` */
+    std::vector<unsigned> bk_n;         /*< Number of keys */
+    std::vector<double> bk_inv_time;    /*< 1 / period (ms) */
+    std::vector<struct Point> bk_scale; /*< Scale, constant over the period */
+    std::vector<struct an_key> bk_keys; /*< Keys of every baked channel */
+    std::vector<struct mat4> bk_out;    /*< Evaluated transforms */
+    size_t bake_budget;                 /*< Bytes `bk_keys` may take */
+
+    /* channels requested for the next evaluation, per track */
+    std::vector<unsigned char> rot_due;
+    std::vector<unsigned char> tr_due;
+    std::vector<unsigned char> bk_due;
+    unsigned evaluated; /*< Channels evaluated last time, padding included */
+
+    std::vector<float> phase; /*< Scratch: where in its period each channel is */
+};
+
+/**
+ * @brief Remove every channel. The bake budget is kept.
+ * @param anim The tracks
+ */
+void an_clear (struct anim_tracks * anim);
+
+/**
+ * @brief Add a GT_ROTATE_ANIM channel
+ * @param anim The tracks
+ * @param axis Axis to rotate around
+ * @param time Time in msecs for a full 360 rotation
+ * @returns The channel's index in the rotation track
+ */
+unsigned an_add_rotate (struct anim_tracks * anim, struct Point axis, unsigned time);
+
+/**
+ * @brief Add a GT_TRANSLATE_ANIM channel
+ * @param anim The tracks
+ * @param segments Segments of the closed curve to follow
+ * @param time Time in msecs to go around the curve
+ * @returns The channel's index in the translation track
+ */
+unsigned an_add_translate (struct anim_tracks * anim, const std::vector<struct cr_segment> & segments, unsigned time);
+
+/**
+ * @brief How many more keys fit in the bake budget
+ * @param anim The tracks
+ */
+size_t an_bake_room (const struct anim_tracks * anim);
+
+/**
+ * @brief Add a baked channel from transforms sampled at regular intervals
+ *        over a period. Only rigid transforms with a constant scale can be
+ *        baked: the samples are refused if they shear, if their scale
+ *        changes, or if they don't fit in the budget.
+ * @param anim The tracks
+ * @param samples The transforms, `samples[i]` being at `i * time / n`
+ * @param time Period in msecs
+ * @param[out] ret The channel's index in the baked track
+ * @returns Whether the channel was added
+ */
+bool an_add_baked (struct anim_tracks * anim, const std::vector<struct mat4> & samples, unsigned time, unsigned * ret);
+
+/**
+ * @brief Pad the tracks and size the outputs. Call after adding every
+ *        channel and before evaluating.
+ * @param anim The tracks
+ */
+void an_finish (struct anim_tracks * anim);
+
+/**
+ * @brief Ask for a channel to be evaluated by the next `an_evaluate`
+ * @param anim The tracks
+ * @param track The channel's track
+ * @param channel The channel's index in its track
+ */
+void an_request (struct anim_tracks * anim, enum an_track track, unsigned channel);
+
+/**
+ * @brief Evaluate the requested channels, writing `rot_out`, `tr_[xyz]`
+ *        and `bk_out`, and clear the requests. SIMD tracks are evaluated
+ *        `VF_WIDTH` channels at a time, so a request may bring its
+ *        neighbours along; every other channel keeps its last value.
+ * @param anim The tracks
+ * @param elapsed Number of ms since program start
+ */
+void an_evaluate (struct anim_tracks * anim, unsigned elapsed);
+
+#endif /* _ANIM_H */
@@ -0,0 +1,277 @@
+#include "atlas.h"
+#include "simd.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+
+/**
+ * @brief Round up to a multiple of `AT_ALIGN`
+ */
+static inline unsigned at_align (unsigned n)
+{
+    return (n + AT_ALIGN - 1) / AT_ALIGN * AT_ALIGN;
+}
+
+/**
+ * @brief Size of an image side once halved some times
+ */
+static inline unsigned at_shrunk (unsigned n, unsigned shrink)
+{
+    for (; shrink > 0; shrink--)
+        n = std::max(1u, n / 2);
+    return n;
+}
+
+/**
+ * @brief Size of a tile side, for an image side halved some times
+ */
+static inline unsigned at_tile_side (unsigned n, unsigned shrink)
+{
+    return at_align(at_shrunk(n, shrink) + 2 * AT_PADDING);
+}
+
+unsigned at_add (struct atlas * at, struct at_image * img)
+{
+    at->images.push_back(at_image());
+    struct at_image * dst = &at->images.back();
+    dst->width = img->width;
+    dst->height = img->height;
+    dst->shrink = 0;
+    dst->pixels.swap(img->pixels);
+    return at->images.size() - 1;
+}
+
+void at_halve (struct at_image * img)
+{
+    unsigned w = std::max(1u, img->width / 2);
+    unsigned h = std::max(1u, img->height / 2);
+    std::vector<unsigned char> pixels(4 * (size_t) w * h);
+
+    for (unsigned y = 0; y < h; y++) {
+        unsigned y0 = std::min(2 * y, img->height - 1);
+        unsigned y1 = std::min(2 * y + 1, img->height - 1);
+        for (unsigned x = 0; x < w; x++) {
+            unsigned x0 = std::min(2 * x, img->width - 1);
+            unsigned x1 = std::min(2 * x + 1, img->width - 1);
+            for (unsigned c = 0; c < 4; c++) {
+                unsigned sum = img->pixels[4 * ((size_t) y0 * img->width + x0) + c]
+                    + img->pixels[4 * ((size_t) y0 * img->width + x1) + c]
+                    + img->pixels[4 * ((size_t) y1 * img->width + x0) + c]
+                    + img->pixels[4 * ((size_t) y1 * img->width + x1) + c];
+                pixels[4 * ((size_t) y * w + x) + c] = (sum + 2) / 4;
+            }
+        }
+    }
+
+    img->width = w;
+    img->height = h;
+    img->pixels.swap(pixels);
+}
+
+/**
+ * @brief Pack the tiles in shelves, tallest first
+ * @param at The atlas, with the size of every tile set
+ * @param order Tiles by decreasing height
+ * @param width Width of the atlas
+ * @returns Height it takes
+ */
+static unsigned at_shelves (struct atlas * at, const std::vector<unsigned> * order, unsigned width)
+{
+    unsigned x = 0, y = 0, shelf = 0;
+    for (unsigned i : *order) {
+        struct at_tile * t = &at->tiles[i];
+        if (t->width == 0)
+            continue;
+        if (x + t->width > width) {
+            y += shelf;
+            x = 0;
+            shelf = 0;
+        }
+        t->x = x;
+        t->y = y;
+        x += t->width;
+        shelf = std::max(shelf, t->height);
+    }
+    return y + shelf;
+}
+
+bool at_pack (struct atlas * at, unsigned max_size)
+{
+    assert(max_size >= 2 * AT_ALIGN);
+    at->tiles.resize(at->images.size());
+    at->width = at->height = 0;
+
+    std::vector<unsigned> order(at->images.size());
+    for (;;) {
+        unsigned widest = 0;
+        for (unsigned i = 0; i < at->images.size(); i++) {
+            const struct at_image * img = &at->images[i];
+            bool empty = img->width == 0;
+            at->tiles[i].width = empty ? 0 : at_tile_side(img->width, img->shrink);
+            at->tiles[i].height = empty ? 0 : at_tile_side(img->height, img->shrink);
+            widest = std::max(widest, at->tiles[i].width);
+            order[i] = i;
+        }
+        if (widest == 0)
+            return true;
+
+        std::stable_sort(order.begin(), order.end(), [at] (unsigned a, unsigned b) {
+            return at->tiles[a].height > at->tiles[b].height;
+        });
+
+        /* a whole number of the widest tiles across, whichever takes the least room */
+        unsigned best = 0;
+        size_t best_area = 0;
+        for (unsigned w = widest; w <= max_size; w += widest) {
+            unsigned h = at_shelves(at, &order, w);
+            if (h <= max_size && (best == 0 || (size_t) w * h < best_area)) {
+                best = w;
+                best_area = (size_t) w * h;
+            }
+        }
+
+        if (best > 0) {
+            at->width = best;
+            at->height = at_shelves(at, &order, best);
+            return true;
+        }
+
+        /*
+         * doesn't fit: halve the largest image whose tile would get any
+         * smaller, and try again; padding and alignment keep tiles from
+         * shrinking past a point
+         */
+        int largest = -1;
+        for (unsigned i = 0; i < at->images.size(); i++) {
+            const struct at_image * img = &at->images[i];
+            const struct at_tile * t = &at->tiles[i];
+            bool shrinks = t->width > 0
+                && (at_tile_side(img->width, img->shrink + 1) < t->width
+                        || at_tile_side(img->height, img->shrink + 1) < t->height);
+            if (shrinks && (largest < 0 || (size_t) t->width * t->height
+                        > (size_t) at->tiles[largest].width * at->tiles[largest].height))
+                largest = i;
+        }
+
+        if (largest < 0) {
+            for (struct at_tile & t : at->tiles)
+                t.width = t.height = 0;
+            return false;
+        }
+        at->images[largest].shrink++;
+    }
+}
+
+void at_rect (const struct atlas * at, unsigned id, float rect[4])
+{
+    const struct at_tile * t = &at->tiles[id];
+    const struct at_image * img = &at->images[id];
+    rect[0] = (float) (t->x + AT_PADDING) / at->width;
+    rect[1] = (float) (t->y + AT_PADDING) / at->height;
+    rect[2] = (float) at_shrunk(img->width, img->shrink) / at->width;
+    rect[3] = (float) at_shrunk(img->height, img->shrink) / at->height;
+}
+
+/**
+ * @brief Halve a level of a tile, averaging every 2x2 texels,
+ *        `VB_WIDTH` bytes of each row at a time
+ * @param src The level, of an even size
+ * @param width Its width
+ * @param height Its height
+ * @param[out] dst The next level
+ */
+static void at_downsample (const unsigned char * src, unsigned width, unsigned height, unsigned char * dst)
+{
+    size_t row = 4 * (size_t) width;
+
+    for (unsigned y = 0; y < height / 2; y++) {
+        const unsigned char * a = &src[2 * y * row];
+        const unsigned char * b = a + row;
+        unsigned char * out = &dst[y * row / 2];
+
+        /* rows first, then pairs of texels: 2 vectors of input make 1 of output */
+        size_t x = 0;
+        for (; x + 2 * VB_WIDTH <= row; x += 2 * VB_WIDTH) {
+            vb lo = vb_avg(vb_load(a + x), vb_load(b + x));
+            vb hi = vb_avg(vb_load(a + x + VB_WIDTH), vb_load(b + x + VB_WIDTH));
+            vb_store(out + x / 2, vb_avg(vb_even32(lo, hi), vb_odd32(lo, hi)));
+        }
+        for (; x < row; x += 8)
+            for (unsigned c = 0; c < 4; c++)
+                out[x / 2 + c] = (a[x + c] + a[x + 4 + c] + b[x + c] + b[x + 4 + c] + 2) / 4;
+    }
+}
+
+/**
+ * @brief Size of a tile on every level, uncompressed
+ */
+static size_t at_plain_size (const struct at_tile * t)
+{
+    size_t size = 0;
+    for (unsigned l = 0; l < AT_LEVELS; l++)
+        size += 4 * (size_t) (t->width >> l) * (t->height >> l);
+    return size;
+}
+
+void at_build (struct atlas * at, unsigned id)
+{
+    struct at_image * img = &at->images[id];
+    struct at_tile * t = &at->tiles[id];
+    if (t->width == 0)
+        return;
+
+    for (unsigned i = 0; i < img->shrink; i++)
+        at_halve(img);
+    t->mips.resize(at_plain_size(t));
+
+    /* the padding wraps around, and so does the rest of the tile's alignment */
+    unsigned char * level = t->mips.data();
+    for (unsigned y = 0; y < t->height; y++) {
+        unsigned sy = (y + img->height - AT_PADDING % img->height) % img->height;
+        unsigned char * row = &level[4 * (size_t) y * t->width];
+        for (unsigned x = 0; x < t->width; x++) {
+            unsigned sx = (x + img->width - AT_PADDING % img->width) % img->width;
+            memcpy(&row[4 * x], &img->pixels[4 * ((size_t) sy * img->width + sx)], 4);
+        }
+    }
+    std::vector<unsigned char>().swap(img->pixels);
+
+    for (unsigned l = 1; l < AT_LEVELS; l++) {
+        unsigned char * next = level + 4 * (size_t) (t->width >> (l - 1)) * (t->height >> (l - 1));
+        at_downsample(level, t->width >> (l - 1), t->height >> (l - 1), next);
+        level = next;
+    }
+    if (at->format == BC_RGBA)
+        return;
+
+    /* every level is compressed from the plain one, not from the compressed level before */
+    std::vector<unsigned char> blocks(at_tile_size(at, id));
+    level = t->mips.data();
+    for (unsigned l = 0; l < AT_LEVELS; l++) {
+        unsigned w = t->width >> l, h = t->height >> l;
+        bc_encode(at->format, level, w, h, &blocks[at_level_offset(at, id, l)]);
+        level += 4 * (size_t) w * h;
+    }
+    t->mips.swap(blocks);
+}
+
+size_t at_tile_size (const struct atlas * at, unsigned id)
+{
+    return at_level_offset(at, id, AT_LEVELS);
+}
+
+size_t at_level_offset (const struct atlas * at, unsigned id, unsigned level)
+{
+    const struct at_tile * t = &at->tiles[id];
+    size_t offset = 0;
+    for (unsigned l = 0; l < level; l++)
+        offset += bc_size(at->format, t->width >> l, t->height >> l);
+    return offset;
+}
+
+void at_release (struct atlas * at, unsigned id)
+{
+    std::vector<unsigned char>().swap(at->tiles[id].mips);
+}
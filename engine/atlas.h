@@ -0,0 +1,115 @@
+#ifndef _ATLAS_H
+#define _ATLAS_H
+
+#include "bcn.h"
+
+#include <stddef.h>
+
+#include <vector>
+
+/** Texels around each image, repeating it as `GL_REPEAT` would */
+#define AT_PADDING 16
+
+/** Mip levels of an atlas: more would blur images into each other */
+#define AT_LEVELS 5
+
+/** Tiles are aligned to this, so that they stay aligned on every level, to compressed blocks too */
+#define AT_ALIGN (4 << (AT_LEVELS - 1))
+
+/**
+ * An image, as decoded
+ */
+struct at_image {
+    unsigned width;                    /*< Width, in texels, 0 if it failed to load */
+    unsigned height;                   /*< Height, in texels */
+    unsigned shrink;                   /*< Times it's halved to fit, once packed */
+    std::vector<unsigned char> pixels; /*< RGBA, 8 bits per channel; may come later than the size */
+};
+
+/**
+ * Where an image is in an atlas: its tile is the image and its padding
+ */
+struct at_tile {
+    unsigned x, y;                   /*< Lower left corner of the tile, in texels */
+    unsigned width, height;          /*< Size of the tile */
+    std::vector<unsigned char> mips; /*< The tile on every level, in the atlas' format, once built, the largest first */
+};
+
+/**
+ * A texture atlas: images of any size packed into one texture, so that
+ * models with different images don't need a texture bind in between
+ */
+struct atlas {
+    std::vector<struct at_image> images; /*< Images, by ID */
+    std::vector<struct at_tile> tiles;   /*< Their tiles, once packed */
+    unsigned width, height;              /*< Size of the atlas, once packed */
+    enum bc_format format;               /*< Layout of its texels, to set before building tiles */
+};
+
+/**
+ * @brief Add an image. Its size is enough to pack it; its pixels are
+ *        only needed to build its tile.
+ * @param at The atlas
+ * @param img The image, whose pixels are taken
+ * @returns Its ID
+ */
+unsigned at_add (struct atlas * at, struct at_image * img);
+
+/**
+ * @brief Lay the images out. The largest are halved until they all fit;
+ *        those that failed to load get no tile.
+ * @param at The atlas
+ * @param max_size Largest width or height of the atlas
+ * @returns Whether they fit; if not, even at their smallest, no image
+ *          gets a tile
+ */
+bool at_pack (struct atlas * at, unsigned max_size);
+
+/**
+ * @brief Build an image's tile on every level, compressed if the atlas
+ *        is, and free the image's pixels. Tiles may be built concurrently.
+ * @param at The packed atlas
+ * @param id The image, with its pixels
+ */
+void at_build (struct atlas * at, unsigned id);
+
+/**
+ * @brief Size of a tile on every level
+ * @param at The atlas
+ * @param id The image
+ * @returns Its size in bytes
+ */
+size_t at_tile_size (const struct atlas * at, unsigned id);
+
+/**
+ * @brief Where a level of a tile starts in its mips
+ * @param at The atlas
+ * @param id The image
+ * @param level The level, `width >> level` by `height >> level`
+ * @returns Its offset in bytes
+ */
+size_t at_level_offset (const struct atlas * at, unsigned id, unsigned level);
+
+/**
+ * @brief Halve an image, averaging every 2x2 texels; the last row and
+ *        column of an odd size are averaged in with the one before
+ * @param img The image, with its pixels
+ */
+void at_halve (struct at_image * img);
+
+/**
+ * @brief Free a tile, once it's been uploaded
+ * @param at The atlas
+ * @param id The image
+ */
+void at_release (struct atlas * at, unsigned id);
+
+/**
+ * @brief Where an image is in the packed atlas, in texture coordinates
+ * @param at The atlas
+ * @param id The image
+ * @param[out] rect Its lower left corner, width and height
+ */
+void at_rect (const struct atlas * at, unsigned id, float rect[4]);
+
+#endif /* _ATLAS_H */
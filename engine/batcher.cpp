@@ -0,0 +1,208 @@
+#include "batcher.h"
+#include "simd.h"
+#include "workers.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+/** Guessed time of a draw, in ns, until one is measured */
+#define BT_DRAW_COST 2000
+
+/** Guessed time to batch a vertex, in ns, until one is measured */
+#define BT_VERTEX_COST 4
+
+void bt_init (struct batcher * b, unsigned max_vertices)
+{
+    b->max_vertices = max_vertices;
+    b->meshes.clear();
+    b->length = 0;
+    b->draw_cost = BT_DRAW_COST;
+    b->vertex_cost = BT_VERTEX_COST;
+    memset(&b->stats, 0, sizeof(b->stats));
+}
+
+unsigned bt_add_mesh (struct batcher * b, const std::vector<struct Point> * vertices, const std::vector<struct Point> * normals, const std::vector<struct Point> * tcoords)
+{
+    struct bt_mesh mesh;
+    mesh.length = vertices->size();
+
+    /* the padding is transformed along, and never copied out */
+    size_t padded = (mesh.length + VF_WIDTH - 1) / VF_WIDTH * VF_WIDTH;
+    mesh.x.assign(padded, 0);
+    mesh.y.assign(padded, 0);
+    mesh.z.assign(padded, 0);
+    mesh.nx.assign(padded, 0);
+    mesh.ny.assign(padded, 0);
+    mesh.nz.assign(padded, 1);
+    mesh.tcoords.assign(2 * mesh.length, 0);
+
+    for (unsigned i = 0; i < mesh.length; i++) {
+        mesh.x[i] = (*vertices)[i].x;
+        mesh.y[i] = (*vertices)[i].y;
+        mesh.z[i] = (*vertices)[i].z;
+        if (i < normals->size()) {
+            mesh.nx[i] = (*normals)[i].x;
+            mesh.ny[i] = (*normals)[i].y;
+            mesh.nz[i] = (*normals)[i].z;
+        }
+        if (i < tcoords->size()) {
+            mesh.tcoords[2 * i] = (*tcoords)[i].x;
+            mesh.tcoords[2 * i + 1] = (*tcoords)[i].y;
+        }
+    }
+
+    b->meshes.push_back(mesh);
+    return b->meshes.size() - 1;
+}
+
+void bt_reserve (struct batcher * b, size_t n_items, size_t n_mats, size_t n_vertices)
+{
+    b->items.reserve(n_items);
+    b->sorted.resize(n_items);
+    b->offsets.assign(n_mats + 1, 0);
+    b->groups.reserve(n_mats);
+    b->jobs.reserve(n_items);
+    b->vertices.assign(3 * n_vertices, 0);
+    b->normals.assign(3 * n_vertices, 0);
+    b->tcoords.assign(2 * n_vertices, 0);
+}
+
+void bt_begin (struct batcher * b)
+{
+    b->items.clear();
+}
+
+void bt_push (struct batcher * b, unsigned mesh, unsigned id, unsigned mat, const struct mat4 * world, float depth)
+{
+    struct bt_item item = { mesh, id, mat, world, depth, 0, };
+    b->items.push_back(item);
+}
+
+/**
+ * @brief Task of `bt_build`: transform an item into the stream,
+ *        `VF_WIDTH` vertices at a time
+ */
+static void bt_transform (void * ctx, unsigned job)
+{
+    struct batcher * b = (struct batcher *) ctx;
+    const struct bt_item * item = &b->sorted[b->jobs[job]];
+    const struct bt_mesh * mesh = &b->meshes[item->mesh];
+    const float * m = item->world->m;
+
+    /* normals go through the inverse transpose: the cofactors over the determinant */
+    float c[9] = {
+        m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+        m[9] * m[2] - m[10] * m[1], m[10] * m[0] - m[8] * m[2], m[8] * m[1] - m[9] * m[0],
+        m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4],
+    };
+    float sign = (m[0] * c[0] + m[1] * c[1] + m[2] * c[2] < 0) ? -1 : 1;
+
+    vf m0 = vf_set1(m[0]), m1 = vf_set1(m[1]), m2 = vf_set1(m[2]);
+    vf m4 = vf_set1(m[4]), m5 = vf_set1(m[5]), m6 = vf_set1(m[6]);
+    vf m8 = vf_set1(m[8]), m9 = vf_set1(m[9]), m10 = vf_set1(m[10]);
+    vf m12 = vf_set1(m[12]), m13 = vf_set1(m[13]), m14 = vf_set1(m[14]);
+    vf c0 = vf_set1(sign * c[0]), c1 = vf_set1(sign * c[1]), c2 = vf_set1(sign * c[2]);
+    vf c3 = vf_set1(sign * c[3]), c4 = vf_set1(sign * c[4]), c5 = vf_set1(sign * c[5]);
+    vf c6 = vf_set1(sign * c[6]), c7 = vf_set1(sign * c[7]), c8 = vf_set1(sign * c[8]);
+
+    float * vertices = &b->vertices[3 * item->first];
+    float * normals = &b->normals[3 * item->first];
+
+    for (unsigned i = 0; i < mesh->length; i += VF_WIDTH) {
+        vf x = vf_load(&mesh->x[i]), y = vf_load(&mesh->y[i]), z = vf_load(&mesh->z[i]);
+        vf px = vf_fmadd(m0, x, vf_fmadd(m4, y, vf_fmadd(m8, z, m12)));
+        vf py = vf_fmadd(m1, x, vf_fmadd(m5, y, vf_fmadd(m9, z, m13)));
+        vf pz = vf_fmadd(m2, x, vf_fmadd(m6, y, vf_fmadd(m10, z, m14)));
+
+        vf nx = vf_load(&mesh->nx[i]), ny = vf_load(&mesh->ny[i]), nz = vf_load(&mesh->nz[i]);
+        vf qx = vf_fmadd(c0, nx, vf_fmadd(c3, ny, vf_mul(c6, nz)));
+        vf qy = vf_fmadd(c1, nx, vf_fmadd(c4, ny, vf_mul(c7, nz)));
+        vf qz = vf_fmadd(c2, nx, vf_fmadd(c5, ny, vf_mul(c8, nz)));
+        vf len = vf_sqrt(vf_fmadd(qx, qx, vf_fmadd(qy, qy, vf_mul(qz, qz))));
+        len = vf_max(len, vf_set1(1e-20f));
+
+        /* GL wants them interleaved */
+        float out[6][VF_WIDTH];
+        vf_store(out[0], px);
+        vf_store(out[1], py);
+        vf_store(out[2], pz);
+        vf_store(out[3], vf_div(qx, len));
+        vf_store(out[4], vf_div(qy, len));
+        vf_store(out[5], vf_div(qz, len));
+
+        unsigned n = (mesh->length - i < VF_WIDTH) ? mesh->length - i : VF_WIDTH;
+        for (unsigned j = 0; j < n; j++) {
+            float * v = &vertices[3 * (i + j)];
+            float * nrm = &normals[3 * (i + j)];
+            v[0] = out[0][j]; v[1] = out[1][j]; v[2] = out[2][j];
+            nrm[0] = out[3][j]; nrm[1] = out[4][j]; nrm[2] = out[5][j];
+        }
+    }
+
+    std::copy(mesh->tcoords.begin(), mesh->tcoords.end(), &b->tcoords[2 * item->first]);
+}
+
+void bt_build (struct batcher * b)
+{
+    b->groups.clear();
+    b->jobs.clear();
+    b->length = 0;
+    memset(&b->stats, 0, sizeof(b->stats));
+    b->stats.items = b->items.size();
+
+    /* counting sort by material */
+    std::fill(b->offsets.begin(), b->offsets.end(), 0);
+    for (const struct bt_item & item : b->items)
+        b->offsets[item.mat + 1]++;
+    for (size_t m = 1; m < b->offsets.size(); m++)
+        b->offsets[m] += b->offsets[m - 1];
+
+    for (size_t m = 0; m + 1 < b->offsets.size(); m++) {
+        if (b->offsets[m] == b->offsets[m + 1])
+            continue;
+        struct bt_group group = { (unsigned) m, b->offsets[m], 0, 0, 0, INFINITY, false, };
+        b->groups.push_back(group);
+    }
+
+    for (const struct bt_item & item : b->items) {
+        unsigned k = b->offsets[item.mat]++;
+        b->sorted[k] = item;
+    }
+
+    /* batching a group costs its vertices and one draw, instead of a draw per item */
+    for (struct bt_group & group : b->groups) {
+        group.count = b->offsets[group.mat] - group.first;
+        for (unsigned k = group.first; k < group.first + group.count; k++) {
+            group.length += b->meshes[b->sorted[k].mesh].length;
+            group.depth = fminf(group.depth, b->sorted[k].depth);
+        }
+
+        group.batched = group.count > 1
+            && group.length * b->vertex_cost + b->draw_cost < group.count * b->draw_cost;
+        if (!group.batched)
+            continue;
+
+        group.vertex = b->length;
+        for (unsigned k = group.first; k < group.first + group.count; k++) {
+            b->sorted[k].first = b->length;
+            b->length += b->meshes[b->sorted[k].mesh].length;
+            b->jobs.push_back(k);
+        }
+        b->stats.batches++;
+        b->stats.batched += group.count;
+    }
+
+    b->stats.vertices = b->length;
+    if (!b->jobs.empty())
+        wk_run(bt_transform, b, b->jobs.size());
+}
+
+void bt_measure (struct batcher * b, float draw_ns, unsigned draws, float batch_ns)
+{
+    if (draws > 0)
+        b->draw_cost += (draw_ns / draws - b->draw_cost) * BT_COST_WEIGHT;
+    if (b->length > 0)
+        b->vertex_cost += (batch_ns / b->length - b->vertex_cost) * BT_COST_WEIGHT;
+}
@@ -0,0 +1,145 @@
+#ifndef _BATCHER_H
+#define _BATCHER_H
+
+#include "../generator/generators.h"
+#include "mat4.h"
+
+#include <stddef.h>
+
+#include <vector>
+
+/** Meshes with at most this many vertices are batched, by default */
+#define BT_MAX_VERTICES 512
+
+/** Weight of a new measurement in the running cost averages */
+#define BT_COST_WEIGHT 0.05f
+
+/**
+ * A mesh small enough to batch, with its vertex data laid out by
+ * component and padded to a multiple of `VF_WIDTH`
+ */
+struct bt_mesh {
+    unsigned length;               /*< Vertex count */
+    std::vector<float> x, y, z;    /*< Positions */
+    std::vector<float> nx, ny, nz; /*< Normals */
+    std::vector<float> tcoords;    /*< Texture coordinates, interleaved */
+};
+
+/**
+ * A model instance submitted for batching
+ */
+struct bt_item {
+    unsigned mesh;             /*< Index into `batcher::meshes` */
+    unsigned id;               /*< The caller's ID of the mesh */
+    unsigned mat;              /*< Its material */
+    const struct mat4 * world; /*< Its world matrix */
+    float depth;               /*< Its distance from the camera */
+    unsigned first;            /*< First vertex of its copy in the stream */
+};
+
+/**
+ * The items of a material, drawn either as one batch or one by one
+ */
+struct bt_group {
+    unsigned mat;    /*< The material */
+    unsigned first;  /*< First item, in `batcher::sorted` */
+    unsigned count;  /*< Number of items */
+    unsigned vertex; /*< First vertex of the batch in the stream */
+    unsigned length; /*< Vertices of the batch */
+    float depth;     /*< Distance of the nearest item from the camera */
+    bool batched;    /*< Drawn as one batch? */
+};
+
+/**
+ * Statistics of the last frame
+ */
+struct bt_stats {
+    unsigned items;    /*< Items submitted */
+    unsigned batches;  /*< Batches built */
+    unsigned batched;  /*< Items drawn by them */
+    unsigned vertices; /*< Vertices transformed */
+};
+
+/**
+ * A dynamic batcher. Every frame, the small model instances submitted to
+ * it are grouped by material, and the groups where it's cheaper than
+ * drawing the instances one by one have them transformed to world space
+ * into one vertex stream, to draw with one call per group.
+ */
+struct batcher {
+    unsigned max_vertices;               /*< Largest mesh to batch */
+    std::vector<struct bt_mesh> meshes;  /*< Meshes to batch */
+    std::vector<struct bt_item> items;   /*< Items of the frame, as submitted */
+    std::vector<struct bt_item> sorted;  /*< `items`, by material */
+    std::vector<unsigned> offsets;       /*< Items per material, to sort them */
+    std::vector<struct bt_group> groups; /*< Groups of the frame */
+    std::vector<unsigned> jobs;          /*< Items of the batches, in `sorted` */
+    std::vector<float> vertices;         /*< The stream: positions, */
+    std::vector<float> normals;          /*< normals */
+    std::vector<float> tcoords;          /*< and texture coordinates */
+    unsigned length;                     /*< Vertices in the stream */
+    float draw_cost;                     /*< Measured time of a draw, in ns */
+    float vertex_cost;                   /*< Measured time to batch a vertex, in ns */
+    struct bt_stats stats;               /*< Statistics of the last frame */
+};
+
+/**
+ * @brief Set a batcher up, with costs guessed until they're measured
+ * @param b The batcher
+ * @param max_vertices Largest mesh to batch
+ */
+void bt_init (struct batcher * b, unsigned max_vertices);
+
+/**
+ * @brief Add a mesh to batch
+ * @param b The batcher
+ * @param vertices Its vertices
+ * @param normals Their normals
+ * @param tcoords Their texture coordinates
+ * @returns Its index in `batcher::meshes`
+ */
+unsigned bt_add_mesh (struct batcher * b, const std::vector<struct Point> * vertices, const std::vector<struct Point> * normals, const std::vector<struct Point> * tcoords);
+
+/**
+ * @brief Make room for a frame's worth of items, so that batching doesn't
+ *        allocate
+ * @param b The batcher
+ * @param n_items Most items a frame may submit
+ * @param n_mats Number of materials
+ * @param n_vertices Most vertices those items may have
+ */
+void bt_reserve (struct batcher * b, size_t n_items, size_t n_mats, size_t n_vertices);
+
+/**
+ * @brief Start a frame
+ */
+void bt_begin (struct batcher * b);
+
+/**
+ * @brief Submit a model instance
+ * @param b The batcher
+ * @param mesh Its mesh, in `batcher::meshes`
+ * @param id The caller's ID of the mesh
+ * @param mat Its material
+ * @param world Its world matrix, which must stay put until the frame is built
+ * @param depth Its distance from the camera
+ */
+void bt_push (struct batcher * b, unsigned mesh, unsigned id, unsigned mat, const struct mat4 * world, float depth);
+
+/**
+ * @brief Group the items of the frame, decide which groups to batch, and
+ *        transform those on the workers
+ * @param b The batcher
+ */
+void bt_build (struct batcher * b);
+
+/**
+ * @brief Feed back how long the frame took, to decide on the next
+ * @param b The batcher
+ * @param draw_ns Time spent drawing
+ * @param draws Number of draws
+ * @param batch_ns Time spent building and uploading the stream
+ */
+void bt_measure (struct batcher * b, float draw_ns, unsigned draws, float batch_ns);
+
+#endif /* _BATCHER_H */
@@ -0,0 +1,178 @@
+#include "bcn.h"
+#include "simd.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+enum bc_format bc_parse (const char * name, enum bc_format def)
+{
+    return (strcmp(name, "BC1") == 0) ? BC_BC1
+        : (strcmp(name, "BC3") == 0) ? BC_BC3
+        : (strcmp(name, "RGBA") == 0) ? BC_RGBA
+        : def;
+}
+
+size_t bc_size (enum bc_format f, unsigned width, unsigned height)
+{
+    size_t texels = (size_t) width * height;
+    switch (f) {
+        case BC_BC1: return texels / 2;
+        case BC_BC3: return texels;
+        default:     return 4 * texels;
+    }
+}
+
+/**
+ * @brief A color in 565, rounded
+ */
+static inline unsigned bc_565 (const int c[3])
+{
+    return ((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 | ((c[2] * 31 + 127) / 255);
+}
+
+/**
+ * @brief A 565 color back in 8 bits per channel, as the GPU decodes it
+ */
+static inline void bc_888 (unsigned c, float out[3])
+{
+    unsigned r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (b << 3) | (b >> 2);
+}
+
+/**
+ * @brief Compress a block's colors, `VF_WIDTH` texels at a time
+ * @param texels The block's 16 texels
+ * @param lo Smallest of each channel
+ * @param hi Largest of each channel
+ * @param[out] out 8 bytes
+ */
+static void bc_color (const unsigned char * texels, const unsigned char * lo, const unsigned char * hi, unsigned char * out)
+{
+    /* inset the box by a 16th on each side: it's closer to most colors */
+    int c0[3], c1[3];
+    for (unsigned c = 0; c < 3; c++) {
+        int inset = (hi[c] - lo[c]) >> 4;
+        c0[c] = hi[c] - inset;
+        c1[c] = lo[c] + inset;
+    }
+
+    /* `c0` is never below `c1`, so the block has 4 colors and no transparency */
+    unsigned e0 = bc_565(c0), e1 = bc_565(c1);
+    uint32_t indices = 0;
+
+    if (e0 != e1) {
+        float p0[3], p1[3];
+        bc_888(e0, p0);
+        bc_888(e1, p1);
+
+        /* project every texel on the line between them, in thirds */
+        float d[3] = { p0[0] - p1[0], p0[1] - p1[1], p0[2] - p1[2], };
+        float scale = 3 / (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        vf dr = vf_set1(d[0] * scale), dg = vf_set1(d[1] * scale), db = vf_set1(d[2] * scale);
+        vf r1 = vf_set1(p1[0]), g1 = vf_set1(p1[1]), b1 = vf_set1(p1[2]);
+
+        float r[16], g[16], b[16], k[16];
+        for (unsigned i = 0; i < 16; i++) {
+            r[i] = texels[4 * i];
+            g[i] = texels[4 * i + 1];
+            b[i] = texels[4 * i + 2];
+        }
+        for (unsigned i = 0; i < 16; i += VF_WIDTH) {
+            vf t = vf_mul(vf_sub(vf_load(&r[i]), r1), dr);
+            t = vf_fmadd(vf_sub(vf_load(&g[i]), g1), dg, t);
+            t = vf_fmadd(vf_sub(vf_load(&b[i]), b1), db, t);
+            t = vf_floor(vf_add(t, vf_set1(0.5f)));
+            vf_store(&k[i], vf_min(vf_max(t, vf_set1(0)), vf_set1(3)));
+        }
+
+        /* thirds from `c1` to `c0`, as the indices of the colors */
+        static const unsigned order[4] = { 1, 3, 2, 0, };
+        for (unsigned i = 0; i < 16; i++)
+            indices |= order[(unsigned) k[i]] << (2 * i);
+    }
+
+    out[0] = e0 & 0xff;
+    out[1] = e0 >> 8;
+    out[2] = e1 & 0xff;
+    out[3] = e1 >> 8;
+    for (unsigned i = 0; i < 4; i++)
+        out[4 + i] = indices >> (8 * i);
+}
+
+/**
+ * @brief Compress a block's alpha, `VF_WIDTH` texels at a time
+ * @param texels The block's 16 texels
+ * @param lo Smallest alpha
+ * @param hi Largest alpha
+ * @param[out] out 8 bytes
+ */
+static void bc_alpha (const unsigned char * texels, unsigned char lo, unsigned char hi, unsigned char * out)
+{
+    /* with the largest first, there are 6 values in between */
+    uint64_t indices = 0;
+    if (hi > lo) {
+        float a[16], k[16];
+        for (unsigned i = 0; i < 16; i++)
+            a[i] = texels[4 * i + 3];
+
+        vf scale = vf_set1(7.0f / (hi - lo)), base = vf_set1(lo);
+        for (unsigned i = 0; i < 16; i += VF_WIDTH) {
+            vf t = vf_floor(vf_fmadd(vf_sub(vf_load(&a[i]), base), scale, vf_set1(0.5f)));
+            vf_store(&k[i], vf_min(vf_max(t, vf_set1(0)), vf_set1(7)));
+        }
+
+        /* sevenths from `lo` to `hi`, as the indices of the values */
+        static const unsigned order[8] = { 1, 7, 6, 5, 4, 3, 2, 0, };
+        for (unsigned i = 0; i < 16; i++)
+            indices |= (uint64_t) order[(unsigned) k[i]] << (3 * i);
+    }
+
+    out[0] = hi;
+    out[1] = lo;
+    for (unsigned i = 0; i < 6; i++)
+        out[2 + i] = indices >> (8 * i);
+}
+
+void bc_encode (enum bc_format f, const unsigned char * rgba, unsigned width, unsigned height, unsigned char * out)
+{
+    assert(f != BC_RGBA && width % 4 == 0 && height % 4 == 0);
+    size_t row = 4 * (size_t) width;
+
+    for (unsigned y = 0; y < height; y += 4) {
+        for (unsigned x = 0; x < width; x += 4) {
+            unsigned char texels[64];
+            for (unsigned i = 0; i < 4; i++)
+                memcpy(&texels[16 * i], &rgba[(y + i) * row + 4 * x], 16);
+
+            /* the box the block's colors span, `VB_WIDTH / 4` texels at a time */
+            vb vlo = vb_load(texels), vhi = vlo;
+            for (unsigned i = VB_WIDTH; i < sizeof(texels); i += VB_WIDTH) {
+                vb v = vb_load(&texels[i]);
+                vlo = vb_min(vlo, v);
+                vhi = vb_max(vhi, v);
+            }
+
+            unsigned char los[VB_WIDTH], his[VB_WIDTH], lo[4], hi[4];
+            vb_store(los, vlo);
+            vb_store(his, vhi);
+            memcpy(lo, los, 4);
+            memcpy(hi, his, 4);
+            for (unsigned i = 4; i < VB_WIDTH; i++) {
+                lo[i % 4] = std::min(lo[i % 4], los[i]);
+                hi[i % 4] = std::max(hi[i % 4], his[i]);
+            }
+
+            if (f == BC_BC3) {
+                bc_alpha(texels, lo[3], hi[3], out);
+                out += 8;
+            }
+            bc_color(texels, lo, hi, out);
+            out += 8;
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef _BCN_H
+#define _BCN_H
+
+#include <stddef.h>
+
+/**
+ * Layouts of texels: plain, or compressed in 4x4 blocks (S3TC)
+ */
+enum bc_format {
+    BC_RGBA, /*< 8 bits per channel, 4 bytes per texel */
+    BC_BC1,  /*< DXT1: 565 colors, no alpha, 8 bytes per block */
+    BC_BC3,  /*< DXT5: BC1 colors and interpolated alpha, 16 bytes per block */
+};
+
+/**
+ * @brief A format by name: "BC1", "BC3" or "RGBA"
+ * @param name The name
+ * @param def The format if it's none of those
+ */
+enum bc_format bc_parse (const char * name, enum bc_format def);
+
+/**
+ * @brief Size of an image in a format
+ * @param f The format
+ * @param width Its width, a multiple of 4 if it's compressed
+ * @param height Its height, likewise
+ * @returns Its size in bytes
+ */
+size_t bc_size (enum bc_format f, unsigned width, unsigned height);
+
+/**
+ * @brief Compress an image. Each block's endpoints are the corners of the
+ *        box its colors span, a bit inset, and its texels take whichever
+ *        of the 4 (or 8, for alpha) colors in between is nearest: not the
+ *        best endpoints, but fast enough to compress on load.
+ * @param f The format, compressed
+ * @param rgba The image, 8 bits per channel, rows first
+ * @param width Its width, a multiple of 4
+ * @param height Its height, a multiple of 4
+ * @param[out] out `bc_size(f, width, height)` bytes
+ */
+void bc_encode (enum bc_format f, const unsigned char * rgba, unsigned width, unsigned height, unsigned char * out);
+
+#endif /* _BCN_H */
@@ -0,0 +1,92 @@
+#ifndef _BOUNDS_H
+#define _BOUNDS_H
+
+#include "../generator/generators.h"
+#include "mat4.h"
+
+#include <float.h>
+#include <math.h>
+
+/**
+ * An axis-aligned bounding box. It's empty if `min` is greater than `max`.
+ */
+struct aabb {
+    struct Point min;
+    struct Point max;
+};
+
+/**
+ * @brief A box with nothing in it, the identity of `bb_union`
+ */
+static inline struct aabb bb_empty (void)
+{
+    struct aabb ret;
+    ret.min = Point(FLT_MAX, FLT_MAX, FLT_MAX);
+    ret.max = Point(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    return ret;
+}
+
+static inline bool bb_is_empty (const struct aabb * b)
+{
+    return b->min.x > b->max.x;
+}
+
+/**
+ * @brief Grow a box to hold a point
+ */
+static inline void bb_add (struct aabb * b, struct Point p)
+{
+    b->min = Point(fminf(b->min.x, p.x), fminf(b->min.y, p.y), fminf(b->min.z, p.z));
+    b->max = Point(fmaxf(b->max.x, p.x), fmaxf(b->max.y, p.y), fmaxf(b->max.z, p.z));
+}
+
+/**
+ * @brief Smallest box holding two boxes
+ */
+static inline struct aabb bb_union (const struct aabb * a, const struct aabb * b)
+{
+    struct aabb ret = *a;
+    if (!bb_is_empty(b)) {
+        bb_add(&ret, b->min);
+        bb_add(&ret, b->max);
+    }
+    return ret;
+}
+
+static inline struct Point bb_center (const struct aabb * b)
+{
+    return (b->min + b->max) / 2;
+}
+
+static inline struct Point bb_extent (const struct aabb * b)
+{
+    return (b->max - b->min) / 2;
+}
+
+/**
+ * @brief Box holding a transformed box, without transforming its corners
+ * @param m The transformation
+ * @param b The box
+ */
+static inline struct aabb bb_transform (const struct mat4 * m, const struct aabb * b)
+{
+    if (bb_is_empty(b))
+        return *b;
+
+    struct Point c = m4_transform_point(m, bb_center(b));
+    struct Point e = bb_extent(b);
+
+    /* each axis of the result grows by the projection of every axis of `b` */
+    struct Point r = Point(
+            fabsf(m->m[0]) * e.x + fabsf(m->m[4]) * e.y + fabsf(m->m[8])  * e.z,
+            fabsf(m->m[1]) * e.x + fabsf(m->m[5]) * e.y + fabsf(m->m[9])  * e.z,
+            fabsf(m->m[2]) * e.x + fabsf(m->m[6]) * e.y + fabsf(m->m[10]) * e.z
+            );
+
+    struct aabb ret;
+    ret.min = c - r;
+    ret.max = c + r;
+    return ret;
+}
+
+#endif /* _BOUNDS_H */
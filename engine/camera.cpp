@@ -0,0 +1,90 @@
+#include "camera.h"
+
+#include <math.h>
+
+static inline bool cam_point_eq (struct Point a, struct Point b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+/**
+ * @brief Extract the frustum planes from a projection * view matrix
+ *        (Gribb & Hartmann): each plane is the last row of the matrix
+ *        plus or minus one of the others
+ * @param frst Where to save the planes
+ * @param m The matrix, column-major
+ */
+static void cam_extract_frustum (struct cl_frustum * frst, const struct mat4 * m)
+{
+    for (unsigned i = 0; i < 6; i++) {
+        unsigned row = i / 2;
+        float sign = (i % 2 == 0) ? 1 : -1;
+
+        float a = m->m[3]  + sign * m->m[row];
+        float b = m->m[7]  + sign * m->m[4 + row];
+        float c = m->m[11] + sign * m->m[8 + row];
+        float d = m->m[15] + sign * m->m[12 + row];
+
+        /* normalized, so distances are in world units */
+        float len = sqrtf(a * a + b * b + c * c);
+        cl_set_plane(frst, i, Point(a / len, b / len, c / len), d / len);
+    }
+}
+
+void cam_look_at (struct camera * cam, struct Point eye, struct Point center, struct Point up)
+{
+    if (cam_point_eq(cam->eye, eye) && cam_point_eq(cam->center, center) && cam_point_eq(cam->up, up))
+        return;
+
+    cam->eye = eye;
+    cam->center = center;
+    cam->up = up;
+    cam->dirty = true;
+}
+
+void cam_perspective (struct camera * cam, float fovy, unsigned width, unsigned height, float znear, float zfar)
+{
+    if (height == 0)
+        height = 1;
+
+    if (cam->fovy == fovy && cam->width == width && cam->height == height
+            && cam->znear == znear && cam->zfar == zfar)
+        return;
+
+    cam->fovy = fovy;
+    cam->width = width;
+    cam->height = height;
+    cam->znear = znear;
+    cam->zfar = zfar;
+    cam->dirty = true;
+}
+
+void cam_update (struct camera * cam)
+{
+    if (!cam->dirty)
+        return;
+
+    cam->view = m4_look_at(cam->eye, cam->center, cam->up);
+    cam->proj = m4_perspective(cam->fovy, (float) cam->width / cam->height, cam->znear, cam->zfar);
+
+    cam->clip = m4_mul(&cam->proj, &cam->view);
+    cam_extract_frustum(&cam->frustum, &cam->clip);
+
+    cam->lod_scale = cam->height / (2 * tanf(cam->fovy * (float) M_PI / 360));
+    cam->dirty = false;
+}
+
+void cam_ray (const struct camera * cam, int x, int y, struct Point * origin, struct Point * dir)
+{
+    /* the pixel's center, from -1 to 1 across the viewport */
+    float nx = 2 * (x + 0.5f) / cam->width - 1;
+    float ny = 1 - 2 * (y + 0.5f) / cam->height;
+    float h = tanf(cam->fovy * (float) M_PI / 360);
+    float w = h * cam->width / cam->height;
+
+    struct Point f = normalize(cam->center - cam->eye);
+    struct Point s = normalize(crossProduct(f, cam->up));
+    struct Point u = crossProduct(s, f);
+    *origin = cam->eye;
+    *dir = f + (nx * w) * s + (ny * h) * u;
+}
@@ -0,0 +1,64 @@
+#ifndef _CAMERA_H
+#define _CAMERA_H
+
+#include "../generator/generators.h"
+#include "cull.h"
+#include "mat4.h"
+
+/**
+ * A camera: where it is and how it projects. Its matrices and frustum are
+ * derived from those and only recomputed when one of them changes, so any
+ * number of cameras can be kept around and drawn with.
+ */
+struct camera {
+    struct Point eye;    /*< Position */
+    struct Point center; /*< Point looked at */
+    struct Point up;     /*< Up direction */
+
+    float fovy;          /*< Vertical field of view, in degrees */
+    float znear;         /*< Near plane distance */
+    float zfar;          /*< Far plane distance */
+    unsigned width;      /*< Viewport size, in pixels */
+    unsigned height;
+
+    bool dirty;          /*< Has something changed since `cam_update`? */
+
+    struct mat4 view;           /*< View matrix */
+    struct mat4 proj;           /*< Projection matrix */
+    struct mat4 clip;           /*< Projection * view */
+    struct cl_frustum frustum;  /*< World space frustum, normals pointing inwards */
+    float lod_scale;            /*< Pixels per unit at distance 1 from the eye */
+};
+
+/**
+ * @brief Place a camera, same as `gluLookAt`
+ * @param cam The camera
+ */
+void cam_look_at (struct camera * cam, struct Point eye, struct Point center, struct Point up);
+
+/**
+ * @brief Set a camera's projection, same as `gluPerspective` over a
+ *        viewport
+ * @param cam The camera
+ * @param fovy Vertical field of view, in degrees
+ * @param width,height Viewport size, in pixels
+ * @param znear,zfar Clipping planes distances
+ */
+void cam_perspective (struct camera * cam, float fovy, unsigned width, unsigned height, float znear, float zfar);
+
+/**
+ * @brief Recompute a camera's matrices and frustum, if it changed
+ * @param cam The camera
+ */
+void cam_update (struct camera * cam);
+
+/**
+ * @brief The ray from a camera's eye through a pixel
+ * @param cam The camera, up to date
+ * @param x,y The pixel, from the top left corner of the viewport
+ * @param[out] origin Where the ray starts: the eye
+ * @param[out] dir Its direction, not normalized
+ */
+void cam_ray (const struct camera * cam, int x, int y, struct Point * origin, struct Point * dir);
+
+#endif /* _CAMERA_H */
@@ -0,0 +1,133 @@
+#include "cull.h"
+#include "simd.h"
+
+#include <float.h>
+#include <math.h>
+
+void cl_set_plane (struct cl_frustum * frst, unsigned i, struct Point n, float d)
+{
+    frst->nx[i] = n.x;
+    frst->ny[i] = n.y;
+    frst->nz[i] = n.z;
+    frst->d[i] = d;
+}
+
+enum cl_result cl_cull_box (const struct cl_frustum * frst, const struct aabb * b)
+{
+    if (bb_is_empty(b))
+        return CL_OUT;
+
+    struct Point c = bb_center(b);
+    struct Point e = bb_extent(b);
+    enum cl_result ret = CL_IN;
+
+    for (unsigned i = 0; i < 6; i++) {
+        /* signed distance of the center, and how far the box reaches along n */
+        float dist = frst->nx[i] * c.x + frst->ny[i] * c.y + frst->nz[i] * c.z + frst->d[i];
+        float reach = fabsf(frst->nx[i]) * e.x + fabsf(frst->ny[i]) * e.y + fabsf(frst->nz[i]) * e.z;
+
+        if (dist + reach < 0)
+            return CL_OUT;
+        if (dist - reach < 0)
+            ret = CL_PARTIAL;
+    }
+
+    return ret;
+}
+
+void cl_reserve (struct cl_spheres * spheres, size_t n)
+{
+    /* room for padding the last block too */
+    size_t padded = n + VF_WIDTH;
+    spheres->x.reserve(padded);
+    spheres->y.reserve(padded);
+    spheres->z.reserve(padded);
+    spheres->r.reserve(padded);
+    spheres->id.reserve(padded);
+    spheres->visible.reserve(padded);
+}
+
+void cl_clear (struct cl_spheres * spheres)
+{
+    spheres->x.clear();
+    spheres->y.clear();
+    spheres->z.clear();
+    spheres->r.clear();
+    spheres->id.clear();
+    spheres->n = 0;
+}
+
+void cl_push (struct cl_spheres * spheres, struct Point c, float r, unsigned id)
+{
+    spheres->x.push_back(c.x);
+    spheres->y.push_back(c.y);
+    spheres->z.push_back(c.z);
+    spheres->r.push_back(r);
+    spheres->id.push_back(id);
+    spheres->n++;
+}
+
+/**
+ * @brief Signed distances of `VF_WIDTH` points to `VF_WIDTH` planes
+ */
+static inline vf cl_dist (vf nx, vf ny, vf nz, vf d, vf x, vf y, vf z)
+{
+    return vf_fmadd(nx, x, vf_fmadd(ny, y, vf_fmadd(nz, z, d)));
+}
+
+unsigned cl_cull (const struct cl_frustum * frst, struct cl_spheres * s, unsigned char * last_plane)
+{
+    unsigned n = s->n;
+    size_t padded = (n + VF_WIDTH - 1) / VF_WIDTH * VF_WIDTH;
+
+    /* padding is outside of everything */
+    s->x.resize(padded, 0);
+    s->y.resize(padded, 0);
+    s->z.resize(padded, 0);
+    s->r.resize(padded, -FLT_MAX);
+    s->id.resize(padded, 0);
+    s->visible.resize(n);
+
+    unsigned k = 0;
+    for (size_t i = 0; i < padded; i += VF_WIDTH) {
+        vf x = vf_load(&s->x[i]);
+        vf y = vf_load(&s->y[i]);
+        vf z = vf_load(&s->z[i]);
+        vf nr = vf_sub(vf_set1(0), vf_load(&s->r[i]));
+
+        /* try the plane that rejected each sphere last time first */
+        unsigned last[VF_WIDTH];
+        for (unsigned l = 0; l < VF_WIDTH; l++)
+            last[l] = (i + l < n) ? last_plane[s->id[i + l]] : 0;
+
+        vf dist = cl_dist(
+                vf_gather(frst->nx, last),
+                vf_gather(frst->ny, last),
+                vf_gather(frst->nz, last),
+                vf_gather(frst->d, last),
+                x, y, z);
+        int out = vf_mask(vf_lt(dist, nr));
+
+        for (unsigned p = 0; p < 6 && out != VF_ALL; p++) {
+            dist = cl_dist(
+                    vf_set1(frst->nx[p]),
+                    vf_set1(frst->ny[p]),
+                    vf_set1(frst->nz[p]),
+                    vf_set1(frst->d[p]),
+                    x, y, z);
+            int rejected = vf_mask(vf_lt(dist, nr)) & ~out;
+            out |= rejected;
+
+            for (unsigned l = 0; rejected != 0; l++, rejected >>= 1)
+                if ((rejected & 1) && i + l < n)
+                    last_plane[s->id[i + l]] = p;
+        }
+
+        for (unsigned l = 0; l < VF_WIDTH && i + l < n; l++)
+            if (!(out & (1 << l)))
+                s->visible[k++] = s->id[i + l];
+    }
+
+    s->visible.resize(k);
+    return k;
+}
@@ -0,0 +1,95 @@
+#ifndef _CULL_H
+#define _CULL_H
+
+#include "../generator/generators.h"
+#include "bounds.h"
+
+#include <stddef.h>
+
+#include <vector>
+
+/**
+ * The six planes of a frustum, as `n . p + d >= 0` for points inside,
+ * one array per coefficient so that a plane can be gathered per lane
+ */
+struct cl_frustum {
+    float nx[6];
+    float ny[6];
+    float nz[6];
+    float d[6];
+};
+
+/**
+ * A batch of bounding spheres to cull, structure-of-arrays. Its storage
+ * is kept between frames, so filling it doesn't allocate once reserved.
+ */
+struct cl_spheres {
+    std::vector<float> x;          /*< Centers */
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> r;          /*< Radii */
+    std::vector<unsigned> id;      /*< Whose sphere each one is */
+    std::vector<unsigned> visible; /*< Output: IDs of the spheres inside */
+    unsigned n;                    /*< Number of spheres */
+};
+
+/**
+ * Where a box is relative to a frustum
+ */
+enum cl_result {
+    CL_OUT,     /*< Completely outside */
+    CL_PARTIAL, /*< Crosses some plane */
+    CL_IN,      /*< Completely inside */
+};
+
+/**
+ * @brief Set a plane of a frustum
+ * @param frst The frustum
+ * @param i Index of the plane
+ * @param n Normal, pointing inwards
+ * @param d Offset, `-n . p` for a point `p` of the plane
+ */
+void cl_set_plane (struct cl_frustum * frst, unsigned i, struct Point n, float d);
+
+/**
+ * @brief Test a box against a frustum
+ * @param frst The frustum
+ * @param b The box
+ */
+enum cl_result cl_cull_box (const struct cl_frustum * frst, const struct aabb * b);
+
+/**
+ * @brief Make room for a number of spheres
+ * @param spheres The batch
+ * @param n Number of spheres
+ */
+void cl_reserve (struct cl_spheres * spheres, size_t n);
+
+/**
+ * @brief Empty a batch, keeping its storage
+ * @param spheres The batch
+ */
+void cl_clear (struct cl_spheres * spheres);
+
+/**
+ * @brief Add a sphere to a batch
+ * @param spheres The batch
+ * @param c Center
+ * @param r Radius
+ * @param id Its ID, an index into `last_plane`
+ */
+void cl_push (struct cl_spheres * spheres, struct Point c, float r, unsigned id);
+
+/**
+ * @brief Cull a batch of spheres against a frustum, `VF_WIDTH` spheres by
+ *        six planes at a time. Each sphere is first tested against the
+ *        plane it failed last time, which usually still rejects it.
+ * @param frst The frustum
+ * @param spheres The batch; `visible` is filled with the IDs of the
+ *        spheres that aren't completely outside, in batch order
+ * @param[in,out] last_plane Plane each ID last failed, indexed by ID
+ * @returns Number of visible spheres
+ */
+unsigned cl_cull (const struct cl_frustum * frst, struct cl_spheres * spheres, unsigned char * last_plane);
+
+#endif /* _CULL_H */
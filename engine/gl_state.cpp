@@ -0,0 +1,238 @@
+#include "gl_state.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define UNREACHABLE() assert(!"unreachable")
+
+/** Capabilities tracked by `gs_enable` */
+enum gs_cap {
+    GS_CAP_LIGHTING,
+    GS_CAP_TEXTURE_2D,
+    GS_CAP_DEPTH_TEST,
+    GS_CAP_CULL_FACE,
+    GS_CAP_LIGHT0, /* GS_CAP_LIGHT0 + i is GL_LIGHT0 + i */
+    GS_CAP_COUNT = GS_CAP_LIGHT0 + 8,
+};
+
+/** Client arrays tracked by `gs_client_state` and `gs_array_pointer` */
+enum gs_array {
+    GS_ARRAY_VERTEX,
+    GS_ARRAY_NORMAL,
+    GS_ARRAY_TEXCOORD,
+    GS_ARRAY_COUNT,
+};
+
+/** Material components tracked by `gs_material` */
+enum gs_mat {
+    GS_MAT_AMBIENT,
+    GS_MAT_DIFFUSE,
+    GS_MAT_SPECULAR,
+    GS_MAT_EMISSION,
+    GS_MAT_COUNT,
+};
+
+/**
+ * The shadowed state. Every entry has a `known` flag: an unknown entry
+ * is always forwarded to GL.
+ */
+static struct {
+    bool caps_known[GS_CAP_COUNT];
+    bool caps[GS_CAP_COUNT];
+
+    bool client_known[GS_ARRAY_COUNT];
+    bool client[GS_ARRAY_COUNT];
+
+    bool pointer_known[GS_ARRAY_COUNT];
+    GLuint pointer_buffer[GS_ARRAY_COUNT];
+    GLint pointer_size[GS_ARRAY_COUNT];
+
+    bool buffer_known;
+    GLuint buffer;
+
+    bool texture_known;
+    GLuint texture;
+
+    bool program_known;
+    GLuint program;
+
+    bool rect_known;
+    GLfloat rect[4];
+
+    bool mat_known[GS_MAT_COUNT];
+    GLfloat mat[GS_MAT_COUNT][4];
+
+    struct gs_stats stats;
+} gs;
+
+static enum gs_cap gs_cap_index (GLenum cap)
+{
+    switch (cap) {
+        case GL_LIGHTING:   return GS_CAP_LIGHTING;
+        case GL_TEXTURE_2D: return GS_CAP_TEXTURE_2D;
+        case GL_DEPTH_TEST: return GS_CAP_DEPTH_TEST;
+        case GL_CULL_FACE:  return GS_CAP_CULL_FACE;
+        default:
+            assert(cap >= GL_LIGHT0 && cap < GL_LIGHT0 + 8);
+            return (enum gs_cap) (GS_CAP_LIGHT0 + (cap - GL_LIGHT0));
+    }
+}
+
+static enum gs_array gs_array_index (GLenum array)
+{
+    switch (array) {
+        case GL_VERTEX_ARRAY:        return GS_ARRAY_VERTEX;
+        case GL_NORMAL_ARRAY:        return GS_ARRAY_NORMAL;
+        case GL_TEXTURE_COORD_ARRAY: return GS_ARRAY_TEXCOORD;
+        default: UNREACHABLE(); return GS_ARRAY_VERTEX;
+    }
+}
+
+static enum gs_mat gs_mat_index (GLenum pname)
+{
+    switch (pname) {
+        case GL_AMBIENT:  return GS_MAT_AMBIENT;
+        case GL_DIFFUSE:  return GS_MAT_DIFFUSE;
+        case GL_SPECULAR: return GS_MAT_SPECULAR;
+        case GL_EMISSION: return GS_MAT_EMISSION;
+        default: UNREACHABLE(); return GS_MAT_AMBIENT;
+    }
+}
+
+/**
+ * @brief Count a call and tell whether it has to reach GL
+ * @param known Is the current value known?
+ * @param same Is the new value the same as the current one?
+ */
+static inline bool gs_should_issue (bool known, bool same)
+{
+    bool issue = !known || !same;
+    if (issue)
+        gs.stats.issued++;
+    else
+        gs.stats.elided++;
+    return issue;
+}
+
+void gs_invalidate (void)
+{
+    struct gs_stats stats = gs.stats;
+    memset(&gs, 0, sizeof(gs));
+    gs.stats = stats;
+}
+
+void gs_enable (GLenum cap, bool on)
+{
+    enum gs_cap i = gs_cap_index(cap);
+    if (!gs_should_issue(gs.caps_known[i], gs.caps[i] == on))
+        return;
+
+    if (on)
+        glEnable(cap);
+    else
+        glDisable(cap);
+    gs.caps_known[i] = true;
+    gs.caps[i] = on;
+}
+
+void gs_client_state (GLenum array, bool on)
+{
+    enum gs_array i = gs_array_index(array);
+    if (!gs_should_issue(gs.client_known[i], gs.client[i] == on))
+        return;
+
+    if (on)
+        glEnableClientState(array);
+    else
+        glDisableClientState(array);
+    gs.client_known[i] = true;
+    gs.client[i] = on;
+}
+
+void gs_bind_buffer (GLuint id)
+{
+    if (!gs_should_issue(gs.buffer_known, gs.buffer == id))
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    gs.buffer_known = true;
+    gs.buffer = id;
+}
+
+void gs_bind_texture (GLuint id)
+{
+    if (!gs_should_issue(gs.texture_known, gs.texture == id))
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, id);
+    gs.texture_known = true;
+    gs.texture = id;
+}
+
+void gs_use_program (GLuint id)
+{
+    if (!gs_should_issue(gs.program_known, gs.program == id))
+        return;
+
+    glUseProgram(id);
+    gs.program_known = true;
+    gs.program = id;
+}
+
+void gs_texture_rect (const GLfloat rect[4])
+{
+    bool same = memcmp(gs.rect, rect, sizeof(gs.rect)) == 0;
+    if (!gs_should_issue(gs.rect_known, same))
+        return;
+
+    glMatrixMode(GL_TEXTURE);
+    glLoadIdentity();
+    glTranslatef(rect[0], rect[1], 0);
+    glScalef(rect[2], rect[3], 1);
+    glMatrixMode(GL_MODELVIEW);
+    gs.rect_known = true;
+    memcpy(gs.rect, rect, sizeof(gs.rect));
+}
+
+void gs_array_pointer (GLenum array, GLuint id, GLint size)
+{
+    enum gs_array i = gs_array_index(array);
+    bool same = gs.pointer_buffer[i] == id && gs.pointer_size[i] == size;
+    if (!gs_should_issue(gs.pointer_known[i], same))
+        return;
+
+    /* the pointer is relative to whatever is bound when it's set */
+    gs_bind_buffer(id);
+    switch (i) {
+        case GS_ARRAY_VERTEX:   glVertexPointer(size, GL_FLOAT, 0, 0); break;
+        case GS_ARRAY_NORMAL:   glNormalPointer(GL_FLOAT, 0, 0); break;
+        case GS_ARRAY_TEXCOORD: glTexCoordPointer(size, GL_FLOAT, 0, 0); break;
+        default: UNREACHABLE();
+    }
+    gs.pointer_known[i] = true;
+    gs.pointer_buffer[i] = id;
+    gs.pointer_size[i] = size;
+}
+
+void gs_material (GLenum pname, const GLfloat color[4])
+{
+    enum gs_mat i = gs_mat_index(pname);
+    bool same = memcmp(gs.mat[i], color, sizeof(gs.mat[i])) == 0;
+    if (!gs_should_issue(gs.mat_known[i], same))
+        return;
+
+    glMaterialfv(GL_FRONT, pname, color);
+    gs.mat_known[i] = true;
+    memcpy(gs.mat[i], color, sizeof(gs.mat[i]));
+}
+
+struct gs_stats gs_stats (void)
+{
+    return gs.stats;
+}
+
+void gs_reset_stats (void)
+{
+    gs.stats.issued = 0;
+    gs.stats.elided = 0;
+}
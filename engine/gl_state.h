@@ -0,0 +1,102 @@
+#ifndef _GL_STATE_H
+#define _GL_STATE_H
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glew.h>
+#include <GL/glut.h>
+#endif
+
+/*
+ * A shadow copy of the GL state the engine touches every frame. Calls
+ * that wouldn't change anything are dropped before reaching GL.
+ *
+ * The cache assumes it's the only one changing this state, so every
+ * buffer/texture bind, program, texture matrix, material, client array
+ * and enable bit covered here must go through it. It tracks a single
+ * context, and only texture unit 0.
+ */
+
+/**
+ * Counters of GL calls that went through the cache
+ */
+struct gs_stats {
+    unsigned issued; /*< Calls forwarded to GL */
+    unsigned elided; /*< Calls dropped because nothing would change */
+};
+
+/**
+ * @brief Forget everything the cache knows, so that the next call of
+ *        every kind reaches GL
+ */
+void gs_invalidate (void);
+
+/**
+ * @brief Enable or disable a capability (`glEnable`/`glDisable`)
+ * @param cap One of the capabilities used by the engine (lighting,
+ *            lights, textures, depth test, face culling)
+ * @param on Enable it?
+ */
+void gs_enable (GLenum cap, bool on);
+
+/**
+ * @brief Enable or disable a client array (`glEnableClientState`)
+ * @param array `GL_VERTEX_ARRAY`, `GL_NORMAL_ARRAY` or `GL_TEXTURE_COORD_ARRAY`
+ * @param on Enable it?
+ */
+void gs_client_state (GLenum array, bool on);
+
+/**
+ * @brief Bind a buffer to `GL_ARRAY_BUFFER`
+ * @param id The buffer
+ */
+void gs_bind_buffer (GLuint id);
+
+/**
+ * @brief Bind a texture to `GL_TEXTURE_2D`
+ * @param id The texture
+ */
+void gs_bind_texture (GLuint id);
+
+/**
+ * @brief Use a program (`glUseProgram`)
+ * @param id The program, 0 for the fixed function pipeline
+ */
+void gs_use_program (GLuint id);
+
+/**
+ * @brief Map texture coordinates from [0, 1] to a rectangle of the bound
+ *        texture, with the texture matrix. The matrix mode is left as
+ *        `GL_MODELVIEW`.
+ * @param rect The rectangle's lower left corner, width and height
+ */
+void gs_texture_rect (const GLfloat rect[4]);
+
+/**
+ * @brief Source the vertex, normal or texture coordinate array from a
+ *        tightly packed float buffer
+ * @param array `GL_VERTEX_ARRAY`, `GL_NORMAL_ARRAY` or `GL_TEXTURE_COORD_ARRAY`
+ * @param id The buffer
+ * @param size Components per element (ignored for normals)
+ */
+void gs_array_pointer (GLenum array, GLuint id, GLint size);
+
+/**
+ * @brief Set a component of the front material (`glMaterialfv`)
+ * @param pname `GL_AMBIENT`, `GL_DIFFUSE`, `GL_SPECULAR` or `GL_EMISSION`
+ * @param color RGBA color
+ */
+void gs_material (GLenum pname, const GLfloat color[4]);
+
+/**
+ * @brief Counters since the last reset
+ */
+struct gs_stats gs_stats (void);
+
+/**
+ * @brief Reset the counters
+ */
+void gs_reset_stats (void);
+
+#endif /* _GL_STATE_H */
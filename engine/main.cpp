@@ -1,6 +1,7 @@
 #define _USE_MATH_DEFINES
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -11,9 +12,13 @@
 
 #include <IL/il.h>
 
+#include "gl_state.h"
 #include "scene.h"
+#include "workers.h"
 #include <math.h>
 
+#include <string>
+#include <thread>
 #include <vector>
 #include <iostream>
 
@@ -21,23 +26,76 @@
 
 int usage (const char * cmd)
 {
-    printf("%s SCENE_FILE\n", cmd);
+    printf("%s SCENE_FILE [CAMERA_PATH]\n", cmd);
+    printf("%s --bake-pvs SCENE_FILE CAMERA_PATH\n", cmd);
+    printf("\tFollow CAMERA_PATH instead of orbiting the scene, culling with the\n"
+           "\tpotentially visible sets in CAMERA_PATH.pvs, if baked with --bake-pvs;\n"
+           "\tthey hold while the window is at most twice as wide as tall\n");
+    printf("%s --tile-texture IMAGE FILE.vt [BC1|BC3|RGBA]\n", cmd);
+    printf("\tTile IMAGE into FILE.vt, a virtual texture models can use as their\n"
+           "\ttexture; its format has to be the scene's TEXTURE_FORMAT (BC1)\n");
     return !0;
 }
 
+/**
+ * @brief Tile an image into a virtual texture file
+ * @param src The image
+ * @param dst The file
+ * @param format Format of the pages
+ * @returns The exit code
+ */
+static int tile_texture (const char * src, const char * dst, enum bc_format format)
+{
+    ilInit();
+    ilEnable(IL_ORIGIN_SET);
+    ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+
+    struct at_image img;
+    unsigned t = 0;
+    ilGenImages(1, &t);
+    ilBindImage(t);
+    if (ilLoadImage(src) && ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE)) {
+        img.width = ilGetInteger(IL_IMAGE_WIDTH);
+        img.height = ilGetInteger(IL_IMAGE_HEIGHT);
+        const unsigned char * pixels = ilGetData();
+        img.pixels.assign(pixels, pixels + 4 * (size_t) img.width * img.height);
+    }
+    ilDeleteImages(1, &t);
+    if (img.pixels.empty()) {
+        fprintf(stderr, "Error loading `%s`\n", src);
+        return !0;
+    }
+
+    // pages are cut and compressed on every core
+    unsigned cores = std::thread::hardware_concurrency();
+    wk_start((cores > 1) ? cores - 1 : 0);
+    bool ok = vt_write(dst, &img, format);
+    wk_stop();
+
+    if (!ok) {
+        fprintf(stderr, "Error tiling `%s` into `%s` (its sides must be powers of 2, from %d to %d)\n",
+                src, dst, VT_PAGE, VT_MAX_SIZE);
+        return !0;
+    }
+    printf("Tiled `%s` into `%s`\n", src, dst);
+    return 0;
+}
+
 static int main_window = 0;
 static int secondary_window = 0;
 
 static float fov = 45;
 static float nearDist = 1;
 static float farDist = 1000;
-static float Hnear;
-static float Wnear;
-static float Hfar;
-static float Wfar;
 static float lX = 0, lY = 0, lZ = 0;
 static float uX = 0, uY = 1, uZ = 0;
-static struct frustum frst = {0};
+static struct camera main_camera;      /* orbits the scene */
+static struct camera secondary_camera; /* looks down on it */
+static struct scene scene;
+static struct pv_path camera_path; /* flown by the main camera, if given */
+static bool follow_path = false;
+static int picked = -1;              /* node clicked on, -1 if none */
+static std::vector<unsigned> nearby; /* nodes near it */
 
 void changeSize2 (int w, int h)
 {
@@ -46,18 +104,16 @@ void changeSize2 (int w, int h)
     if(h == 0)
         h = 1;
 
-    // compute window's aspect ratio
-    float ratio = w * 1.0 / h;
     // Set the projection matrix as current
     glMatrixMode(GL_PROJECTION);
-    // Load Identity Matrix
-    glLoadIdentity();
 
     // Set the viewport to be the entire window
     glViewport(0, 0, w, h);
 
     // Set perspective
-    gluPerspective(45, ratio, 10, 100000);
+    cam_perspective(&secondary_camera, 45, w, h, 10, 100000);
+    cam_update(&secondary_camera);
+    glLoadMatrixf(secondary_camera.proj.m);
 
     // return to the model view matrix mode
     glMatrixMode(GL_MODELVIEW);
@@ -70,22 +126,16 @@ void changeSize (int w, int h)
     if(h == 0)
         h = 1;
 
-    // compute window's aspect ratio
-    float ratio = w * 1.0 / h;
     // Set the projection matrix as current
     glMatrixMode(GL_PROJECTION);
-    // Load Identity Matrix
-    glLoadIdentity();
 
     // Set the viewport to be the entire window
     glViewport(0, 0, w, h);
 
-    // Set perspective
-    gluPerspective(fov, ratio, nearDist, farDist);
-    Hnear = 2 * tan(fov / 2) * nearDist;
-    Wnear = Hnear * ratio;
-    Hfar = 2 * tan(fov / 2) * farDist;
-    Wfar = Hfar * ratio;
+    // Set perspective; culling uses the very same matrix
+    cam_perspective(&main_camera, fov, w, h, nearDist, farDist);
+    cam_update(&main_camera);
+    glLoadMatrixf(main_camera.proj.m);
 
     // return to the model view matrix mode
     glMatrixMode(GL_MODELVIEW);
@@ -101,7 +151,6 @@ static const struct Point Up = Point(0, 1, 0);
 
 static int timebase = 0;
 static int frame = 0;
-static struct scene scene;
 
 static bool draw_axes   = true;  /* draw axes? */
 static bool draw_curves = true;  /* draw Catmull-Rom curves? */
@@ -117,9 +166,9 @@ void renderScene2 (void)
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // set the camera
-    glLoadIdentity();
-
-    gluLookAt(0, 1000, 0, 0, 0, 0, -1, 0, 0);
+    cam_look_at(&secondary_camera, Point(0, 1000, 0), Point(0, 0, 0), Point(-1, 0, 0));
+    cam_update(&secondary_camera);
+    glLoadMatrixf(secondary_camera.view.m);
 
     if (draw_axes) {
         glBegin(GL_LINES);
@@ -136,7 +185,7 @@ void renderScene2 (void)
 
     unsigned elapsed_program_start = glutGet(GLUT_ELAPSED_TIME);
 
-    sc_draw(&scene, &frst, elapsed_program_start, draw_curves, draw_lights);
+    sc_draw(&scene, &secondary_camera, elapsed_program_start, draw_curves, draw_lights);
 
     // End of frame
     glutPostRedisplay();
@@ -148,37 +197,18 @@ void renderScene (void)
     // clear buffers
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // set the camera
-    glLoadIdentity();
-
-    gluLookAt(camX, camY, camZ, lX, lY, lZ, uX, uY, uZ);
-
-    struct Point p = Point(camX, camY, camZ);
-    struct Point l = Point(lX, lY, lZ);
-    struct Point u = Point(uX, uY, uZ);
-    struct Point d = normalize(l - p);
-    struct Point right = normalize(crossProduct(d, u));
-
-    //far points
-    struct Point fc = p + (d * farDist);
-    struct Point ftl = fc + (u * Hfar / 2) - (right * Wfar / 2);
-    struct Point ftr = fc + (u * Hfar / 2) + (right * Wfar / 2);
-    struct Point fbl = fc - (u * Hfar / 2) - (right * Wfar / 2);
-    struct Point fbr = fc - (u * Hfar / 2) + (right * Wfar / 2);
-
-    //near points
-    struct Point nc = p + (d * nearDist);
-    struct Point ntl = nc + (u * (Hnear / 2)) - (right * (Wnear / 2));
-    struct Point ntr = nc + (u * (Hnear / 2)) + (right * (Wnear / 2));
-    struct Point nbl = nc - (u * (Hnear / 2)) - (right * (Wnear / 2));
-    struct Point nbr = nc - (u * (Hnear / 2)) + (right * (Wnear / 2));
-
-    frst.far   = Plane(fc,  normalize(crossProduct(ftr - ftl, ftl - fbl)));
-    frst.near  = Plane(nc,  normalize(crossProduct(ntl - ntr, ntl - nbl)));
-    frst.top   = Plane(ftl, normalize(crossProduct(ntl - ntr, ftr - ntr)));
-    frst.bot   = Plane(nbl, normalize(crossProduct(nbr - nbl, fbl - nbl)));
-    frst.left  = Plane(ftl, normalize(crossProduct(ntl - ftl, fbl - ftl)));
-    frst.right = Plane(ftr, normalize(crossProduct(nbr - fbr, ftr - fbr)));
+    // set the camera; its frustum is only recomputed when it moves
+    int segment = -1;
+    if (follow_path) {
+        struct pv_key key;
+        segment = pv_path_at(&camera_path, glutGet(GLUT_ELAPSED_TIME), &key);
+        cam_look_at(&main_camera, key.eye, key.center, Point(uX, uY, uZ));
+    } else {
+        cam_look_at(&main_camera, Point(camX, camY, camZ), Point(lX, lY, lZ), Point(uX, uY, uZ));
+    }
+    cam_update(&main_camera);
+    sc_set_pvs(&scene, &main_camera, segment);
+    glLoadMatrixf(main_camera.view.m);
 
     if (draw_axes) {
         glBegin(GL_LINES);
@@ -196,7 +226,18 @@ void renderScene (void)
     unsigned elapsed_program_start = glutGet(GLUT_ELAPSED_TIME);
     unsigned elapsed_last_frame = elapsed_program_start - timebase;
 
-    sc_draw(&scene, &frst, elapsed_program_start, draw_curves, draw_lights);
+    // assets still loading are swapped in a few at a time, in their boxes' place
+    bool loading = sc_load_step(&scene, SC_LOAD_BUDGET);
+    sc_draw(&scene, &main_camera, elapsed_program_start, draw_curves, draw_lights);
+
+    if (picked >= 0) {
+        sc_draw_bounds(&scene, picked, Point(1, 1, 0));
+        for (unsigned i : nearby)
+            sc_draw_bounds(&scene, i, Point(0, 0.6f, 1));
+    }
+
+    struct gs_stats gl_calls = gs_stats();
+    gs_reset_stats();
 
     // End of frame
     glutPostRedisplay();
@@ -205,10 +246,24 @@ void renderScene (void)
     frame++;
     if (elapsed_last_frame > 1000) {
         float fps = frame*1000.0/elapsed_last_frame;
-        char s[64];
+        char s[512];
         timebase = elapsed_program_start;
         frame = 0;
-        sprintf(s, "FPS: %6.2f", fps);
+        sprintf(s, "%sFPS: %6.2f | Nodes updated: %u | Channels: %u | Visible: %u (%u culled, %u occluded) | Batched: %u in %u draws | Draws: %u | State changes: %u (%u saved) | GL calls: %u (%u elided)",
+                loading ? "Loading | " : "",
+                fps,
+                scene.stats.nodes_updated,
+                scene.anim.evaluated,
+                scene.stats.visible,
+                scene.stats.culled,
+                scene.stats.occluded,
+                scene.batcher.stats.batched,
+                scene.batcher.stats.batches,
+                scene.queue.stats.packets,
+                scene.queue.stats.state_changes,
+                scene.queue.stats.saved,
+                gl_calls.issued,
+                gl_calls.elided);
         glutSetWindowTitle(s);
     }
 }
@@ -224,10 +279,34 @@ void processKeys (unsigned char c, int xx, int yy)
         toggle(draw_axes,   '%');
         toggle(draw_curves, '~');
         toggle(draw_lights, '$');
+        toggle(scene.cull,  '!');
+        toggle(scene.occlusion, '@');
+        toggle(scene.batching, '^');
 #undef toggle
+
+        /* check the octree's queries against a scan of every node */
+        case '?':
+            if (!ot_check(&scene.index, &main_camera.frustum))
+                fprintf(stderr, "The octree doesn't match a scan of its nodes\n");
+            break;
     }
 }
 
+/**
+ * @brief Pick the node under a pixel, and find the nodes near it
+ */
+static void pick (int x, int y)
+{
+    struct Point origin, dir;
+    cam_ray(&main_camera, x, y, &origin, &dir);
+    picked = sc_pick(&scene, origin, dir);
+
+    nearby.clear();
+    if (picked < 0)
+        return;
+    sc_nearby(&scene, picked, &nearby);
+}
+
 void processMouseButtons(int button, int state, int xx, int yy)
 {
     if (state == GLUT_DOWN) {
@@ -239,6 +318,10 @@ void processMouseButtons(int button, int state, int xx, int yy)
             2:
             0;
     } else if (state == GLUT_UP) {
+        // a click that doesn't drag picks what's under it
+        if (tracking == 1 && xx == startX && yy == startY)
+            pick(xx, yy);
+
         if (tracking == 1) {
             alpha += xx - startX;
             beta += yy - startY;
@@ -282,8 +365,18 @@ void processMouseMotion(int xx, int yy)
 
 int main (int argc, char **argv)
 {
-    if (argc < 2)
-        return usage(*argv);
+    const char * cmd = *argv;
+    if (argc > 3 && strcmp(argv[1], "--tile-texture") == 0)
+        return tile_texture(argv[2], argv[3], bc_parse((argc > 4) ? argv[4] : "", BC_BC1));
+
+    bool bake_pvs = argc > 1 && strcmp(argv[1], "--bake-pvs") == 0;
+    if (bake_pvs) {
+        argv++;
+        argc--;
+    }
+
+    if (argc < 2 || (bake_pvs && argc < 3))
+        return usage(cmd);
 
     // init GLUT and the window
     glutInit(&argc, argv);
@@ -306,13 +399,13 @@ int main (int argc, char **argv)
 
         // OpenGL settings
         glPolygonMode(GL_FRONT, GL_FILL);
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);
-        glEnableClientState(GL_VERTEX_ARRAY);
-        glEnableClientState(GL_NORMAL_ARRAY);
-        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-        glEnable(GL_TEXTURE_2D);
-        glEnable(GL_LIGHTING);
+        gs_enable(GL_DEPTH_TEST, true);
+        gs_enable(GL_CULL_FACE, true);
+        gs_client_state(GL_VERTEX_ARRAY, true);
+        gs_client_state(GL_NORMAL_ARRAY, true);
+        gs_client_state(GL_TEXTURE_COORD_ARRAY, true);
+        gs_enable(GL_TEXTURE_2D, true);
+        gs_enable(GL_LIGHTING, true);
 
         glClearColor(0, 0, 0, 0);
 
@@ -368,8 +461,44 @@ int main (int argc, char **argv)
     camZ = r * cos(alpha * 3.14 / 180.0) * cos(beta * 3.14 / 180.0);
     camY = r * sin(beta * 3.14 / 180.0);
 
-    if (!sc_load_file(argv[1], &scene))
+    // occluders are drawn and batches built on every core
+    unsigned cores = std::thread::hardware_concurrency();
+    wk_start((cores > 1) ? cores - 1 : 0);
+    atexit(wk_stop);
+
+    // the window opens right away, while the assets load; baking needs them all
+    if (!(bake_pvs ? sc_load_file(argv[1], &scene) : sc_load_begin(argv[1], &scene)))
         return !0;
+    scene.cull = true;
+    scene.occlusion = true;
+    scene.batching = true;
+
+    if (argc > 2) {
+        if (!pv_load_path(argv[2], &camera_path)) {
+            fprintf(stderr, "Error loading camera path `%s`\n", argv[2]);
+            return !0;
+        }
+        follow_path = true;
+
+        std::string pvs_file = std::string(argv[2]) + ".pvs";
+        struct pvs sets;
+
+        if (bake_pvs) {
+            // twice as wide as tall, so the sets hold for any window up to that shape
+            cam_perspective(&main_camera, fov, 1600, 800, nearDist, farDist);
+            cam_look_at(&main_camera, camera_path.keys[0].eye, camera_path.keys[0].center, Point(uX, uY, uZ));
+            sc_bake_pvs(&scene, &main_camera, &camera_path, &sets);
+            if (!pv_save(&sets, pvs_file.c_str())) {
+                fprintf(stderr, "Error saving `%s`\n", pvs_file.c_str());
+                return !0;
+            }
+            printf("Baked %u sets (%zu runs) into `%s`\n", pv_count(&sets), sets.runs.size(), pvs_file.c_str());
+            return 0;
+        }
+
+        if (pv_load(&sets, pvs_file.c_str()) && !sc_use_pvs(&scene, &sets))
+            fprintf(stderr, "`%s` was baked for another scene, ignoring it\n", pvs_file.c_str());
+    }
 
     sc_draw_lights(&scene); /* draw static ligts */
 
@@ -0,0 +1,195 @@
+#ifndef _MAT4_H
+#define _MAT4_H
+
+#include "../generator/generators.h"
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define M4_SSE 1
+#endif
+
+/**
+ * A 4x4 matrix, stored column-major like OpenGL expects it, so it can be
+ * handed to `glLoadMatrixf` as is.
+ */
+struct mat4 {
+    alignas(16) float m[16];
+};
+
+/**
+ * @brief The identity matrix
+ */
+static inline struct mat4 m4_identity (void)
+{
+    struct mat4 ret = {{
+        1, 0, 0, 0,
+        0, 1, 0, 0,
+        0, 0, 1, 0,
+        0, 0, 0, 1,
+    }};
+    return ret;
+}
+
+/**
+ * @brief Multiply two matrices
+ * @returns `a * b`, i.e., `b` is applied first
+ */
+static inline struct mat4 m4_mul (const struct mat4 * a, const struct mat4 * b)
+{
+    struct mat4 ret;
+#if defined(__AVX__)
+    /* two columns of the result per iteration */
+    __m256 a0 = _mm256_broadcast_ps((const __m128 *) &a->m[0]);
+    __m256 a1 = _mm256_broadcast_ps((const __m128 *) &a->m[4]);
+    __m256 a2 = _mm256_broadcast_ps((const __m128 *) &a->m[8]);
+    __m256 a3 = _mm256_broadcast_ps((const __m128 *) &a->m[12]);
+    for (unsigned j = 0; j < 16; j += 8) {
+        const float * bj = &b->m[j];
+        __m256 c = _mm256_mul_ps(a0, _mm256_setr_ps(bj[0], bj[0], bj[0], bj[0], bj[4], bj[4], bj[4], bj[4]));
+        c = _mm256_add_ps(c, _mm256_mul_ps(a1, _mm256_setr_ps(bj[1], bj[1], bj[1], bj[1], bj[5], bj[5], bj[5], bj[5])));
+        c = _mm256_add_ps(c, _mm256_mul_ps(a2, _mm256_setr_ps(bj[2], bj[2], bj[2], bj[2], bj[6], bj[6], bj[6], bj[6])));
+        c = _mm256_add_ps(c, _mm256_mul_ps(a3, _mm256_setr_ps(bj[3], bj[3], bj[3], bj[3], bj[7], bj[7], bj[7], bj[7])));
+        _mm256_storeu_ps(&ret.m[j], c);
+    }
+#elif defined(M4_SSE)
+    __m128 a0 = _mm_load_ps(&a->m[0]);
+    __m128 a1 = _mm_load_ps(&a->m[4]);
+    __m128 a2 = _mm_load_ps(&a->m[8]);
+    __m128 a3 = _mm_load_ps(&a->m[12]);
+    for (unsigned j = 0; j < 16; j += 4) {
+        __m128 c = _mm_mul_ps(a0, _mm_set1_ps(b->m[j + 0]));
+        c = _mm_add_ps(c, _mm_mul_ps(a1, _mm_set1_ps(b->m[j + 1])));
+        c = _mm_add_ps(c, _mm_mul_ps(a2, _mm_set1_ps(b->m[j + 2])));
+        c = _mm_add_ps(c, _mm_mul_ps(a3, _mm_set1_ps(b->m[j + 3])));
+        _mm_store_ps(&ret.m[j], c);
+    }
+#else
+    for (unsigned j = 0; j < 4; j++)
+        for (unsigned i = 0; i < 4; i++) {
+            float c = 0;
+            for (unsigned k = 0; k < 4; k++)
+                c += a->m[k * 4 + i] * b->m[j * 4 + k];
+            ret.m[j * 4 + i] = c;
+        }
+#endif
+    return ret;
+}
+
+/**
+ * @brief Multiply by a translation, without building its matrix
+ * @returns `m * m4_translate(x, y, z)`
+ */
+static inline struct mat4 m4_mul_translate (const struct mat4 * m, float x, float y, float z)
+{
+    struct mat4 ret = *m;
+    for (unsigned i = 0; i < 4; i++)
+        ret.m[12 + i] += m->m[i] * x + m->m[4 + i] * y + m->m[8 + i] * z;
+    return ret;
+}
+
+/**
+ * @brief Transform a point (w = 1)
+ */
+static inline struct Point m4_transform_point (const struct mat4 * m, struct Point p)
+{
+    return Point(
+            m->m[0] * p.x + m->m[4] * p.y + m->m[8]  * p.z + m->m[12],
+            m->m[1] * p.x + m->m[5] * p.y + m->m[9]  * p.z + m->m[13],
+            m->m[2] * p.x + m->m[6] * p.y + m->m[10] * p.z + m->m[14]
+            );
+}
+
+/**
+ * @brief Same as `glTranslatef`
+ */
+static inline struct mat4 m4_translate (float x, float y, float z)
+{
+    struct mat4 ret = m4_identity();
+    ret.m[12] = x;
+    ret.m[13] = y;
+    ret.m[14] = z;
+    return ret;
+}
+
+/**
+ * @brief Same as `glScalef`
+ */
+static inline struct mat4 m4_scale (float x, float y, float z)
+{
+    struct mat4 ret = m4_identity();
+    ret.m[0] = x;
+    ret.m[5] = y;
+    ret.m[10] = z;
+    return ret;
+}
+
+/**
+ * @brief Same as `glRotatef`
+ * @param angle Angle in degrees
+ * @param x,y,z Axis to rotate around, doesn't need to be normalized
+ */
+static inline struct mat4 m4_rotate (float angle, float x, float y, float z)
+{
+    float len = sqrtf(x * x + y * y + z * z);
+    if (len == 0)
+        return m4_identity();
+    x /= len;
+    y /= len;
+    z /= len;
+
+    float rad = angle * (float) M_PI / 180;
+    float c = cosf(rad);
+    float s = sinf(rad);
+    float t = 1 - c;
+
+    struct mat4 ret = {{
+        x * x * t + c,     y * x * t + z * s, x * z * t - y * s, 0,
+        x * y * t - z * s, y * y * t + c,     y * z * t + x * s, 0,
+        x * z * t + y * s, y * z * t - x * s, z * z * t + c,     0,
+        0,                 0,                 0,                 1,
+    }};
+    return ret;
+}
+
+/**
+ * @brief Same as `gluPerspective`
+ * @param fovy Vertical field of view, in degrees
+ */
+static inline struct mat4 m4_perspective (float fovy, float aspect, float znear, float zfar)
+{
+    float f = 1 / tanf(fovy * (float) M_PI / 360);
+
+    struct mat4 ret = {{
+        f / aspect, 0, 0,                                0,
+        0,          f, 0,                                0,
+        0,          0, (zfar + znear) / (znear - zfar),      -1,
+        0,          0, (2 * zfar * znear) / (znear - zfar),  0,
+    }};
+    return ret;
+}
+
+/**
+ * @brief Same as `gluLookAt`
+ */
+static inline struct mat4 m4_look_at (struct Point eye, struct Point center, struct Point up)
+{
+    struct Point f = normalize(center - eye);
+    struct Point s = normalize(crossProduct(f, up));
+    struct Point u = crossProduct(s, f);
+
+    struct mat4 ret = {{
+        s.x, u.x, -f.x, 0,
+        s.y, u.y, -f.y, 0,
+        s.z, u.z, -f.z, 0,
+        0,   0,   0,    1,
+    }};
+    ret.m[12] = -(s.x * eye.x + s.y * eye.y + s.z * eye.z);
+    ret.m[13] = -(u.x * eye.x + u.y * eye.y + u.z * eye.z);
+    ret.m[14] = f.x * eye.x + f.y * eye.y + f.z * eye.z;
+    return ret;
+}
+
+#endif /* _MAT4_H */
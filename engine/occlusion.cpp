@@ -0,0 +1,231 @@
+#include "occlusion.h"
+#include "simd.h"
+#include "workers.h"
+
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+
+/** Smallest `w` a projected point may have; nearer ones are behind the eye */
+#define OC_EPSILON 1e-6f
+
+/**
+ * @brief Project a point: `m * (p, 1)`
+ */
+static inline void oc_project (const struct mat4 * m, struct Point p, float out[4])
+{
+    for (unsigned i = 0; i < 4; i++)
+        out[i] = m->m[i] * p.x + m->m[4 + i] * p.y + m->m[8 + i] * p.z + m->m[12 + i];
+}
+
+void oc_reserve (struct oc_buffer * buf, size_t n)
+{
+    unsigned size = 0;
+    for (unsigned l = 0; l < OC_LEVELS; l++) {
+        buf->offset[l] = size;
+        size += (OC_WIDTH >> l) * (OC_HEIGHT >> l);
+    }
+    buf->depth.assign(size, 1);
+    buf->tris.reserve(n);
+}
+
+void oc_begin (struct oc_buffer * buf, const struct mat4 * clip)
+{
+    buf->clip = *clip;
+    buf->tris.clear();
+    buf->tested = 0;
+}
+
+void oc_add_mesh (struct oc_buffer * buf, const struct mat4 * model, const struct oc_mesh * mesh)
+{
+    struct mat4 mvp = m4_mul(&buf->clip, model);
+
+    for (size_t i = 0; i + 2 < mesh->vertices.size(); i += 3) {
+        float x[3], y[3], z[3];
+        bool keep = true;
+        for (unsigned j = 0; j < 3 && keep; j++) {
+            float v[4];
+            oc_project(&mvp, mesh->vertices[i + j], v);
+            keep = v[3] > OC_EPSILON && v[2] >= -v[3];
+            x[j] = (v[0] / v[3] * 0.5f + 0.5f) * OC_WIDTH;
+            y[j] = (v[1] / v[3] * 0.5f + 0.5f) * OC_HEIGHT;
+            z[j] = v[2] / v[3];
+        }
+        if (!keep || (z[0] > 1 && z[1] > 1 && z[2] > 1))
+            continue;
+
+        /* counter-clockwise on screen, whichever way it faced */
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (fabsf(area) < OC_EPSILON)
+            continue;
+        if (area < 0) {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(z[1], z[2]);
+            area = -area;
+        }
+
+        struct oc_tri t;
+        t.x0 = std::max(0, (int) floorf(std::min(x[0], std::min(x[1], x[2]))));
+        t.x1 = std::min(OC_WIDTH - 1, (int) ceilf(std::max(x[0], std::max(x[1], x[2]))));
+        t.y0 = std::max(0, (int) floorf(std::min(y[0], std::min(y[1], y[2]))));
+        t.y1 = std::min(OC_HEIGHT - 1, (int) ceilf(std::max(y[0], std::max(y[1], y[2]))));
+        if (t.x0 > t.x1 || t.y0 > t.y1)
+            continue;
+
+        for (unsigned j = 0; j < 3; j++) {
+            unsigned k = (j + 1) % 3;
+            t.ea[j] = y[j] - y[k];
+            t.eb[j] = x[k] - x[j];
+            t.ec[j] = -(t.ea[j] * x[j] + t.eb[j] * y[j]);
+        }
+
+        float dx1 = x[1] - x[0], dy1 = y[1] - y[0], dz1 = z[1] - z[0];
+        float dx2 = x[2] - x[0], dy2 = y[2] - y[0], dz2 = z[2] - z[0];
+        t.za = (dz1 * dy2 - dz2 * dy1) / area;
+        t.zb = (dz2 * dx1 - dz1 * dx2) / area;
+        t.zc = z[0] - t.za * x[0] - t.zb * y[0];
+
+        buf->tris.push_back(t);
+    }
+}
+
+/**
+ * @brief Draw the rows `[y0, y1]` of a triangle, `VF_WIDTH` pixels at a
+ *        time, sampling at pixel centers
+ */
+static void oc_draw_tri (float * depth, const struct oc_tri * t, int y0, int y1)
+{
+    static const float lanes[8] = { 0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f, };
+    const vf lane = vf_load(lanes);
+    const vf zero = vf_set1(0);
+    const vf ea0 = vf_set1(t->ea[0]), ea1 = vf_set1(t->ea[1]), ea2 = vf_set1(t->ea[2]);
+    const vf za = vf_set1(t->za);
+
+    /* rows are a multiple of the width, so aligned spans never run over */
+    int xa = t->x0 & ~(VF_WIDTH - 1);
+
+    for (int y = y0; y <= y1; y++) {
+        float yc = y + 0.5f;
+        vf e0row = vf_set1(t->eb[0] * yc + t->ec[0]);
+        vf e1row = vf_set1(t->eb[1] * yc + t->ec[1]);
+        vf e2row = vf_set1(t->eb[2] * yc + t->ec[2]);
+        vf zrow = vf_set1(t->zb * yc + t->zc);
+        float * row = &depth[y * OC_WIDTH];
+
+        for (int x = xa; x <= t->x1; x += VF_WIDTH) {
+            vf xs = vf_add(vf_set1((float) x), lane);
+            vf out = vf_or(vf_or(
+                        vf_lt(vf_fmadd(ea0, xs, e0row), zero),
+                        vf_lt(vf_fmadd(ea1, xs, e1row), zero)),
+                        vf_lt(vf_fmadd(ea2, xs, e2row), zero));
+            if (vf_mask(out) == VF_ALL)
+                continue;
+
+            vf cur = vf_load(row + x);
+            vf z = vf_fmadd(za, xs, zrow);
+            vf_store(row + x, vf_select(out, cur, vf_min(cur, z)));
+        }
+    }
+}
+
+/**
+ * @brief Build a level of the pyramid from the one before it, rows
+ *        `[y0, y1)` only
+ */
+static void oc_downsample (struct oc_buffer * buf, unsigned level, unsigned y0, unsigned y1)
+{
+    unsigned w = OC_WIDTH >> level;
+    const float * src = &buf->depth[buf->offset[level - 1]];
+    float * dst = &buf->depth[buf->offset[level]];
+
+    for (unsigned y = y0; y < y1; y++) {
+        const float * a = &src[(2 * y) * (2 * w)];
+        const float * b = a + 2 * w;
+        for (unsigned x = 0; x < w; x++)
+            dst[y * w + x] = std::max(std::max(a[2 * x], a[2 * x + 1]), std::max(b[2 * x], b[2 * x + 1]));
+    }
+}
+
+/**
+ * @brief Task of `oc_finish`: clear a band, draw every triangle over it,
+ *        and build the levels of the pyramid that only depend on it
+ */
+static void oc_draw_band (void * ctx, unsigned band)
+{
+    struct oc_buffer * buf = (struct oc_buffer *) ctx;
+    int y0 = band * OC_BAND;
+    int y1 = y0 + OC_BAND - 1;
+
+    std::fill(&buf->depth[y0 * OC_WIDTH], &buf->depth[(y1 + 1) * OC_WIDTH], 1.0f);
+
+    for (const struct oc_tri & t : buf->tris)
+        if (t.y0 <= y1 && t.y1 >= y0)
+            oc_draw_tri(buf->depth.data(), &t, std::max(t.y0, y0), std::min(t.y1, y1));
+
+    for (unsigned l = 1; l < OC_LEVELS && (OC_BAND >> l) > 0; l++)
+        oc_downsample(buf, l, y0 >> l, (y1 + 1) >> l);
+}
+
+void oc_finish (struct oc_buffer * buf)
+{
+    assert(!buf->depth.empty() && "call oc_reserve first");
+
+    wk_run(oc_draw_band, buf, OC_HEIGHT / OC_BAND);
+
+    /* the coarse levels span several bands */
+    for (unsigned l = 1; l < OC_LEVELS; l++)
+        if ((OC_BAND >> l) == 0)
+            oc_downsample(buf, l, 0, OC_HEIGHT >> l);
+}
+
+bool oc_visible (struct oc_buffer * buf, const struct aabb * b)
+{
+    buf->tested++;
+
+    float x0 = FLT_MAX, x1 = -FLT_MAX;
+    float y0 = FLT_MAX, y1 = -FLT_MAX;
+    float zmin = FLT_MAX;
+    for (unsigned i = 0; i < 8; i++) {
+        struct Point p = Point(
+                (i & 1) ? b->max.x : b->min.x,
+                (i & 2) ? b->max.y : b->min.y,
+                (i & 4) ? b->max.z : b->min.z);
+        float v[4];
+        oc_project(&buf->clip, p, v);
+
+        /* crossing the near plane: in front of everything */
+        if (v[3] <= OC_EPSILON || v[2] < -v[3])
+            return true;
+
+        float x = (v[0] / v[3] * 0.5f + 0.5f) * OC_WIDTH;
+        float y = (v[1] / v[3] * 0.5f + 0.5f) * OC_HEIGHT;
+        x0 = fminf(x0, x); x1 = fmaxf(x1, x);
+        y0 = fminf(y0, y); y1 = fmaxf(y1, y);
+        zmin = fminf(zmin, v[2] / v[3]);
+    }
+
+    /* off screen, it's for the frustum to cull */
+    int px0 = std::max(0, (int) floorf(x0));
+    int px1 = std::min(OC_WIDTH - 1, (int) floorf(x1));
+    int py0 = std::max(0, (int) floorf(y0));
+    int py1 = std::min(OC_HEIGHT - 1, (int) floorf(y1));
+    if (px0 > px1 || py0 > py1)
+        return true;
+
+    /* the level where it spans two texels at most, each way */
+    unsigned span = std::max(px1 - px0, py1 - py0);
+    unsigned l = 0;
+    while ((span >> l) > 0 && l < OC_LEVELS - 1)
+        l++;
+
+    unsigned w = OC_WIDTH >> l;
+    const float * level = &buf->depth[buf->offset[l]];
+    for (int y = py0 >> l; y <= py1 >> l; y++)
+        for (int x = px0 >> l; x <= px1 >> l; x++)
+            if (zmin <= level[y * w + x])
+                return true;
+
+    return false;
+}
@@ -0,0 +1,93 @@
+#ifndef _OCCLUSION_H
+#define _OCCLUSION_H
+
+#include "../generator/generators.h"
+#include "bounds.h"
+#include "mat4.h"
+
+#include <stddef.h>
+
+#include <vector>
+
+/** Size of the depth buffer occluders are drawn into, in pixels */
+#define OC_WIDTH  256
+#define OC_HEIGHT 256
+
+/** Rows of the depth buffer drawn by each task, a power of 2 */
+#define OC_BAND 16
+
+/** Levels of the depth pyramid, down to 1x1 */
+#define OC_LEVELS 9
+
+/**
+ * A coarse mesh drawn as an occluder: a triangle list, which has to lie
+ * inside the mesh it stands in for so that it never hides too much
+ */
+struct oc_mesh {
+    std::vector<struct Point> vertices;
+};
+
+/**
+ * A triangle set up for drawing: edge functions and depth as planes over
+ * the screen, `a * x + b * y + c`, and the pixels it may cover
+ */
+struct oc_tri {
+    float ea[3], eb[3], ec[3]; /*< Edge functions, positive inside */
+    float za, zb, zc;          /*< Depth, z / w */
+    int x0, x1, y0, y1;        /*< Pixel bounds, inclusive */
+};
+
+/**
+ * A low resolution depth buffer drawn on the CPU, and its hierarchical-Z
+ * pyramid: each texel of a level holds the farthest depth of the 2x2
+ * texels under it. Depths are z / w, 1 being the far plane.
+ */
+struct oc_buffer {
+    std::vector<float> depth;      /*< Every level, finest first */
+    unsigned offset[OC_LEVELS];    /*< Where each level starts in `depth` */
+    std::vector<struct oc_tri> tris; /*< Triangles of the frame */
+    struct mat4 clip;              /*< Projection * view of the frame */
+    unsigned tested;               /*< Boxes tested on this frame */
+};
+
+/**
+ * @brief Make room for a number of triangles, and for the pyramid
+ * @param buf The buffer
+ * @param n Number of triangles
+ */
+void oc_reserve (struct oc_buffer * buf, size_t n);
+
+/**
+ * @brief Start a frame: drop the last one's occluders
+ * @param buf The buffer
+ * @param clip Projection * view matrix
+ */
+void oc_begin (struct oc_buffer * buf, const struct mat4 * clip);
+
+/**
+ * @brief Add an occluder. Triangles crossing the near plane are dropped,
+ *        so that what's drawn stays conservative.
+ * @param buf The buffer
+ * @param model Its world matrix
+ * @param mesh The occluder
+ */
+void oc_add_mesh (struct oc_buffer * buf, const struct mat4 * model, const struct oc_mesh * mesh);
+
+/**
+ * @brief Draw the occluders added since `oc_begin` and build the pyramid,
+ *        a band of rows per task on the workers
+ * @param buf The buffer
+ */
+void oc_finish (struct oc_buffer * buf);
+
+/**
+ * @brief Could any of a box be seen past the occluders? The box's nearest
+ *        depth is compared against the farthest of the pyramid texels
+ *        covering it, on the level where it spans two texels at most.
+ * @param buf The buffer, finished
+ * @param b The box, in world space
+ * @returns `false` if it's hidden for sure
+ */
+bool oc_visible (struct oc_buffer * buf, const struct aabb * b);
+
+#endif /* _OCCLUSION_H */
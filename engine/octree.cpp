@@ -0,0 +1,504 @@
+#include "octree.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+
+/**
+ * @brief Loose bounds of a cell
+ */
+static struct aabb ot_loose (const struct ot_cell * cell)
+{
+    struct Point r = Point(2 * cell->half, 2 * cell->half, 2 * cell->half);
+    struct aabb ret;
+    ret.min = cell->center - r;
+    ret.max = cell->center + r;
+    return ret;
+}
+
+static bool ot_contains (const struct aabb * outer, const struct aabb * inner)
+{
+    return outer->min.x <= inner->min.x && inner->max.x <= outer->max.x
+        && outer->min.y <= inner->min.y && inner->max.y <= outer->max.y
+        && outer->min.z <= inner->min.z && inner->max.z <= outer->max.z;
+}
+
+static bool ot_overlaps (const struct aabb * a, const struct aabb * b)
+{
+    return a->min.x <= b->max.x && b->min.x <= a->max.x
+        && a->min.y <= b->max.y && b->min.y <= a->max.y
+        && a->min.z <= b->max.z && b->min.z <= a->max.z;
+}
+
+/**
+ * @brief Octant of a cell a point is in
+ */
+static unsigned ot_octant (const struct ot_cell * cell, struct Point p)
+{
+    return (p.x >= cell->center.x)
+        | (p.y >= cell->center.y) << 1
+        | (p.z >= cell->center.z) << 2;
+}
+
+/**
+ * @brief Create a child of a cell, reusing a free cell if there's one
+ * @returns Its index
+ */
+static int ot_new_cell (struct octree * tree, int parent, unsigned octant)
+{
+    int i = tree->free;
+    if (i >= 0) {
+        tree->free = tree->cells[i].parent;
+    } else {
+        i = tree->cells.size();
+        tree->cells.push_back(ot_cell());
+    }
+
+    const struct ot_cell * p = &tree->cells[parent];
+    float h = p->half / 2;
+
+    struct ot_cell cell;
+    cell.center = p->center + Point((octant & 1) ? h : -h, (octant & 2) ? h : -h, (octant & 4) ? h : -h);
+    cell.half = h;
+    cell.depth = p->depth + 1;
+    cell.parent = parent;
+    std::fill(cell.child, cell.child + 8, -1);
+    cell.first = -1;
+    cell.count = 0;
+
+    tree->cells[i] = cell;
+    tree->cells[parent].child[octant] = i;
+    return i;
+}
+
+/**
+ * @brief Find the deepest cell a box fits in, creating it if needed
+ */
+static int ot_target (struct octree * tree, const struct aabb * box)
+{
+    struct Point c = bb_center(box);
+    struct Point e = bb_extent(box);
+    float size = 2 * std::max(e.x, std::max(e.y, e.z));
+
+    int i = 0;
+    while (tree->cells[i].depth < OT_MAX_DEPTH && size <= tree->cells[i].half) {
+        const struct ot_cell * p = &tree->cells[i];
+        unsigned octant = ot_octant(p, c);
+
+        /* the child's loose bounds, whether it exists yet or not */
+        float h = p->half / 2;
+        struct Point cc = p->center + Point((octant & 1) ? h : -h, (octant & 2) ? h : -h, (octant & 4) ? h : -h);
+        struct aabb loose;
+        loose.min = cc - Point(2 * h, 2 * h, 2 * h);
+        loose.max = cc + Point(2 * h, 2 * h, 2 * h);
+        if (!ot_contains(&loose, box))
+            break;
+
+        int child = p->child[octant];
+        if (child < 0)
+            child = ot_new_cell(tree, i, octant);
+        i = child;
+    }
+
+    return i;
+}
+
+/**
+ * @brief Put an item in a cell
+ */
+static void ot_link (struct octree * tree, unsigned id, int cell)
+{
+    struct ot_item * item = &tree->items[id];
+    item->cell = cell;
+    item->prev = -1;
+    item->next = tree->cells[cell].first;
+    if (item->next >= 0)
+        tree->items[item->next].prev = id;
+    tree->cells[cell].first = id;
+
+    for (int c = cell; c >= 0; c = tree->cells[c].parent)
+        tree->cells[c].count++;
+}
+
+/**
+ * @brief Take an item out of its cell's list
+ */
+static void ot_unlink (struct octree * tree, unsigned id)
+{
+    struct ot_item * item = &tree->items[id];
+    if (item->prev >= 0)
+        tree->items[item->prev].next = item->next;
+    else
+        tree->cells[item->cell].first = item->next;
+    if (item->next >= 0)
+        tree->items[item->next].prev = item->prev;
+    item->cell = -1;
+}
+
+/**
+ * @brief Account for an item that left a cell, freeing the cells left
+ *        empty on the way up
+ */
+static void ot_release (struct octree * tree, int cell)
+{
+    while (cell >= 0) {
+        struct ot_cell * c = &tree->cells[cell];
+        int parent = c->parent;
+
+        if (--c->count == 0 && parent >= 0) {
+            tree->cells[parent].child[ot_octant(&tree->cells[parent], c->center)] = -1;
+            c->parent = tree->free;
+            tree->free = cell;
+        }
+
+        cell = parent;
+    }
+}
+
+void ot_reserve (struct octree * tree, size_t n)
+{
+    struct ot_item item;
+    item.box = bb_empty();
+    item.cell = item.prev = item.next = -1;
+    tree->items.assign(n, item);
+
+    /* every item's path, and one more for the one being moved */
+    tree->cells.clear();
+    tree->cells.reserve(1 + (n + 1) * OT_MAX_DEPTH);
+    tree->free = -1;
+}
+
+void ot_clear (struct octree * tree, const struct aabb * region)
+{
+    for (struct ot_item & item : tree->items)
+        item.cell = item.prev = item.next = -1;
+
+    struct Point e = bb_is_empty(region) ? Point(1, 1, 1) : bb_extent(region);
+
+    struct ot_cell root;
+    root.center = bb_is_empty(region) ? Point(0, 0, 0) : bb_center(region);
+    root.half = std::max(e.x, std::max(e.y, e.z));
+    root.depth = 0;
+    root.parent = -1;
+    std::fill(root.child, root.child + 8, -1);
+    root.first = -1;
+    root.count = 0;
+
+    tree->cells.clear();
+    tree->cells.push_back(root);
+    tree->free = -1;
+}
+
+/**
+ * @brief Take an item out of the tree
+ */
+static void ot_remove (struct octree * tree, unsigned id)
+{
+    int cell = tree->items[id].cell;
+    if (cell < 0)
+        return;
+
+    ot_unlink(tree, id);
+    ot_release(tree, cell);
+}
+
+void ot_move (struct octree * tree, unsigned id, const struct aabb * box)
+{
+    assert(!tree->cells.empty() && "call ot_clear first");
+
+    if (bb_is_empty(box)) {
+        ot_remove(tree, id);
+        return;
+    }
+
+    int target = ot_target(tree, box);
+    int old = tree->items[id].cell;
+    tree->items[id].box = *box;
+    if (target == old)
+        return;
+
+    /* in the new cell first, so that the cells they share aren't freed */
+    if (old >= 0)
+        ot_unlink(tree, id);
+    ot_link(tree, id, target);
+    if (old >= 0)
+        ot_release(tree, old);
+}
+
+/**
+ * @brief Append every item of a subtree
+ */
+static void ot_collect (const struct octree * tree, int cell, std::vector<unsigned> * out)
+{
+    const struct ot_cell * c = &tree->cells[cell];
+    for (int i = c->first; i >= 0; i = tree->items[i].next)
+        out->push_back(i);
+    for (unsigned k = 0; k < 8; k++)
+        if (c->child[k] >= 0)
+            ot_collect(tree, c->child[k], out);
+}
+
+/**
+ * A shape to query for, as a test of boxes against it
+ */
+typedef enum cl_result (*ot_test) (const void * shape, const struct aabb * b);
+
+/**
+ * @brief Append the items of a subtree that pass a test. Subtrees whose
+ *        loose bounds are outside are skipped, and those inside are taken
+ *        whole.
+ */
+static void ot_query (const struct octree * tree, int cell, ot_test test, const void * shape, std::vector<unsigned> * out)
+{
+    const struct ot_cell * c = &tree->cells[cell];
+
+    if (c->depth > 0) {
+        struct aabb loose = ot_loose(c);
+        switch (test(shape, &loose)) {
+            case CL_OUT: return;
+            case CL_IN: ot_collect(tree, cell, out); return;
+            case CL_PARTIAL: break;
+        }
+    }
+
+    for (int i = c->first; i >= 0; i = tree->items[i].next)
+        if (test(shape, &tree->items[i].box) != CL_OUT)
+            out->push_back(i);
+    for (unsigned k = 0; k < 8; k++)
+        if (c->child[k] >= 0)
+            ot_query(tree, c->child[k], test, shape, out);
+}
+
+static enum cl_result ot_test_frustum (const void * shape, const struct aabb * b)
+{
+    return cl_cull_box((const struct cl_frustum *) shape, b);
+}
+
+struct ot_sphere {
+    struct Point c;
+    float r;
+};
+
+static enum cl_result ot_test_sphere (const void * shape, const struct aabb * b)
+{
+    const struct ot_sphere * s = (const struct ot_sphere *) shape;
+
+    /* distance to the nearest point of the box, and to the farthest */
+    struct Point n = Point(
+            fmaxf(b->min.x - s->c.x, fmaxf(0, s->c.x - b->max.x)),
+            fmaxf(b->min.y - s->c.y, fmaxf(0, s->c.y - b->max.y)),
+            fmaxf(b->min.z - s->c.z, fmaxf(0, s->c.z - b->max.z)));
+    struct Point f = Point(
+            fmaxf(fabsf(b->min.x - s->c.x), fabsf(b->max.x - s->c.x)),
+            fmaxf(fabsf(b->min.y - s->c.y), fabsf(b->max.y - s->c.y)),
+            fmaxf(fabsf(b->min.z - s->c.z), fabsf(b->max.z - s->c.z)));
+    float r2 = s->r * s->r;
+
+    if (n.x * n.x + n.y * n.y + n.z * n.z > r2)
+        return CL_OUT;
+    if (f.x * f.x + f.y * f.y + f.z * f.z <= r2)
+        return CL_IN;
+    return CL_PARTIAL;
+}
+
+static enum cl_result ot_test_box (const void * shape, const struct aabb * b)
+{
+    const struct aabb * a = (const struct aabb *) shape;
+    if (!ot_overlaps(a, b))
+        return CL_OUT;
+    if (ot_contains(a, b))
+        return CL_IN;
+    return CL_PARTIAL;
+}
+
+unsigned ot_query_frustum (const struct octree * tree, const struct cl_frustum * frst, std::vector<unsigned> * out)
+{
+    size_t n = out->size();
+    if (!tree->cells.empty())
+        ot_query(tree, 0, ot_test_frustum, frst, out);
+    return out->size() - n;
+}
+
+unsigned ot_query_sphere (const struct octree * tree, struct Point c, float r, std::vector<unsigned> * out)
+{
+    struct ot_sphere s = { c, r, };
+    size_t n = out->size();
+    if (!tree->cells.empty())
+        ot_query(tree, 0, ot_test_sphere, &s, out);
+    return out->size() - n;
+}
+
+unsigned ot_query_box (const struct octree * tree, const struct aabb * b, std::vector<unsigned> * out)
+{
+    size_t n = out->size();
+    if (!tree->cells.empty() && !bb_is_empty(b))
+        ot_query(tree, 0, ot_test_box, b, out);
+    return out->size() - n;
+}
+
+/**
+ * A ray being cast, and the nearest hit so far
+ */
+struct ot_ray {
+    struct Point origin;
+    struct Point inv; /*< 1 / direction */
+    float t;          /*< Nearest hit, or the farthest wanted */
+    int id;           /*< Item hit, -1 if none */
+};
+
+/**
+ * @brief Where a ray enters a box, by the slab method
+ * @returns Whether it enters it before `ray->t`
+ */
+static bool ot_ray_box (const struct ot_ray * ray, const struct aabb * b, float * t)
+{
+    float t0 = 0;
+    float t1 = ray->t;
+    const float o[3] = { ray->origin.x, ray->origin.y, ray->origin.z, };
+    const float inv[3] = { ray->inv.x, ray->inv.y, ray->inv.z, };
+    const float lo[3] = { b->min.x, b->min.y, b->min.z, };
+    const float hi[3] = { b->max.x, b->max.y, b->max.z, };
+
+    for (unsigned k = 0; k < 3; k++) {
+        float a = (lo[k] - o[k]) * inv[k];
+        float z = (hi[k] - o[k]) * inv[k];
+        /* fminf/fmaxf drop the NaNs of a ray along a slab's plane */
+        t0 = fmaxf(t0, fminf(a, z));
+        t1 = fminf(t1, fmaxf(a, z));
+    }
+
+    *t = t0;
+    return t0 <= t1;
+}
+
+static void ot_raycast_cell (const struct octree * tree, int cell, struct ot_ray * ray)
+{
+    const struct ot_cell * c = &tree->cells[cell];
+    float t;
+
+    if (c->depth > 0) {
+        struct aabb loose = ot_loose(c);
+        if (!ot_ray_box(ray, &loose, &t))
+            return;
+    }
+
+    for (int i = c->first; i >= 0; i = tree->items[i].next)
+        if (ot_ray_box(ray, &tree->items[i].box, &t) && (ray->id < 0 || t < ray->t)) {
+            ray->t = t;
+            ray->id = i;
+        }
+    for (unsigned k = 0; k < 8; k++)
+        if (c->child[k] >= 0)
+            ot_raycast_cell(tree, c->child[k], ray);
+}
+
+bool ot_raycast (const struct octree * tree, struct Point origin, struct Point dir, float tmax, unsigned * id, float * t)
+{
+    struct ot_ray ray;
+    ray.origin = origin;
+    ray.inv = Point(1 / dir.x, 1 / dir.y, 1 / dir.z);
+    ray.t = tmax;
+    ray.id = -1;
+
+    if (!tree->cells.empty())
+        ot_raycast_cell(tree, 0, &ray);
+
+    if (ray.id < 0)
+        return false;
+    *id = ray.id;
+    *t = ray.t;
+    return true;
+}
+
+/**
+ * @brief Check what a query found against a scan of every item
+ */
+static bool ot_check_query (const struct octree * tree, ot_test test, const void * shape, std::vector<unsigned> * found)
+{
+    /* every item in the tree is in it once: no repeats and the same count mean the same items */
+    std::sort(found->begin(), found->end());
+    if (std::adjacent_find(found->begin(), found->end()) != found->end())
+        return false;
+    for (unsigned i : *found)
+        if (tree->items[i].cell < 0 || test(shape, &tree->items[i].box) == CL_OUT)
+            return false;
+
+    size_t n = 0;
+    for (const struct ot_item & item : tree->items)
+        n += item.cell >= 0 && test(shape, &item.box) != CL_OUT;
+    return n == found->size();
+}
+
+/**
+ * @brief Check a raycast against a scan of every item, its nearest hit
+ *        worked out the same way
+ */
+static bool ot_check_ray (const struct octree * tree, struct Point origin, struct Point dir)
+{
+    struct ot_ray scan;
+    scan.origin = origin;
+    scan.inv = Point(1 / dir.x, 1 / dir.y, 1 / dir.z);
+    scan.t = FLT_MAX;
+    scan.id = -1;
+    for (unsigned i = 0; i < tree->items.size(); i++) {
+        float hit;
+        if (tree->items[i].cell >= 0 && ot_ray_box(&scan, &tree->items[i].box, &hit) && (scan.id < 0 || hit < scan.t)) {
+            scan.t = hit;
+            scan.id = i;
+        }
+    }
+
+    unsigned id;
+    float t;
+    bool hit = ot_raycast(tree, origin, dir, FLT_MAX, &id, &t);
+    return hit == (scan.id >= 0) && (!hit || t == scan.t);
+}
+
+bool ot_check (const struct octree * tree, const struct cl_frustum * frst)
+{
+    if (tree->cells.empty())
+        return true;
+
+    std::vector<unsigned> found;
+    ot_query_frustum(tree, frst, &found);
+    if (!ot_check_query(tree, ot_test_frustum, frst, &found))
+        return false;
+
+    for (unsigned i = 0; i < tree->items.size(); i++) {
+        const struct ot_item * item = &tree->items[i];
+        if (item->cell < 0)
+            continue;
+
+        const struct ot_cell * cell = &tree->cells[item->cell];
+        struct aabb loose = ot_loose(cell);
+        if (cell->depth > 0 && !ot_contains(&loose, &item->box))
+            return false;
+        int k = cell->first;
+        while (k >= 0 && k != (int) i)
+            k = tree->items[k].next;
+        if (k < 0)
+            return false;
+
+        /* around the item: its bounding sphere, its box, and a ray at it from a corner */
+        struct Point c = bb_center(&item->box);
+        struct Point e = bb_extent(&item->box);
+        struct ot_sphere s = { c, sqrtf(e.x * e.x + e.y * e.y + e.z * e.z), };
+        found.clear();
+        ot_query_sphere(tree, s.c, s.r, &found);
+        if (!ot_check_query(tree, ot_test_sphere, &s, &found))
+            return false;
+
+        found.clear();
+        ot_query_box(tree, &item->box, &found);
+        if (!ot_check_query(tree, ot_test_box, &item->box, &found))
+            return false;
+
+        struct Point away = e * 3 + Point(1, 1, 1);
+        if (!ot_check_ray(tree, c + away, away * -1))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,132 @@
+#ifndef _OCTREE_H
+#define _OCTREE_H
+
+#include "../generator/generators.h"
+#include "bounds.h"
+#include "cull.h"
+
+#include <stddef.h>
+
+#include <vector>
+
+/** Depth of the smallest cells, the root being at 0 */
+#define OT_MAX_DEPTH 8
+
+/**
+ * A cell of a loose octree. Its loose bounds are twice its size, so an
+ * item only has to fit in size and have its center in the cell to be
+ * kept in it. The root's loose bounds are unlimited: whatever doesn't fit
+ * anywhere else ends up there.
+ */
+struct ot_cell {
+    struct Point center; /*< Center of the cell */
+    float half;          /*< Half its size */
+    unsigned depth;      /*< 0 for the root */
+    int parent;          /*< Parent cell, -1 for the root; next free cell, if free */
+    int child[8];        /*< Children by octant, -1 if none */
+    int first;           /*< First item in it, -1 if none */
+    unsigned count;      /*< Items in its subtree */
+};
+
+/**
+ * An item of a loose octree
+ */
+struct ot_item {
+    struct aabb box; /*< Its bounds */
+    int cell;        /*< Cell it's in, -1 if it isn't in the tree */
+    int prev;        /*< Previous and next items in the same cell, -1 if none */
+    int next;
+};
+
+/**
+ * A loose octree over axis-aligned boxes, identified by index. Items are
+ * moved from cell to cell as their boxes change, and cells are created
+ * and freed as needed, so the tree never has to be rebuilt.
+ */
+struct octree {
+    std::vector<struct ot_cell> cells; /*< Cells, the root first */
+    std::vector<struct ot_item> items; /*< Items, indexed by ID */
+    int free;                          /*< First free cell, -1 if none */
+};
+
+/**
+ * @brief Make room for a number of items, and for every cell they can
+ *        take, so that moving them around doesn't allocate
+ * @param tree The tree
+ * @param n Number of items, IDs going from 0 to `n - 1`
+ */
+void ot_reserve (struct octree * tree, size_t n);
+
+/**
+ * @brief Take every item out, and start over with a new region
+ * @param tree The tree
+ * @param region Region the cells divide; items may lie outside of it
+ */
+void ot_clear (struct octree * tree, const struct aabb * region);
+
+/**
+ * @brief Insert an item, or move it if its box changed
+ * @param tree The tree
+ * @param id The item's ID
+ * @param box Its new bounds
+ */
+void ot_move (struct octree * tree, unsigned id, const struct aabb * box);
+
+/*
+ * Queries append the IDs they find to `out`, in no particular order, and
+ * return how many they found. `out` must have room for them, or it will
+ * allocate.
+ */
+
+/**
+ * @brief Find the items that aren't completely outside a frustum
+ * @param tree The tree
+ * @param frst The frustum
+ * @param[out] out Where the IDs found are appended
+ * @returns How many were found
+ */
+unsigned ot_query_frustum (const struct octree * tree, const struct cl_frustum * frst, std::vector<unsigned> * out);
+
+/**
+ * @brief Find the items whose boxes touch a sphere
+ * @param tree The tree
+ * @param c Center of the sphere
+ * @param r Its radius
+ * @param[out] out Where the IDs found are appended
+ * @returns How many were found
+ */
+unsigned ot_query_sphere (const struct octree * tree, struct Point c, float r, std::vector<unsigned> * out);
+
+/**
+ * @brief Find the items whose boxes overlap a box
+ * @param tree The tree
+ * @param b The box
+ * @param[out] out Where the IDs found are appended
+ * @returns How many were found
+ */
+unsigned ot_query_box (const struct octree * tree, const struct aabb * b, std::vector<unsigned> * out);
+
+/**
+ * @brief Find the nearest item whose box a ray hits, e.g. to pick
+ * @param tree The tree
+ * @param origin Where the ray starts
+ * @param dir Its direction, not necessarily normalized
+ * @param tmax Farthest hit wanted, in units of `dir`
+ * @param[out] id The item hit
+ * @param[out] t Where it was hit: `origin + t * dir`
+ * @returns Whether an item was hit
+ */
+bool ot_raycast (const struct octree * tree, struct Point origin, struct Point dir, float tmax, unsigned * id, float * t);
+
+/**
+ * @brief Check the tree against a scan of every item: each item must be
+ *        in its cell, within the cell's loose bounds, and queries around
+ *        each item must find what the scan does. Slow, and it allocates:
+ *        for debugging, not for every frame.
+ * @param tree The tree
+ * @param frst A frustum to query with too, e.g. the camera's
+ * @returns Whether it all matches
+ */
+bool ot_check (const struct octree * tree, const struct cl_frustum * frst);
+
+#endif /* _OCTREE_H */
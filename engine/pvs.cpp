@@ -0,0 +1,186 @@
+#define _USE_MATH_DEFINES
+#include "pvs.h"
+
+#include "pugixml/pugixml.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define maybe(atr, def) ((atr) ? atr.as_float() : (def))
+
+/** Identifies a file of sets, and its version */
+static const char pv_magic[4] = { 'P', 'V', 'S', '2', };
+
+bool pv_load_path (const char * fname, struct pv_path * path)
+{
+    pugi::xml_document doc;
+    if (!doc.load_file(fname))
+        return false;
+
+    pugi::xml_node node = doc.child("path");
+    path->time = maybe(node.attribute("TIME"), 60000);
+    path->samples = maybe(node.attribute("SAMPLES"), 16);
+    path->keys.clear();
+
+    for (pugi::xml_node k = node.child("key"); k; k = k.next_sibling("key")) {
+        struct pv_key key;
+        key.eye = Point(maybe(k.attribute("X"), 0), maybe(k.attribute("Y"), 0), maybe(k.attribute("Z"), 0));
+        key.center = Point(maybe(k.attribute("CX"), 0), maybe(k.attribute("CY"), 0), maybe(k.attribute("CZ"), 0));
+        path->keys.push_back(key);
+    }
+
+    return path->keys.size() >= 2 && path->time > 0 && path->samples > 0;
+}
+
+void pv_path_sample (const struct pv_path * path, unsigned segment, float u, struct pv_key * key)
+{
+    const struct pv_key * a = &path->keys[segment];
+    const struct pv_key * b = &path->keys[(segment + 1) % path->keys.size()];
+    key->eye = a->eye + (b->eye - a->eye) * u;
+    key->center = a->center + (b->center - a->center) * u;
+}
+
+unsigned pv_path_at (const struct pv_path * path, unsigned elapsed, struct pv_key * key)
+{
+    float t = (float) (elapsed % path->time) / path->time * path->keys.size();
+    unsigned segment = (unsigned) t % path->keys.size();
+    pv_path_sample(path, segment, t - floorf(t), key);
+    return segment;
+}
+
+void pv_clear (struct pvs * sets, unsigned n_nodes, uint32_t scene_hash, const struct pv_lens * lens)
+{
+    sets->n_nodes = n_nodes;
+    sets->scene_hash = scene_hash;
+    sets->lens = *lens;
+    sets->first.assign(1, 0);
+    sets->runs.clear();
+}
+
+void pv_push (struct pvs * sets, const unsigned char * bits)
+{
+    /* runs alternate, so a set starting with a 1 starts with an empty run */
+    unsigned char value = 0;
+    unsigned run = 0;
+    for (unsigned i = 0; i < sets->n_nodes; i++) {
+        if ((bits[i] != 0) != value) {
+            sets->runs.push_back(run);
+            value = !value;
+            run = 0;
+        }
+        run++;
+    }
+    sets->runs.push_back(run);
+    sets->first.push_back(sets->runs.size());
+}
+
+void pv_get (const struct pvs * sets, unsigned i, unsigned char * bits)
+{
+    unsigned char value = 0;
+    for (unsigned r = sets->first[i]; r < sets->first[i + 1]; r++) {
+        memset(bits, value, sets->runs[r]);
+        bits += sets->runs[r];
+        value = !value;
+    }
+}
+
+bool pv_covers (const struct pv_lens * baked, const struct pv_lens * live)
+{
+    /* a hair of slack for the rounding of window sizes */
+    const float slack = 1.0001f;
+    float baked_h = tanf(baked->fovy * (float) M_PI / 360);
+    float live_h = tanf(live->fovy * (float) M_PI / 360);
+
+    struct Point a = normalize(baked->up);
+    struct Point b = normalize(live->up);
+    return live_h <= baked_h * slack
+        && live_h * live->aspect <= baked_h * baked->aspect * slack
+        && live->znear * slack >= baked->znear
+        && live->zfar <= baked->zfar * slack
+        && a.x * b.x + a.y * b.y + a.z * b.z >= 1 - 1e-4f;
+}
+
+unsigned pv_count (const struct pvs * sets)
+{
+    return sets->first.empty() ? 0 : sets->first.size() - 1;
+}
+
+/*
+ * The file is the header, `first` and `runs`, as 32 bit integers in the
+ * machine's byte order: it's only meant to be read where it was baked.
+ */
+
+bool pv_save (const struct pvs * sets, const char * fname)
+{
+    FILE * outf = fopen(fname, "wb");
+    if (!outf)
+        return false;
+
+    uint32_t header[4] = {
+        sets->n_nodes,
+        sets->scene_hash,
+        (uint32_t) sets->first.size(),
+        (uint32_t) sets->runs.size(),
+    };
+    const struct pv_lens * l = &sets->lens;
+    float lens[7] = { l->fovy, l->aspect, l->znear, l->zfar, l->up.x, l->up.y, l->up.z, };
+    std::vector<uint32_t> first(sets->first.begin(), sets->first.end());
+    std::vector<uint32_t> runs(sets->runs.begin(), sets->runs.end());
+
+    bool ok = fwrite(pv_magic, sizeof(pv_magic), 1, outf) == 1
+        && fwrite(header, sizeof(header), 1, outf) == 1
+        && fwrite(lens, sizeof(lens), 1, outf) == 1
+        && fwrite(first.data(), sizeof(uint32_t), first.size(), outf) == first.size()
+        && fwrite(runs.data(), sizeof(uint32_t), runs.size(), outf) == runs.size();
+
+    return fclose(outf) == 0 && ok;
+}
+
+bool pv_load (struct pvs * sets, const char * fname)
+{
+    FILE * inf = fopen(fname, "rb");
+    if (!inf)
+        return false;
+
+    char magic[sizeof(pv_magic)];
+    uint32_t header[4];
+    float lens[7];
+    bool ok = fread(magic, sizeof(magic), 1, inf) == 1
+        && memcmp(magic, pv_magic, sizeof(magic)) == 0
+        && fread(header, sizeof(header), 1, inf) == 1
+        && fread(lens, sizeof(lens), 1, inf) == 1
+        && header[2] > 0;
+
+    std::vector<uint32_t> first(ok ? header[2] : 0);
+    std::vector<uint32_t> runs(ok ? header[3] : 0);
+    ok = ok
+        && fread(first.data(), sizeof(uint32_t), first.size(), inf) == first.size()
+        && fread(runs.data(), sizeof(uint32_t), runs.size(), inf) == runs.size()
+        && first.front() == 0
+        && first.back() == runs.size();
+    fclose(inf);
+
+    /* every set has to be exactly `n_nodes` bits */
+    for (size_t i = 0; ok && i + 1 < first.size(); i++) {
+        uint64_t bits = 0;
+        ok = first[i] <= first[i + 1];
+        for (uint32_t r = first[i]; ok && r < first[i + 1]; r++)
+            bits += runs[r];
+        ok = ok && bits == header[0];
+    }
+
+    if (!ok)
+        return false;
+
+    sets->n_nodes = header[0];
+    sets->scene_hash = header[1];
+    sets->lens.fovy = lens[0];
+    sets->lens.aspect = lens[1];
+    sets->lens.znear = lens[2];
+    sets->lens.zfar = lens[3];
+    sets->lens.up = Point(lens[4], lens[5], lens[6]);
+    sets->first.assign(first.begin(), first.end());
+    sets->runs.assign(runs.begin(), runs.end());
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef _PVS_H
+#define _PVS_H
+
+#include "../generator/generators.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * A key of a camera path: where the camera is and what it looks at
+ */
+struct pv_key {
+    struct Point eye;
+    struct Point center;
+};
+
+/**
+ * A closed camera path, flown at constant speed from key to key. Each
+ * pair of consecutive keys is a segment.
+ */
+struct pv_path {
+    std::vector<struct pv_key> keys; /*< Keys, in order */
+    unsigned time;                   /*< Time in msecs to go around the path */
+    unsigned samples;                /*< Samples per segment when baking */
+};
+
+/**
+ * How a camera projects, as far as what it can see goes
+ */
+struct pv_lens {
+    float fovy;      /*< Vertical field of view, in degrees */
+    float aspect;    /*< Width over height */
+    float znear;     /*< Near plane distance */
+    float zfar;      /*< Far plane distance */
+    struct Point up; /*< Up direction */
+};
+
+/**
+ * Potentially visible sets, one per segment of a camera path: a bit per
+ * scene node, set if its models may be seen from the segment. The bits
+ * are stored run-length encoded.
+ */
+struct pvs {
+    unsigned n_nodes;            /*< Bits per set */
+    uint32_t scene_hash;         /*< Of the scene they were baked for */
+    struct pv_lens lens;         /*< Of the camera they were baked with */
+    std::vector<unsigned> first; /*< First run of each set in `runs`, and one past the last */
+    std::vector<unsigned> runs;  /*< Lengths of alternating runs of 0s and 1s, 0s first */
+};
+
+/**
+ * @brief Load a camera path file:
+ *        `<path TIME="ms" SAMPLES="n"><key X Y Z CX CY CZ/>...</path>`
+ * @param fname The path to the file
+ * @param[out] path Where to save it
+ * @returns `true` if it was loaded and has two keys at least
+ */
+bool pv_load_path (const char * fname, struct pv_path * path);
+
+/**
+ * @brief Where the camera is at some point of a segment
+ * @param path The path
+ * @param segment The segment
+ * @param u How far along it, from 0 to 1
+ * @param[out] key The camera
+ */
+void pv_path_sample (const struct pv_path * path, unsigned segment, float u, struct pv_key * key);
+
+/**
+ * @brief Where the camera is at some time
+ * @param path The path
+ * @param elapsed Number of ms since it started going around
+ * @param[out] key The camera
+ * @returns The segment it's in
+ */
+unsigned pv_path_at (const struct pv_path * path, unsigned elapsed, struct pv_key * key);
+
+/**
+ * @brief Remove every set
+ * @param sets The sets
+ * @param n_nodes Bits per set
+ * @param scene_hash Of the scene they're for
+ * @param lens Of the camera they're for
+ */
+void pv_clear (struct pvs * sets, unsigned n_nodes, uint32_t scene_hash, const struct pv_lens * lens);
+
+/**
+ * @brief Does a lens see no more than another? Sets baked with `baked`
+ *        only hold for cameras it covers: no wider either way, clipping
+ *        no less, and with the same up direction.
+ */
+bool pv_covers (const struct pv_lens * baked, const struct pv_lens * live);
+
+/**
+ * @brief Add a set
+ * @param sets The sets
+ * @param bits A byte per bit, `n_nodes` of them
+ */
+void pv_push (struct pvs * sets, const unsigned char * bits);
+
+/**
+ * @brief Read a set
+ * @param sets The sets
+ * @param i Which one
+ * @param[out] bits A byte per bit, `n_nodes` of them
+ */
+void pv_get (const struct pvs * sets, unsigned i, unsigned char * bits);
+
+/**
+ * @brief Number of sets
+ */
+unsigned pv_count (const struct pvs * sets);
+
+/**
+ * @brief Save sets to a file
+ * @returns `true` if they were saved
+ */
+bool pv_save (const struct pvs * sets, const char * fname);
+
+/**
+ * @brief Load sets from a file saved by `pv_save`
+ * @returns `true` if they were loaded
+ */
+bool pv_load (struct pvs * sets, const char * fname);
+
+#endif /* _PVS_H */
@@ -0,0 +1,110 @@
+#include "render_queue.h"
+
+#include <string.h>
+
+/**
+ * @brief Number of material, texture and mesh changes between two keys
+ */
+static unsigned rq_state_changes (uint64_t a, uint64_t b)
+{
+    return (RQ_FIELD(a, MAT) != RQ_FIELD(b, MAT))
+        + (RQ_FIELD(a, TEXT) != RQ_FIELD(b, TEXT))
+        + (RQ_FIELD(a, MESH) != RQ_FIELD(b, MESH));
+}
+
+uint64_t rq_key (enum rq_pass pass, unsigned mat, unsigned text, unsigned mesh, float depth)
+{
+    /*
+     * The bit pattern of a non-negative float grows with its value, so
+     * its top bits make a (roughly logarithmic) depth bucket.
+     */
+    uint32_t d = 0;
+    if (depth > 0)
+        memcpy(&d, &depth, sizeof(d));
+    d >>= 32 - RQ_DEPTH_BITS;
+
+#define field(v, F) \
+    (((uint64_t) (v) & ((UINT64_C(1) << RQ_ ## F ## _BITS) - 1)) << RQ_ ## F ## _SHIFT)
+    return field(pass, PASS)
+        | field(mat, MAT)
+        | field(text, TEXT)
+        | field(mesh, MESH)
+        | field(d, DEPTH);
+#undef field
+}
+
+void rq_reserve (struct render_queue * rq, size_t n)
+{
+    rq->packets.reserve(n);
+    rq->entries.reserve(n);
+    if (rq->scratch.size() < n)
+        rq->scratch.resize(n);
+}
+
+void rq_clear (struct render_queue * rq)
+{
+    rq->packets.clear();
+    rq->entries.clear();
+}
+
+struct rq_packet * rq_push (struct render_queue * rq, uint64_t key)
+{
+    struct rq_entry entry;
+    entry.key = key;
+    entry.packet = rq->packets.size();
+    rq->entries.push_back(entry);
+    rq->packets.push_back(rq_packet());
+    return &rq->packets.back();
+}
+
+void rq_sort (struct render_queue * rq)
+{
+    size_t n = rq->entries.size();
+
+    rq->stats.packets = n;
+    rq->stats.state_changes = 0;
+    rq->stats.saved = 0;
+
+    unsigned unsorted = 0;
+    for (size_t i = 1; i < n; i++)
+        unsorted += rq_state_changes(rq->entries[i - 1].key, rq->entries[i].key);
+
+    if (rq->scratch.size() < n)
+        rq->scratch.resize(n);
+
+    struct rq_entry * src = rq->entries.data();
+    struct rq_entry * dst = rq->scratch.data();
+
+    /* LSD radix sort, one byte at a time */
+    for (unsigned shift = 0; shift < 64; shift += 8) {
+        size_t count[256] = {0};
+        for (size_t i = 0; i < n; i++)
+            count[(src[i].key >> shift) & 0xff]++;
+
+        /* every key has the same byte, nothing to do on this pass */
+        if (n == 0 || count[(src[0].key >> shift) & 0xff] == n)
+            continue;
+
+        size_t offset = 0;
+        for (unsigned b = 0; b < 256; b++) {
+            size_t c = count[b];
+            count[b] = offset;
+            offset += c;
+        }
+
+        for (size_t i = 0; i < n; i++)
+            dst[count[(src[i].key >> shift) & 0xff]++] = src[i];
+
+        struct rq_entry * tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != rq->entries.data())
+        memcpy(rq->entries.data(), src, n * sizeof(struct rq_entry));
+
+    for (size_t i = 1; i < n; i++)
+        rq->stats.state_changes += rq_state_changes(rq->entries[i - 1].key, rq->entries[i].key);
+    if (unsorted > rq->stats.state_changes)
+        rq->stats.saved = unsorted - rq->stats.state_changes;
+}
@@ -0,0 +1,115 @@
+#ifndef _RENDER_QUEUE_H
+#define _RENDER_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * Render passes, in the order they're executed
+ */
+enum rq_pass {
+    RQ_PASS_OPAQUE, /*< Opaque geometry, drawn roughly front-to-back */
+};
+
+/**
+ * Bit layout of a sort key, from the most to the least significant field
+ *
+ * | pass | material | texture | mesh | depth |
+ * |  4   |    12    |   12    |  12  |  24   |
+ */
+#define RQ_PASS_BITS  4
+#define RQ_MAT_BITS   12
+#define RQ_TEXT_BITS  12
+#define RQ_MESH_BITS  12
+#define RQ_DEPTH_BITS 24
+
+#define RQ_DEPTH_SHIFT 0
+#define RQ_MESH_SHIFT  (RQ_DEPTH_SHIFT + RQ_DEPTH_BITS)
+#define RQ_TEXT_SHIFT  (RQ_MESH_SHIFT + RQ_MESH_BITS)
+#define RQ_MAT_SHIFT   (RQ_TEXT_SHIFT + RQ_TEXT_BITS)
+#define RQ_PASS_SHIFT  (RQ_MAT_SHIFT + RQ_MAT_BITS)
+
+#define RQ_FIELD(key, F) \
+    (((key) >> RQ_ ## F ## _SHIFT) & ((UINT64_C(1) << RQ_ ## F ## _BITS) - 1))
+
+/**
+ * A draw packet: everything needed to draw one model instance
+ */
+struct rq_packet {
+    unsigned mesh;  /*< The model to draw */
+    unsigned mat;   /*< Its material */
+    unsigned first; /*< First vertex to draw */
+    unsigned count; /*< Number of vertices to draw */
+    float mv[16];   /*< Modelview matrix of this instance */
+};
+
+/**
+ * An entry of the sorted order: a key and the packet it belongs to
+ */
+struct rq_entry {
+    uint64_t key;
+    unsigned packet;
+};
+
+/**
+ * Statistics of the last sorted frame
+ */
+struct rq_stats {
+    unsigned packets;       /*< Packets submitted */
+    unsigned state_changes; /*< Material/texture/mesh changes after sorting */
+    unsigned saved;         /*< State changes avoided by sorting */
+};
+
+/**
+ * A render queue. It's cleared, filled and sorted every frame, but its
+ * storage is kept around so that a steady scene doesn't allocate.
+ */
+struct render_queue {
+    std::vector<struct rq_packet> packets; /*< Packets in submission order */
+    std::vector<struct rq_entry> entries;  /*< Sorted order of the packets */
+    std::vector<struct rq_entry> scratch;  /*< Radix sort double buffer */
+    struct rq_stats stats;
+};
+
+/**
+ * @brief Build the sort key of a packet
+ * @param pass The render pass
+ * @param mat Material ID
+ * @param text Texture ID (0 if none)
+ * @param mesh Mesh ID
+ * @param depth Distance from the camera (view space)
+ * @returns The key
+ */
+uint64_t rq_key (enum rq_pass pass, unsigned mat, unsigned text, unsigned mesh, float depth);
+
+/**
+ * @brief Make room for a number of packets, so that filling the queue
+ *        doesn't allocate
+ * @param rq The render queue
+ * @param n Number of packets
+ */
+void rq_reserve (struct render_queue * rq, size_t n);
+
+/**
+ * @brief Empty a render queue, keeping its storage
+ * @param rq The render queue
+ */
+void rq_clear (struct render_queue * rq);
+
+/**
+ * @brief Add a packet to a render queue
+ * @param rq The render queue
+ * @param key The packet's sort key
+ * @returns The packet to fill in
+ */
+struct rq_packet * rq_push (struct render_queue * rq, uint64_t key);
+
+/**
+ * @brief Radix sort the queue's packets by key and update its statistics
+ * @param rq The render queue
+ */
+void rq_sort (struct render_queue * rq);
+
+#endif /* _RENDER_QUEUE_H */
@@ -2,7 +2,17 @@
 #include "../generator/generators.h"
 
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <new>
 
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -16,7 +26,11 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#include "atlas.h"
+#include "gl_state.h"
 #include "scene.h"
+#include "texcache.h"
+#include "workers.h"
 
 #define maybe(atr, def) ((atr) ? atr.as_float() : (def))
 #define match(tag, func) \
@@ -25,40 +39,105 @@
 #define UNIMPLEMENTED() assert(!"unimplemented")
 #define UNREACHABLE()   assert(!"unreachable")
 
-static void sc_draw_rotate (const struct gt * gt)
+/**
+ * A model's vertex data, as read from its file
+ */
+struct sc_mesh_data {
+    std::vector<struct Point> vertices;
+    std::vector<struct Point> normals;
+    std::vector<struct Point> tcoords;
+};
+
+/** Time loading is measured in */
+typedef std::chrono::steady_clock sc_clock;
+
+/**
+ * Stages of loading a scene's assets, in order
+ */
+enum sc_load_stage {
+    SC_LOAD_ASSETS,  /*< Meshes and images are read on the workers, and meshes uploaded */
+    SC_LOAD_TILES,   /*< Tiles of the atlas are built on the workers, and uploaded */
+    SC_LOAD_BATCHES, /*< Static subtrees are batched */
+    SC_LOAD_DONE,
+};
+
+/**
+ * Things that are only needed while loading a scene file. The scene can
+ * be drawn while its assets are loaded, so it's kept until they all are.
+ */
+struct sc_load_ctx {
+    enum sc_load_stage stage;                   /*< What's being loaded */
+    unsigned tasks;                             /*< Tasks of the batch launched on the workers */
+    unsigned taken;                             /*< Those taken back */
+
+    std::map<std::string, unsigned> texts;      /*< Image IDs in `atlas` by file name */
+    std::vector<std::string> text_files;        /*< File names by image ID */
+    std::vector<struct at_image> images;        /*< Images by ID, as decoded */
+    std::vector<uint64_t> text_hashes;          /*< Hashes of their files */
+    std::vector<struct tc_map> cached;          /*< Their cached tiles, where they're up to date */
+    std::string cache_dir;                      /*< Where tiles are cached, none if empty */
+    std::map<std::string, int> vtexs;           /*< Virtual texture IDs by file name, -1 if it didn't load */
+    unsigned vtex_cache;                        /*< Slots across the page cache, to make it */
+    std::map<std::string, unsigned> meshes;     /*< Mesh IDs by file name */
+    std::vector<std::string> mesh_files;        /*< File names by mesh ID */
+    std::map<std::string, unsigned> occluders;  /*< Occluder mesh IDs by file name */
+    std::vector<std::string> occluder_files;    /*< File names by occluder mesh ID */
+    std::vector<struct sc_mesh_data> mesh_data; /*< Vertex data by mesh ID, for batching */
+    std::vector<struct sc_mesh_data> occluder_data; /*< Vertex data by occluder mesh ID, until all are read */
+    std::vector<unsigned> uploads;              /*< Meshes read, in the order they're uploaded */
+    unsigned uploaded;                          /*< Those uploaded */
+    struct atlas atlas;                         /*< Every texture's image, packed once all are loaded */
+    unsigned atlas_size;                        /*< Largest width or height of its texture */
+    unsigned atlas_text;                        /*< Its texture */
+    bool separate;                              /*< Does each image get a texture of its own instead, not fitting in it? */
+    unsigned first_tile;                        /*< First tile of the run being built */
+    std::vector<int> mat_images;                /*< Image ID by material, until its tile is uploaded; -1 if none */
+    std::vector<struct mat4> world;             /*< World matrices of static nodes, to batch them */
+    std::vector<bool> whole;                    /*< Is every node of each subtree static? */
+    unsigned next_root;                         /*< Next node that may root a batched subtree */
+};
+
+/** DevIL isn't thread safe: only one thread may use it at a time */
+static std::mutex sc_il_lock;
+
+#ifndef NDEBUG
+/*
+ * Count the allocations made by each thread, so that `sc_draw` can
+ * assert that drawing a frame doesn't touch the heap.
+ */
+static thread_local size_t sc_allocations = 0;
+
+void * operator new (size_t size)
 {
-    assert(gt->type == GT_ROTATE);
-    glRotatef(gt->angle, gt->p.x, gt->p.y, gt->p.z);
+    sc_allocations++;
+    void * ret = malloc((size > 0) ? size : 1);
+    if (!ret)
+        throw std::bad_alloc();
+    return ret;
 }
 
-static void sc_draw_rotate_anim (const struct gt * gt, unsigned elapsed)
+void operator delete (void * ptr) noexcept
 {
-    assert(gt->type == GT_ROTATE_ANIM);
-    float angle = (360.0 * elapsed) / gt->time;
-    glRotatef(angle, gt->p.x, gt->p.y, gt->p.z);
+    free(ptr);
 }
+#endif /* NDEBUG */
 
-static void sc_draw_scale (const struct gt * gt)
+static struct mat4 sc_rotate (const struct gt * gt)
 {
-    assert(gt->type == GT_SCALE);
-    glScalef(gt->p.x, gt->p.y, gt->p.z);
+    assert(gt->type == GT_ROTATE);
+    return m4_rotate(gt->angle, gt->p.x, gt->p.y, gt->p.z);
 }
 
-static void sc_draw_translate (const struct gt * gt)
+static struct mat4 sc_scale (const struct gt * gt)
 {
-    assert(gt->type == GT_TRANSLATE);
-    glTranslatef(gt->p.x, gt->p.y, gt->p.z);
+    assert(gt->type == GT_SCALE);
+    return m4_scale(gt->p.x, gt->p.y, gt->p.z);
 }
 
-static void get_global_catmull_rom_point (float gt, struct Point * pos, struct Point * deriv, const std::vector<struct Point> cp);
-static void sc_draw_translate_anim (struct gt * gt, unsigned elapsed)
+static struct mat4 sc_translate (const struct gt * gt)
 {
-    assert(gt->type == GT_TRANSLATE_ANIM);
-    float t = (float) elapsed / (float) gt->time;
-    struct Point pos;
-    struct Point deriv;
-    get_global_catmull_rom_point(t, &pos, &deriv, gt->control_points);
-    glTranslatef(pos.x, pos.y, pos.z);
+    assert(gt->type == GT_TRANSLATE);
+    return m4_translate(gt->p.x, gt->p.y, gt->p.z);
 }
 
 static void mult_matrix_vector (const float m[16], const float v[4], float res[4])
@@ -70,7 +149,11 @@ static void mult_matrix_vector (const float m[16], const float v[4], float res[4
     }
 }
 
-static void get_catmull_rom_point (float t, struct Point p0, struct Point p1, struct Point p2, struct Point p3, struct Point * pos, struct Point * deriv)
+/**
+ * @brief Polynomial coefficients of the Catmull-Rom segment between `p1`
+ *        and `p2`
+ */
+static struct cr_segment sc_catmull_rom_segment (struct Point p0, struct Point p1, struct Point p2, struct Point p3)
 {
     // catmull-rom matrix
     const float m[16] = {
@@ -80,154 +163,759 @@ static void get_catmull_rom_point (float t, struct Point p0, struct Point p1, st
         0.0f,  1.0f,  0.0f,  0.0f,
     };
 
+    struct cr_segment ret;
+
 #define cenas(f) \
     do { \
         float A[4];                                     \
         const float P[4] = { p0.f, p1.f, p2.f, p3.f };  \
         mult_matrix_vector(m, P, A);                    \
-        pos->f = t*t*t*A[0] + t*t*A[1] + t*A[2] + A[3]; \
-        deriv->f = 3*t*t*A[0] + 2*t*A[1] + A[2];        \
+        ret.a.f = A[0];                                 \
+        ret.b.f = A[1];                                 \
+        ret.c.f = A[2];                                 \
+        ret.d.f = A[3];                                 \
     } while(0)
 
     cenas(x);
     cenas(y);
     cenas(z);
+#undef cenas
+
+    return ret;
 }
 
-static void get_global_catmull_rom_point (float gt, struct Point * pos, struct Point * deriv, const std::vector<struct Point> cp)
+/**
+ * @brief Point of a closed Catmull-Rom curve
+ * @param gt A GT_TRANSLATE_ANIM
+ * @param gt_ Global position along the curve, in `[0, 1[`
+ */
+static inline struct Point sc_catmull_rom_point (const struct gt * gt, float gt_)
 {
-    unsigned POINT_COUNT = cp.size();
-    float t = gt * POINT_COUNT; // this is the real global t
-    int index = floor(t); // which segment
+    unsigned n = gt->segments.size();
+    float t = gt_ * n;
+    unsigned index = (unsigned) t; // which segment
+    if (index >= n)
+        index = n - 1;
     t -= index; // where within the segment
 
-    // indices store the points
-    int i[4];
-    i[0] = (index + POINT_COUNT - 1) % POINT_COUNT;
-    i[1] = (i[0] + 1) % POINT_COUNT;
-    i[2] = (i[1] + 1) % POINT_COUNT;
-    i[3] = (i[2] + 1) % POINT_COUNT;
-
-    get_catmull_rom_point(t, cp[i[0]], cp[i[1]], cp[i[2]], cp[i[3]], pos, deriv);
+    const struct cr_segment * s = &gt->segments[index];
+    return Point(
+            ((s->a.x * t + s->b.x) * t + s->c.x) * t + s->d.x,
+            ((s->a.y * t + s->b.y) * t + s->c.y) * t + s->d.y,
+            ((s->a.z * t + s->b.z) * t + s->c.z) * t + s->d.z
+            );
 }
 
-static void buildRotMatrix (struct Point x, struct Point y, struct Point z, float m[16])
+/**
+ * @brief Apply a node's transform program
+ * @param scene The scene
+ * @param node The node
+ * @param[in,out] m The parent's world matrix, which becomes the node's
+ */
+static void sc_run_program (struct scene * scene, const struct node * node, struct mat4 * m)
 {
-    m[0] = x.x; m[1] = x.y; m[2] = x.z; m[3] = 0;
-    m[4] = y.x; m[5] = y.y; m[6] = y.z; m[7] = 0;
-    m[8] = z.x; m[9] = z.y; m[10] = z.z; m[11] = 0;
-    m[12] = 0; m[13] = 0; m[14] = 0; m[15] = 1;
+    const struct op * ops = &scene->ops[node->first_op];
+    for (unsigned i = 0; i < node->n_ops; i++) {
+        const struct op * op = &ops[i];
+        switch (op->type) {
+            case OP_MATRIX:
+                *m = m4_mul(m, &scene->matrices[op->arg]);
+                break;
+
+            case OP_ROTATE_ANIM:
+                *m = m4_mul(m, &scene->anim.rot_out[op->arg]);
+                break;
+
+            case OP_TRANSLATE_ANIM:
+                scene->curves[scene->channel_curves[op->arg]].world = *m;
+                *m = m4_mul_translate(m,
+                        scene->anim.tr_x[op->arg],
+                        scene->anim.tr_y[op->arg],
+                        scene->anim.tr_z[op->arg]);
+                break;
+
+            case OP_BAKED:
+                if (scene->baked_curves[op->arg] >= 0)
+                    scene->curves[scene->baked_curves[op->arg]].world = *m;
+                *m = m4_mul(m, &scene->anim.bk_out[op->arg]);
+                break;
+
+            default: UNREACHABLE();
+        }
+    }
 }
 
-static void sc_draw_cm_curve (const struct gt * gt)
+/**
+ * @brief Draw the path of every GT_TRANSLATE_ANIM
+ * @param scene The scene
+ * @param view The view matrix
+ */
+static void sc_draw_curves (const struct scene * scene, const struct mat4 * view)
 {
-    glBegin(GL_LINE_LOOP);
-    for (unsigned i = 0; i < 100; i++) {
-        struct Point pos;
-        struct Point deriv;
+    if (scene->curves.empty())
+        return;
 
-        get_global_catmull_rom_point(((float) i) / 100, &pos, &deriv, gt->control_points);
-        glVertex3f(pos.x, pos.y, pos.z);
+    /* curves only have positions */
+    gs_client_state(GL_NORMAL_ARRAY, false);
+    gs_client_state(GL_TEXTURE_COORD_ARRAY, false);
+
+    for (const struct curve & curve : scene->curves) {
+        struct mat4 mv = m4_mul(view, &curve.world);
+        glLoadMatrixf(mv.m);
+        gs_array_pointer(GL_VERTEX_ARRAY, curve.vbo, 3);
+        glDrawArrays(GL_LINE_LOOP, 0, curve.length);
     }
-    glEnd();
+
+    gs_client_state(GL_NORMAL_ARRAY, true);
+    gs_client_state(GL_TEXTURE_COORD_ARRAY, true);
 }
 
-static inline float distpp(struct Point n, struct Point p, struct Point c)
+/**
+ * @brief Draw the 12 edges of a box, from each corner along each axis
+ *        it's at the bottom of
+ */
+static void sc_draw_box (const struct aabb * b)
 {
-    float d = -(n.x*p.x + n.y*p.y + n.z*p.z);
-    return n.x*c.x + n.y*c.y + n.z*c.z + d;
+    glBegin(GL_LINES);
+    for (unsigned c = 0; c < 8; c++) {
+        for (unsigned a = 0; a < 3; a++) {
+            if (c & (1 << a))
+                continue;
+            unsigned d = c | (1 << a);
+            glVertex3f((c & 1) ? b->max.x : b->min.x, (c & 2) ? b->max.y : b->min.y, (c & 4) ? b->max.z : b->min.z);
+            glVertex3f((d & 1) ? b->max.x : b->min.x, (d & 2) ? b->max.y : b->min.y, (d & 4) ? b->max.z : b->min.z);
+        }
+    }
+    glEnd();
 }
 
-static inline bool is_out (struct Point c, float r, struct Plane plane)
+/**
+ * @brief Draw the box of every model in sight whose mesh was read, but
+ *        isn't uploaded yet, in its place
+ * @param scene The scene, being loaded
+ * @param view The view matrix
+ */
+static void sc_draw_placeholders (const struct scene * scene, const struct mat4 * view)
 {
-    return distpp(plane.n, plane.p, c) + r < 0;
+    gs_enable(GL_LIGHTING, false);
+    gs_enable(GL_TEXTURE_2D, false);
+    glColor3f(0.5f, 0.5f, 0.5f);
+
+    for (unsigned i = 0; i < scene->nodes.size(); i++) {
+        const struct node * node = &scene->nodes[i];
+        if (node->flags & NODE_CULLED)
+            continue;
+
+        struct mat4 mv = m4_mul(view, &scene->world[i]);
+        glLoadMatrixf(mv.m);
+        for (unsigned j = node->first_instance; j < node->first_instance + node->n_instances; j++) {
+            const struct aabb * b = &scene->models[scene->instances[j].mesh].box;
+            if (scene->models[scene->instances[j].mesh].length == 0 && !bb_is_empty(b))
+                sc_draw_box(b);
+        }
+    }
+
+    glColor3f(1, 1, 1);
+    gs_enable(GL_LIGHTING, true);
+    gs_enable(GL_TEXTURE_2D, true);
 }
 
-static void sc_draw_model (struct scene * scene, const struct frustum * frst, struct model * model)
+/**
+ * @brief Queue a model
+ * @param scene The scene
+ * @param mv Its modelview matrix
+ * @param model The model
+ * @param depth Its distance from the camera, to sort by
+ * @returns Its packet, set to draw the whole model
+ */
+static struct rq_packet * sc_submit_model (struct scene * scene, const struct mat4 * mv, const struct model * model, float depth)
 {
-    struct Point P = Point(0, 0, 0);
-    bool shouldnt_draw = false
-        || is_out(P, 40, frst->far)
-        || is_out(P, 40, frst->near)
-        || is_out(P, 40, frst->top)
-        || is_out(P, 40, frst->bot)
-        || is_out(P, 40, frst->left)
-        || is_out(P, 40, frst->right);
-
-#if 0
-    if (shouldnt_draw)
-        return;
-#endif
+    const struct attribs * atr = &scene->materials[model->mat];
+
+    uint64_t key = rq_key(RQ_PASS_OPAQUE,
+            model->mat,
+            (atr->has_text) ? atr->text : 0,
+            model->mesh,
+            depth);
+
+    struct rq_packet * pkt = rq_push(&scene->queue, key);
+    pkt->mesh = model->mesh;
+    pkt->mat = model->mat;
+    pkt->first = 0;
+    pkt->count = scene->models[model->mesh].length;
+    memcpy(pkt->mv, mv->m, sizeof(pkt->mv));
+    return pkt;
+}
 
-    glPushAttrib(GL_LIGHTING_BIT);
-    struct model_vbo mvbo = scene->models[model->fname];
-    struct attribs atr = mvbo.attribs[model->id];
+/**
+ * @brief Set every material component, falling back to GL's defaults
+ * @param atr The material, or `NULL` for the default material
+ */
+static void sc_draw_material (const struct attribs * atr)
+{
+    /* images are parts of the atlas */
+    static const GLfloat whole[4] = { 0, 0, 1, 1, };
+    gs_texture_rect((atr && atr->has_text) ? atr->text_rect : whole);
 
-#define draw_(T, GL) \
-    if (atr.has_ ## T) do { \
-        GLfloat color[4] = {atr.T.x, atr.T.y, atr.T.z, 1}; \
-        glMaterialfv(GL_FRONT, GL, color);                 \
+#define draw_(T, GL, R, G, B) \
+    do { \
+        GLfloat color[4] = {R, G, B, 1};                       \
+        if (atr && atr->has_ ## T) {                           \
+            color[0] = atr->T.x;                               \
+            color[1] = atr->T.y;                               \
+            color[2] = atr->T.z;                               \
+        }                                                      \
+        gs_material(GL, color);                                \
     } while (0)
-    draw_(amb,  GL_AMBIENT);
-    draw_(diff, GL_DIFFUSE);
-    draw_(spec, GL_SPECULAR);
-    if (!atr.has_text)
-        draw_(emi,  GL_EMISSION);
+    draw_(amb,  GL_AMBIENT,  0.2, 0.2, 0.2);
+    draw_(diff, GL_DIFFUSE,  0.8, 0.8, 0.8);
+    draw_(spec, GL_SPECULAR, 0, 0, 0);
+    if (atr && atr->has_text)
+        atr = NULL; /* textured models aren't emissive */
+    draw_(emi,  GL_EMISSION, 0, 0, 0);
 
     //glMaterialf(GL_FRONT, GL_SHININESS, 128);
 #undef draw_
+}
+
+/**
+ * @brief Draw a packet. State that's already set is filtered out by the
+ *        state cache, which is why the queue is sorted.
+ * @param scene The scene
+ * @param pkt The packet to draw
+ */
+static void sc_draw_model (struct scene * scene, const struct rq_packet * pkt)
+{
+    const struct model_vbo * mvbo = &scene->models[pkt->mesh];
+    const struct attribs * atr = &scene->materials[pkt->mat];
+
+    glLoadMatrixf(pkt->mv);
+
+    sc_draw_material(atr);
+    gs_bind_texture((atr->has_text) ? atr->text : 0);
+    vt_bind(&scene->vtex, atr->vtex);
+
+    gs_array_pointer(GL_VERTEX_ARRAY, mvbo->v_id, 3);
+    gs_array_pointer(GL_NORMAL_ARRAY, mvbo->n_id, 3);
+    gs_array_pointer(GL_TEXTURE_COORD_ARRAY, mvbo->t_id, 2);
+
+    glDrawArrays(GL_TRIANGLES, pkt->first, pkt->count);
+}
+
+/**
+ * @brief Sort and draw the packets queued this frame
+ * @param scene The scene
+ */
+static void sc_draw_queue (struct scene * scene)
+{
+    struct render_queue * rq = &scene->queue;
+    rq_sort(rq);
 
-    /* bind and draw the triangles */
-    glBindBuffer(GL_ARRAY_BUFFER, mvbo.v_id);
-    glVertexPointer(3, GL_FLOAT, 0, NULL);
+    for (const struct rq_entry & entry : rq->entries)
+        sc_draw_model(scene, &rq->packets[entry.packet]);
 
-    /* bind and draw normals */
-    glBindBuffer(GL_ARRAY_BUFFER, mvbo.n_id);
-    glNormalPointer(GL_FLOAT, 0, 0);
+    /* leave the state as the rest of the frame expects it */
+    sc_draw_material(NULL);
+    gs_bind_texture(0);
+    vt_bind(&scene->vtex, -1);
+}
+
+/**
+ * @brief Draw the pages of virtual textures the packets of the frame
+ *        would like, every few frames
+ * @param scene The scene, its queue drawn
+ */
+static void sc_draw_feedback (struct scene * scene)
+{
+    struct vt_cache * vc = &scene->vtex;
+    if (!vt_feedback_begin(vc))
+        return;
 
-    if (atr.has_text) {
-        glBindTexture(GL_TEXTURE_2D, atr.text);
-        glBindBuffer(GL_ARRAY_BUFFER, mvbo.t_id);
-        glTexCoordPointer(2, GL_FLOAT, 0, 0);
+    const struct render_queue * rq = &scene->queue;
+    for (const struct rq_entry & entry : rq->entries) {
+        const struct rq_packet * pkt = &rq->packets[entry.packet];
+        const struct model_vbo * mvbo = &scene->models[pkt->mesh];
+
+        glLoadMatrixf(pkt->mv);
+        vt_feedback_texture(vc, scene->materials[pkt->mat].vtex);
+        gs_array_pointer(GL_VERTEX_ARRAY, mvbo->v_id, 3);
+        gs_array_pointer(GL_NORMAL_ARRAY, mvbo->n_id, 3);
+        gs_array_pointer(GL_TEXTURE_COORD_ARRAY, mvbo->t_id, 2);
+        glDrawArrays(GL_TRIANGLES, pkt->first, pkt->count);
     }
 
-    glDrawArrays(GL_TRIANGLES, 0, mvbo.length);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glPopAttrib();
+    vt_feedback_end(vc);
 }
 
-static void sc_draw_groups (struct scene * scene, const struct frustum * frst, std::vector<struct group*> groups, unsigned elapsed, bool draw_curves);
-static void sc_draw_group (struct scene * scene, const struct frustum * frst, struct group * group, unsigned elapsed, bool draw_curves)
+/**
+ * @brief Rate of a node that was out of sight when it was last updated:
+ *        it stays hidden only if it can't have come into sight since
+ */
+static enum node_rate sc_hidden_rate (const struct node * node, const struct camera * cam)
 {
-    for (struct gt gt : group->gt) {
-        switch (gt.type) {
-            case GT_ROTATE:         sc_draw_rotate(&gt); break;
-            case GT_ROTATE_ANIM:    sc_draw_rotate_anim(&gt, elapsed); break;
-            case GT_SCALE:          sc_draw_scale(&gt); break;
-            case GT_TRANSLATE:      sc_draw_translate(&gt); break;
-            case GT_TRANSLATE_ANIM: if (draw_curves)
-                                        sc_draw_cm_curve(&gt);
-                                    sc_draw_translate_anim(&gt, elapsed);
-                                    break;
-            default: UNREACHABLE();
+    bool can_move = !(node->flags & NODE_STATIC);
+    return (can_move && cl_cull_box(&cam->frustum, &node->swept) != CL_OUT) ?
+        RATE_FULL:
+        RATE_HIDDEN;
+}
+
+/**
+ * @brief How often a node's own models need its animation, from where
+ *        they were when the node was last updated
+ * @param scene The scene
+ * @param view The view matrix
+ * @param i Index of the node
+ */
+static enum node_rate sc_node_rate (const struct scene * scene, const struct camera * cam, unsigned i)
+{
+    const struct node * node = &scene->nodes[i];
+    if (node->radius == 0)
+        return RATE_HIDDEN;
+    if (scene->cull && (node->flags & NODE_CULLED))
+        return sc_hidden_rate(node, cam);
+
+    const struct mat4 * w = &scene->world[i];
+    struct Point center = m4_transform_point(&cam->view, Point(w->m[12], w->m[13], w->m[14]));
+
+    float scale = 0;
+    for (unsigned j = 0; j < 12; j += 4)
+        scale = fmaxf(scale, w->m[j] * w->m[j] + w->m[j + 1] * w->m[j + 1] + w->m[j + 2] * w->m[j + 2]);
+    float radius = node->radius * sqrtf(scale);
+
+    /* the camera looks down -Z */
+    float depth = -center.z;
+    if (depth + radius < 0)
+        return sc_hidden_rate(node, cam);
+
+    float pixels = radius / fmaxf(depth, radius) * cam->lod_scale;
+    return (pixels < SC_LOD_PIXELS) ?
+        RATE_REDUCED:
+        RATE_FULL;
+}
+
+/**
+ * @brief Decide which animated nodes are updated on this frame, and
+ *        request their channels. A node is animated as often as the
+ *        most visible node of its subtree needs; nodes with the same rate
+ *        are spread over different frames.
+ * @param scene The scene
+ * @param view The view matrix
+ */
+static void sc_schedule (struct scene * scene, const struct camera * cam)
+{
+    /* indexed by `enum node_rate` */
+    static const unsigned period[] = { 1, SC_RATE_REDUCED, SC_RATE_HIDDEN };
+
+    scene->frame++;
+
+    for (unsigned i = 0; i < scene->nodes.size(); i++)
+        scene->nodes[i].rate = sc_node_rate(scene, cam, i);
+
+    /* children come after their parents, so this goes leaves first */
+    for (unsigned i = scene->nodes.size(); i-- > 0; ) {
+        const struct node * node = &scene->nodes[i];
+        if (node->parent >= 0 && node->rate < scene->nodes[node->parent].rate)
+            scene->nodes[node->parent].rate = node->rate;
+    }
+
+    for (unsigned i = 0; i < scene->nodes.size(); i++) {
+        struct node * node = &scene->nodes[i];
+        bool hidden = node->rate == RATE_HIDDEN;
+
+        /* something that comes into sight is brought up to date right away */
+        bool due = (node->flags & NODE_DIRTY)
+            || (!hidden && (node->flags & NODE_HIDDEN))
+            || (scene->frame + i) % period[node->rate] == 0;
+
+        node->flags &= ~(NODE_DUE | NODE_HIDDEN);
+        if (hidden)
+            node->flags |= NODE_HIDDEN;
+        if (!due || !(node->flags & NODE_ANIMATED))
+            continue;
+
+        node->flags |= NODE_DUE;
+        const struct op * ops = &scene->ops[node->first_op];
+        for (unsigned j = 0; j < node->n_ops; j++)
+            switch (ops[j].type) {
+                case OP_ROTATE_ANIM:    an_request(&scene->anim, AN_ROTATE, ops[j].arg); break;
+                case OP_TRANSLATE_ANIM: an_request(&scene->anim, AN_TRANSLATE, ops[j].arg); break;
+                case OP_BAKED:          an_request(&scene->anim, AN_BAKED, ops[j].arg); break;
+                default: break;
+            }
+    }
+}
+
+/**
+ * @brief Update the world matrices that may have changed, parents first.
+ *        A node is updated if its animation is due, it's dirty, or its
+ *        parent was updated; every other node keeps its cached matrix.
+ *        Animation channels must have been evaluated for this frame.
+ * @param scene The scene
+ */
+static void sc_update_world (struct scene * scene)
+{
+    scene->stats.nodes_updated = 0;
+    scene->updated.clear();
+
+    for (unsigned i = 0; i < scene->nodes.size(); i++) {
+        struct node * node = &scene->nodes[i];
+        bool update = (node->flags & (NODE_DUE | NODE_DIRTY))
+            || (node->parent >= 0 && (scene->nodes[node->parent].flags & NODE_UPDATED));
+
+        node->flags &= ~(NODE_DIRTY | NODE_UPDATED);
+        if (!update)
+            continue;
+
+        struct mat4 m = (node->parent < 0) ?
+            m4_identity():
+            scene->world[node->parent];
+        sc_run_program(scene, node, &m);
+        scene->world[i] = m;
+
+        node->flags |= NODE_UPDATED;
+        scene->updated.push_back(i);
+        scene->stats.nodes_updated++;
+    }
+}
+
+/**
+ * @brief Recompute world bounds: those of the nodes updated on this frame,
+ *        then the subtrees' they're in, leaves first. Every other node
+ *        keeps its cached bounds, so a static scene costs nothing.
+ * @param scene The scene
+ */
+static void sc_update_bounds (struct scene * scene)
+{
+    /* each node updated, and its ancestors up to one that's already marked */
+    scene->rebound.clear();
+    for (unsigned i : scene->updated) {
+        scene->model_bounds[i] = bb_transform(&scene->world[i], &scene->nodes[i].box);
+        for (int j = i; j >= 0 && !(scene->nodes[j].flags & NODE_REBOUND); j = scene->nodes[j].parent) {
+            scene->nodes[j].flags |= NODE_REBOUND;
+            scene->rebound.push_back(j);
+        }
+    }
+
+    /* children come after their parents, so this goes leaves first */
+    std::sort(scene->rebound.begin(), scene->rebound.end(), std::greater<unsigned>());
+    for (unsigned i : scene->rebound) {
+        struct node * node = &scene->nodes[i];
+        struct aabb b = scene->model_bounds[i];
+        for (unsigned j = i + 1; j < node->end; j = scene->nodes[j].end)
+            b = bb_union(&b, &scene->bounds[j]);
+        scene->bounds[i] = b;
+        node->flags &= ~NODE_REBOUND;
+    }
+
+    /*
+     * the index's region is only known once the first frame placed every
+     * node; twice the scene's size leaves room for what moves around
+     */
+    if (scene->index.cells.empty()) {
+        struct aabb region = bb_empty();
+        for (unsigned i = 0; i < scene->nodes.size(); i = scene->nodes[i].end)
+            region = bb_union(&region, &scene->bounds[i]);
+        if (!bb_is_empty(&region)) {
+            struct Point c = bb_center(&region);
+            struct Point e = bb_extent(&region) * 2;
+            region.min = c - e;
+            region.max = c + e;
         }
+        ot_clear(&scene->index, &region);
     }
 
-    for (struct model model : group->models)
-        sc_draw_model(scene, frst, &model);
+    for (unsigned i : scene->updated)
+        if (scene->nodes[i].n_instances > 0)
+            ot_move(&scene->index, i, &scene->model_bounds[i]);
+}
+
+/**
+ * @brief Draw the occluders inside the frustum and build the depth
+ *        pyramid from them
+ * @param scene The scene
+ * @param cam The camera
+ * @param static_only Leave out the occluders that move?
+ */
+static void sc_draw_occluders (struct scene * scene, const struct camera * cam, bool static_only)
+{
+    if (!scene->occlusion)
+        return;
+
+    oc_begin(&scene->hiz, &cam->clip);
+    for (const struct sc_occluder & occ : scene->occluders)
+        if ((!static_only || (scene->nodes[occ.node].flags & NODE_STATIC))
+                && cl_cull_box(&cam->frustum, &scene->model_bounds[occ.node]) != CL_OUT)
+            oc_add_mesh(&scene->hiz, &scene->world[occ.node], &scene->occluder_meshes[occ.mesh]);
+    oc_finish(&scene->hiz);
+}
 
-    sc_draw_groups(scene, frst, group->subgroups, elapsed, draw_curves);
+/**
+ * @brief Is a box hidden behind the occluders of the frame?
+ */
+static bool sc_occluded (struct scene * scene, const struct aabb * b)
+{
+    return scene->occlusion && !oc_visible(&scene->hiz, b);
 }
 
-static void sc_draw_groups (struct scene * scene, const struct frustum * frst, std::vector<struct group*> groups, unsigned elapsed, bool draw_curves)
+/**
+ * @brief Queue a node's own model instances
+ */
+static void sc_submit_node (struct scene * scene, const struct mat4 * view, unsigned i)
 {
-    for (struct group * group : groups) {
-        glPushMatrix();
-        sc_draw_group(scene, frst, group, elapsed, draw_curves);
-        glPopMatrix();
+    struct node * node = &scene->nodes[i];
+    node->flags &= ~NODE_CULLED;
+    if (node->n_instances == 0)
+        return;
+
+    /* the camera looks down -Z, so this is the distance to the node's origin */
+    struct mat4 mv = m4_mul(view, &scene->world[i]);
+    const struct model * instances = &scene->instances[node->first_instance];
+    for (unsigned j = 0; j < node->n_instances; j++) {
+        /* meshes that are still loading, or missing, have nothing to draw */
+        const struct model_vbo * mvbo = &scene->models[instances[j].mesh];
+        if (mvbo->length == 0)
+            continue;
+
+        int batch = mvbo->batch;
+        if (scene->batching && batch >= 0)
+            bt_push(&scene->batcher, batch, instances[j].mesh, instances[j].mat, &scene->world[i], -mv.m[14]);
+        else
+            sc_submit_model(scene, &mv, &instances[j], -mv.m[14]);
+        scene->stats.visible++;
     }
 }
 
+/**
+ * @brief Account for a node whose own model instances were culled
+ */
+static void sc_cull_node (struct scene * scene, unsigned i)
+{
+    scene->nodes[i].flags |= NODE_CULLED;
+    scene->stats.culled += scene->nodes[i].n_instances;
+}
+
+/**
+ * @brief Account for a node whose own model instances are hidden behind
+ *        the occluders
+ */
+static void sc_occlude_node (struct scene * scene, unsigned i)
+{
+    scene->nodes[i].flags |= NODE_CULLED;
+    scene->stats.occluded += scene->nodes[i].n_instances;
+}
+
+/**
+ * @brief Does the potentially visible set in use hide a node's own models?
+ */
+static bool sc_pvs_hides (const struct scene * scene, unsigned i)
+{
+    return scene->cull && scene->pvs_set >= 0 && !scene->pvs_visible[i];
+}
+
+/**
+ * @brief Does the potentially visible set in use hide a node's subtree?
+ */
+static bool sc_pvs_hides_subtree (const struct scene * scene, unsigned i)
+{
+    return scene->cull && scene->pvs_set >= 0 && !scene->pvs_subtree[i];
+}
+
+/**
+ * @brief Queue a node's own model instances, unless the potentially
+ *        visible set hides them or they're occluded
+ */
+static void sc_submit_visible (struct scene * scene, const struct mat4 * view, unsigned i)
+{
+    if (sc_pvs_hides(scene, i))
+        sc_cull_node(scene, i);
+    else if (scene->nodes[i].n_instances > 0 && sc_occluded(scene, &scene->model_bounds[i]))
+        sc_occlude_node(scene, i);
+    else
+        sc_submit_node(scene, view, i);
+}
+
+/**
+ * @brief Queue the batches of a batched subtree's root that are inside
+ *        the frustum and not occluded. The subtree's nodes are only
+ *        culled if all of its batches are.
+ * @param scene The scene
+ * @param view The view matrix
+ * @param frst The view frustum
+ * @param i The root
+ * @param cull Where the subtree is relative to the frustum
+ */
+static void sc_submit_batches (struct scene * scene, const struct mat4 * view, const struct cl_frustum * frst, unsigned i, enum cl_result cull)
+{
+    const struct node * node = &scene->nodes[i];
+    bool any = false;
+
+    for (unsigned j = node->first_batch; j < node->first_batch + node->n_batches; j++) {
+        const struct sc_batch * batch = &scene->batches[j];
+
+        if (cull == CL_PARTIAL && cl_cull_box(frst, &batch->box) == CL_OUT) {
+            scene->stats.culled += batch->n_instances;
+        } else if (sc_occluded(scene, &batch->box)) {
+            scene->stats.occluded += batch->n_instances;
+        } else {
+            struct model model = { batch->mesh, batch->mat, -1, };
+            struct Point c = bb_center(&batch->box);
+            sc_submit_model(scene, view, &model, -(view->m[2] * c.x + view->m[6] * c.y + view->m[10] * c.z + view->m[14]));
+            scene->stats.visible += batch->n_instances;
+            any = true;
+        }
+    }
+
+    for (unsigned j = i; j < node->end; j++)
+        if (any)
+            scene->nodes[j].flags &= ~NODE_CULLED;
+        else
+            scene->nodes[j].flags |= NODE_CULLED;
+}
+
+/**
+ * @brief Queue every model instance of the scene inside the frustum and
+ *        not occluded. Subtrees hidden by the potentially visible set,
+ *        outside the frustum or occluded are skipped whole, and those
+ *        inside it only have each node's models tested for occlusion.
+ *        Batched subtrees are drawn by their batches. Nodes crossing the
+ *        frustum have their own models' bounding spheres culled in one
+ *        batch at the end.
+ * @param scene The scene
+ * @param view The view matrix
+ * @param frst The view frustum
+ */
+static void sc_submit_models (struct scene * scene, const struct mat4 * view, const struct cl_frustum * frst)
+{
+    scene->stats.visible = 0;
+    scene->stats.culled = 0;
+    scene->stats.occluded = 0;
+    cl_clear(&scene->candidates);
+
+    unsigned i = 0;
+    while (i < scene->nodes.size()) {
+        unsigned end = scene->nodes[i].end;
+
+        if (sc_pvs_hides_subtree(scene, i)) {
+            for (; i < end; i++)
+                sc_cull_node(scene, i);
+            continue;
+        }
+
+        enum cl_result cull = (scene->cull) ?
+            cl_cull_box(frst, &scene->bounds[i]):
+            CL_IN;
+
+        if (cull != CL_OUT && sc_occluded(scene, &scene->bounds[i])) {
+            for (; i < end; i++)
+                sc_occlude_node(scene, i);
+            continue;
+        }
+
+        /* static subtrees are drawn by their batches */
+        if (cull != CL_OUT && (scene->nodes[i].flags & NODE_BATCHED)) {
+            sc_submit_batches(scene, view, frst, i, cull);
+            i = end;
+            continue;
+        }
+
+        switch (cull) {
+            case CL_OUT:
+                for (; i < end; i++)
+                    sc_cull_node(scene, i);
+                break;
+
+            case CL_IN:
+                while (i < end) {
+                    if (scene->nodes[i].flags & NODE_BATCHED) {
+                        sc_submit_batches(scene, view, frst, i, CL_IN);
+                        i = scene->nodes[i].end;
+                    } else {
+                        sc_submit_visible(scene, view, i++);
+                    }
+                }
+                break;
+
+            case CL_PARTIAL: {
+                /* culled until the batch says otherwise; its children are next */
+                const struct aabb * b = &scene->model_bounds[i];
+                sc_cull_node(scene, i);
+                if (scene->nodes[i].n_instances > 0 && !bb_is_empty(b) && !sc_pvs_hides(scene, i)) {
+                    struct Point e = bb_extent(b);
+                    cl_push(&scene->candidates, bb_center(b), sqrtf(e.x * e.x + e.y * e.y + e.z * e.z), i);
+                }
+                i++;
+            } break;
+        }
+    }
+
+    /* nodes found visible are taken back out of the culled count */
+    unsigned n = cl_cull(frst, &scene->candidates, scene->cull_plane.data());
+    for (unsigned j = 0; j < n; j++) {
+        unsigned k = scene->candidates.visible[j];
+        scene->stats.culled -= scene->nodes[k].n_instances;
+        sc_submit_visible(scene, view, k);
+    }
+}
+
+/**
+ * @brief Refill a streaming buffer, orphaning its old storage so that the
+ *        driver doesn't wait for the draws still using it
+ * @param id The buffer
+ * @param data The new data
+ * @param size Its size, in floats
+ * @param capacity The buffer's size, in floats
+ */
+static void sc_stream_buffer (unsigned id, const float * data, size_t size, size_t capacity)
+{
+    gs_bind_buffer(id);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * capacity, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * size, data);
+}
+
+/**
+ * @brief Build the batches of the small models queued this frame and
+ *        queue them. Groups it wouldn't pay to batch are queued model by
+ *        model.
+ * @param scene The scene
+ * @param view The view matrix
+ * @returns Time it took to build and upload the batches, in ns
+ */
+static float sc_submit_dynamic (struct scene * scene, const struct mat4 * view)
+{
+    struct batcher * b = &scene->batcher;
+    auto start = std::chrono::steady_clock::now();
+
+    bt_build(b);
+    if (b->length > 0) {
+        const struct model_vbo * stream = &scene->models[scene->stream];
+        sc_stream_buffer(stream->v_id, b->vertices.data(), 3 * b->length, b->vertices.size());
+        sc_stream_buffer(stream->n_id, b->normals.data(), 3 * b->length, b->normals.size());
+        sc_stream_buffer(stream->t_id, b->tcoords.data(), 2 * b->length, b->tcoords.size());
+    }
+
+    float ns = std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    for (const struct bt_group & group : b->groups) {
+        if (group.batched) {
+            /* already in world space */
+            struct model model = { scene->stream, group.mat, -1, };
+            struct rq_packet * pkt = sc_submit_model(scene, view, &model, group.depth);
+            pkt->first = group.vertex;
+            pkt->count = group.length;
+            continue;
+        }
+
+        for (unsigned k = group.first; k < group.first + group.count; k++) {
+            const struct bt_item * item = &b->sorted[k];
+            struct mat4 mv = m4_mul(view, item->world);
+            struct model model = { item->id, item->mat, -1, };
+            sc_submit_model(scene, &mv, &model, item->depth);
+        }
+    }
+
+    return ns;
+}
+
 static void sc_draw_light (const struct scene * scene, struct light * light, unsigned i)
 {
     float w = (light->type == LT_POINT) ?
@@ -240,12 +928,17 @@ static void sc_draw_light (const struct scene * scene, struct light * light, uns
     GLfloat cenas[4] = { light->pos.x, light->pos.y, light->pos.z, w, };
     GLfloat colour[4] = { light->color.x, light->color.y, light->color.z, 1, };
     /* Assume `GL_LIGHT[0-7]` were defined sequentially */
-    glEnable(GL_LIGHT0 + i);
+    gs_enable(GL_LIGHT0 + i, true);
     glLightfv(GL_LIGHT0 + i, GL_POSITION, cenas);
     glLightfv(GL_LIGHT0 + i, GL_AMBIENT, colour);
     glLightfv(GL_LIGHT0 + i, GL_DIFFUSE, colour);
 }
 
+void sc_mark_dirty (struct scene * scene, unsigned node)
+{
+    scene->nodes[node].flags |= NODE_DIRTY;
+}
+
 void sc_draw_lights (const struct scene * scene)
 {
     unsigned i = 0;
@@ -253,111 +946,579 @@ void sc_draw_lights (const struct scene * scene)
         sc_draw_light(scene, light, i++);
 }
 
-void sc_draw (struct scene * scene, const struct frustum * frst, unsigned elapsed, bool draw_curves, bool draw_lights)
+void sc_draw (struct scene * scene, const struct camera * cam, unsigned elapsed, bool draw_curves, bool draw_lights)
 {
+    const struct mat4 * view = &cam->view;
+
     if (draw_lights)
         sc_draw_lights(scene);
-    sc_draw_groups(scene, frst, scene->groups, elapsed, draw_curves);
+
+#ifndef NDEBUG
+    size_t allocations = sc_allocations;
+#endif
+
+    glPushMatrix();
+    vt_update(&scene->vtex);
+    sc_schedule(scene, cam);
+    an_evaluate(&scene->anim, elapsed);
+    sc_update_world(scene);
+    sc_update_bounds(scene);
+    sc_draw_occluders(scene, cam, false);
+    if (draw_curves)
+        sc_draw_curves(scene, view);
+
+    rq_clear(&scene->queue);
+    bt_begin(&scene->batcher);
+    sc_submit_models(scene, view, &cam->frustum);
+    float batch_ns = sc_submit_dynamic(scene, view);
+
+    auto start = std::chrono::steady_clock::now();
+    sc_draw_queue(scene);
+    float draw_ns = std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - start).count();
+    bt_measure(&scene->batcher, draw_ns, scene->queue.stats.packets, batch_ns);
+    sc_draw_feedback(scene);
+    if (scene->loading)
+        sc_draw_placeholders(scene, view);
+    glPopMatrix();
+
+    assert(sc_allocations == allocations && "drawing a frame must not allocate");
 }
 
-static bool sc_load_texture (struct scene * scene, std::string fname, std::map<std::string, unsigned> * texts, unsigned * ret)
+int sc_pick (const struct scene * scene, struct Point origin, struct Point dir)
 {
-    if (texts->count(fname))
-        return (*ret = (*texts)[fname]), true;
+    unsigned id;
+    float t;
+    return ot_raycast(&scene->index, origin, dir, FLT_MAX, &id, &t) ? (int) id : -1;
+}
 
-    *ret = 0;
+unsigned sc_nearby (const struct scene * scene, unsigned node, std::vector<unsigned> * out)
+{
+    const struct aabb * b = &scene->model_bounds[node];
+    if (bb_is_empty(b))
+        return 0;
+
+    struct Point e = bb_extent(b);
+    float size = 2 * sqrtf(e.x * e.x + e.y * e.y + e.z * e.z);
+    size_t n = out->size();
+    ot_query_sphere(&scene->index, bb_center(b), size, out);
+    out->erase(std::remove(out->begin() + n, out->end(), node), out->end());
+    return out->size() - n;
+}
 
-    ilEnable(IL_ORIGIN_SET);
-    ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+void sc_draw_bounds (const struct scene * scene, unsigned node, struct Point color)
+{
+    gs_enable(GL_LIGHTING, false);
+    gs_enable(GL_TEXTURE_2D, false);
+    glColor3f(color.x, color.y, color.z);
+    sc_draw_box(&scene->model_bounds[node]);
+    glColor3f(1, 1, 1);
+    gs_enable(GL_LIGHTING, true);
+    gs_enable(GL_TEXTURE_2D, true);
+}
 
-    unsigned t = 0;
-    ilGenImages(1, &t);
-    ilBindImage(t);
-    if (!ilLoadImage(fname.c_str()))
-        return fprintf(stderr, "Error loading texture `%s` (maybe it's missing?)\n", fname.c_str()), false;
+/**
+ * @brief Identify a scene's structure, so that sets baked for it aren't
+ *        used with another (FNV-1a)
+ */
+static uint32_t sc_hash (const struct scene * scene)
+{
+    uint32_t h = 2166136261u;
+#define mix(v) do { h = (h ^ (uint32_t) (v)) * 16777619u; } while (0)
+    for (const struct node & node : scene->nodes) {
+        mix(node.end);
+        mix(node.n_instances);
+        mix(node.flags & NODE_STATIC);
+
+        /* where static nodes are, as sets may hide them */
+        if (!(node.flags & NODE_STATIC))
+            continue;
+        for (unsigned i = node.first_op; i < node.first_op + node.n_ops; i++) {
+            const struct mat4 * m = &scene->matrices[scene->ops[i].arg];
+            for (unsigned k = 0; k < 16; k++) {
+                uint32_t bits;
+                memcpy(&bits, &m->m[k], sizeof(bits));
+                mix(bits);
+            }
+        }
+    }
+    for (const struct model & model : scene->instances)
+        mix(model.mesh);
+#undef mix
+    return h;
+}
 
-    ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
+/**
+ * @brief What a camera can see, to bake sets with or check them against
+ */
+static struct pv_lens sc_lens (const struct camera * cam)
+{
+    struct pv_lens lens;
+    lens.fovy = cam->fovy;
+    lens.aspect = (float) cam->width / cam->height;
+    lens.znear = cam->znear;
+    lens.zfar = cam->zfar;
+    lens.up = cam->up;
+    return lens;
+}
 
-    glGenTextures(1, ret);
-    glBindTexture(GL_TEXTURE_2D, *ret);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+void sc_bake_pvs (struct scene * scene, const struct camera * lens, const struct pv_path * path, struct pvs * sets)
+{
+    unsigned n = scene->nodes.size();
+    std::vector<unsigned char> visible(n);
+    struct camera cam = *lens;
+
+    /* cull like drawing a frame would, without a set */
+    bool cull = scene->cull;
+    int set = scene->pvs_set;
+    scene->cull = true;
+    scene->pvs_set = -1;
+
+    struct pv_lens baked = sc_lens(lens);
+    pv_clear(sets, n, sc_hash(scene), &baked);
+    unsigned segment_time = path->time / path->keys.size();
+
+    for (unsigned s = 0; s < path->keys.size(); s++) {
+        /* nodes that move can't be hidden by a set */
+        for (unsigned i = 0; i < n; i++)
+            visible[i] = !(scene->nodes[i].flags & NODE_STATIC);
+
+        /* both ends of the segment, and samples in between */
+        for (unsigned k = 0; k <= path->samples; k++) {
+            float u = (float) k / path->samples;
+            struct pv_key key;
+            pv_path_sample(path, s, u, &key);
+            cam_look_at(&cam, key.eye, key.center, lens->up);
+            cam_update(&cam);
+
+            unsigned elapsed = s * segment_time + u * segment_time;
+            sc_schedule(scene, &cam);
+            an_evaluate(&scene->anim, elapsed);
+            sc_update_world(scene);
+            sc_update_bounds(scene);
+            sc_draw_occluders(scene, &cam, true);
+            rq_clear(&scene->queue);
+            bt_begin(&scene->batcher);
+            sc_submit_models(scene, &cam.view, &cam.frustum);
+
+            for (unsigned i = 0; i < n; i++)
+                if (scene->nodes[i].n_instances > 0 && !(scene->nodes[i].flags & NODE_CULLED))
+                    visible[i] = 1;
+        }
 
-    unsigned w = ilGetInteger(IL_IMAGE_WIDTH);
-    unsigned h = ilGetInteger(IL_IMAGE_HEIGHT);
-    unsigned char * data = ilGetData();
-    assert(data);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+        pv_push(sets, visible.data());
+    }
 
+    scene->cull = cull;
+    scene->pvs_set = set;
+}
+
+bool sc_use_pvs (struct scene * scene, const struct pvs * sets)
+{
+    if (sets->n_nodes != scene->nodes.size() || sets->scene_hash != sc_hash(scene))
+        return false;
+
+    scene->pvs = *sets;
+    scene->pvs_set = -1;
     return true;
 }
 
-static struct model sc_load_3d_model (struct scene * scene, struct attribs atr, const char * fname)
+void sc_set_pvs (struct scene * scene, const struct camera * cam, int set)
 {
-    struct model_vbo mvbo = {0};
+    struct pv_lens live = sc_lens(cam);
+    if (set >= (int) pv_count(&scene->pvs) || !pv_covers(&scene->pvs.lens, &live))
+        set = -1;
+    if (set == scene->pvs_set)
+        return;
 
-    if (scene->models.count(fname)) {
-        mvbo = scene->models[fname];
-    } else {
-        FILE * inf = fopen(fname, "r");
-        assert(inf);
-        std::vector<struct Point> vec;
-        std::vector<struct Point> norm;
-        std::vector<struct Point> tcoords;
-        gen_model_read(inf, &vec, &norm, &tcoords);
-        fclose(inf);
+    scene->pvs_set = set;
+    if (set < 0)
+        return;
+
+    /* a subtree can be seen if any of its nodes can */
+    pv_get(&scene->pvs, set, scene->pvs_visible.data());
+    scene->pvs_subtree = scene->pvs_visible;
+    for (unsigned i = scene->nodes.size(); i-- > 0; ) {
+        int parent = scene->nodes[i].parent;
+        if (parent >= 0 && scene->pvs_subtree[i])
+            scene->pvs_subtree[parent] = 1;
+    }
+}
+
+/**
+ * @brief Register a texture's image; images are only decoded once every
+ *        one is known, by `sc_launch_assets`
+ * @param scene The scene
+ * @param fname The image file
+ * @param ctx The loading context
+ * @param[out] ret The image's ID in the atlas
+ * @returns `true`
+ */
+static bool sc_load_texture (struct scene * scene, std::string fname, struct sc_load_ctx * ctx, unsigned * ret)
+{
+    std::map<std::string, unsigned> * texts = &ctx->texts;
+
+    if (texts->count(fname))
+        return (*ret = (*texts)[fname]), true;
+
+    *ret = ctx->text_files.size();
+    ctx->text_files.push_back(fname);
+    (*texts)[fname] = *ret;
+    return true;
+}
 
-        mvbo.length = vec.size();
-        float * rafar = (float *) calloc(vec.size() * 3, sizeof(float));
+/**
+ * @brief Open a virtual texture, making the page cache for the first
+ * @param scene The scene
+ * @param fname The tiled texture file, made with `--tile-texture`
+ * @param ctx The loading context
+ * @param[out] atr The material: its texture is the page cache
+ * @returns Whether it could
+ */
+static bool sc_load_virtual (struct scene * scene, const char * fname, struct sc_load_ctx * ctx, struct attribs * atr)
+{
+    struct vt_cache * vc = &scene->vtex;
 
-        unsigned i = 0;
-        for (struct Point p : vec) {
-            rafar[i++] = p.x;
-            rafar[i++] = p.y;
-            rafar[i++] = p.z;
+    if (!ctx->vtexs.count(fname)) {
+        if (!vc->program && ctx->vtex_cache > 0 && !(vt_supported() && vt_init(vc, ctx->vtex_cache, ctx->atlas.format))) {
+            fprintf(stderr, "Virtual textures need GLSL 1.20 and framebuffer objects\n");
+            ctx->vtex_cache = 0; /* don't try again */
         }
+        int id = vc->program ? vt_open(vc, fname) : -1;
+        if (vc->program && id < 0)
+            fprintf(stderr, "Error loading virtual texture `%s` (maybe it's missing, or tiled for another TEXTURE_FORMAT?)\n", fname);
+        ctx->vtexs[fname] = id;
+    }
+
+    static const float whole[4] = { 0, 0, 1, 1, };
+    atr->vtex = ctx->vtexs[fname];
+    atr->text = vc->cache;
+    memcpy(atr->text_rect, whole, sizeof(whole));
+    return atr->vtex >= 0;
+}
+
+/**
+ * @brief Hash of everything besides the source that a tile depends on,
+ *        to tell cached tiles built differently apart
+ */
+static uint64_t sc_tile_options (const struct atlas * at)
+{
+    /* images are always decoded lower left first */
+    uint32_t options[] = { AT_PADDING, AT_LEVELS, AT_ALIGN, (uint32_t) at->format, };
+    return tc_hash(options, sizeof(options), TC_HASH_SEED);
+}
+
+/**
+ * @brief Can textures be compressed with S3TC?
+ */
+static bool sc_has_s3tc (void)
+{
+#ifdef __APPLE__
+    return true;
+#else
+    return GLEW_EXT_texture_compression_s3tc;
+#endif
+}
 
-        glGenBuffers(1, &mvbo.v_id);
-        glBindBuffer(GL_ARRAY_BUFFER, mvbo.v_id);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mvbo.length * 3, rafar, GL_STATIC_DRAW);
+/**
+ * @brief Read an image file, and decode it unless it's cached. Only the
+ *        decoding itself is done under DevIL's lock.
+ * @param ctx The loading context, with the cache
+ * @param i The image
+ * @param decode Decode it even if it's cached?
+ */
+static void sc_read_texture (struct sc_load_ctx * ctx, unsigned i, bool decode)
+{
+    const char * fname = ctx->text_files[i].c_str();
+    struct at_image * img = &ctx->images[i];
+
+    std::vector<unsigned char> data;
+    FILE * inf = fopen(fname, "rb");
+    if (inf) {
+        fseek(inf, 0, SEEK_END);
+        long size = ftell(inf);
+        fseek(inf, 0, SEEK_SET);
+        data.resize((size > 0) ? size : 0);
+        if (fread(data.data(), 1, data.size(), inf) != data.size())
+            data.clear();
+        fclose(inf);
+    }
 
-        i = 0;
-        for (struct Point p : norm) {
-            rafar[i++] = p.x;
-            rafar[i++] = p.y;
-            rafar[i++] = p.z;
+    /* the size is all packing needs, so a cached tile needs no decoding yet */
+    if (!data.empty() && !ctx->cache_dir.empty() && !decode) {
+        std::string cached = tc_path(ctx->cache_dir.c_str(), fname);
+        ctx->text_hashes[i] = tc_hash(data.data(), data.size(), TC_HASH_SEED);
+        if (tc_open(&ctx->cached[i], cached.c_str(), ctx->text_hashes[i], sc_tile_options(&ctx->atlas))) {
+            img->width = ctx->cached[i].header.width;
+            img->height = ctx->cached[i].header.height;
+            return;
         }
+    }
 
-        glGenBuffers(1, &mvbo.n_id);
-        glBindBuffer(GL_ARRAY_BUFFER, mvbo.n_id);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mvbo.length * 3, rafar, GL_STATIC_DRAW);
+    if (!data.empty()) {
+        std::lock_guard<std::mutex> l(sc_il_lock);
+        unsigned t = 0;
+        ilGenImages(1, &t);
+        ilBindImage(t);
+        if (ilLoadL(IL_TYPE_UNKNOWN, data.data(), data.size()) && ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE)) {
+            img->width = ilGetInteger(IL_IMAGE_WIDTH);
+            img->height = ilGetInteger(IL_IMAGE_HEIGHT);
+            const unsigned char * pixels = ilGetData();
+            img->pixels.assign(pixels, pixels + 4 * (size_t) img->width * img->height);
+        }
+        ilDeleteImages(1, &t);
+    }
+
+    if (img->pixels.empty())
+        fprintf(stderr, "Error loading texture `%s` (maybe it's missing?)\n", fname);
+}
 
-        i = 0;
-        for (struct Point p : tcoords) {
-            rafar[i++] = p.x;
-            rafar[i++] = p.y;
+/**
+ * @brief Task of `sc_step_tiles`: build a tile and its mips, unless the
+ *        cached one is the same size, and cache it
+ */
+static void sc_build_tile (void * arg, unsigned i)
+{
+    struct sc_load_ctx * ctx = (struct sc_load_ctx *) arg;
+    struct atlas * at = &ctx->atlas;
+    unsigned id = ctx->first_tile + i;
+    const struct at_image * img = &at->images[id];
+    const struct at_tile * t = &at->tiles[id];
+    struct tc_map * cached = &ctx->cached[id];
+
+    /* an image of its own needs no tile, only its pixels, small enough for a texture */
+    if (ctx->separate) {
+        if (img->width > 0 && img->pixels.empty()) {
+            sc_read_texture(ctx, id, true);
+            at->images[id].pixels.swap(ctx->images[id].pixels);
         }
-        glGenBuffers(1, &mvbo.t_id);
-        glBindBuffer(GL_ARRAY_BUFFER, mvbo.t_id);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mvbo.length * 2, rafar, GL_STATIC_DRAW);
+        while (!img->pixels.empty() && (img->width > ctx->atlas_size || img->height > ctx->atlas_size))
+            at_halve(&at->images[id]);
+        return;
+    }
 
-        free(rafar);
+    if (t->width == 0)
+        return;
+    if (cached->data && cached->header.shrink == img->shrink
+            && cached->header.tile_width == t->width && cached->header.tile_height == t->height)
+        return;
+
+    /* it was packed differently than when it was cached */
+    if (cached->data) {
+        tc_close(cached);
+        sc_read_texture(ctx, id, true);
+        at->images[id].pixels.swap(ctx->images[id].pixels);
+        if (img->pixels.empty())
+            return;
     }
 
-    mvbo.attribs.push_back(atr);
-    scene->models[fname] = mvbo;
+    struct tc_header header;
+    memset(&header, 0, sizeof(header));
+    header.width = img->width;
+    header.height = img->height;
+    header.shrink = img->shrink;
+    at_build(at, id);
 
-    struct model model;
-    model.fname = fname;
-    model.id = mvbo.attribs.size() - 1;
-    return model;
+    if (ctx->cache_dir.empty())
+        return;
+    header.tile_width = t->width;
+    header.tile_height = t->height;
+    header.source = ctx->text_hashes[id];
+    header.options = sc_tile_options(at);
+    header.size = at_tile_size(at, id);
+    std::string fname = tc_path(ctx->cache_dir.c_str(), ctx->text_files[id].c_str());
+    if (!tc_save(fname.c_str(), &header, t->mips.data()))
+        fprintf(stderr, "Error caching texture `%s` in `%s`\n", ctx->text_files[id].c_str(), fname.c_str());
+}
+
+/**
+ * @brief Bound a mesh's vertex data
+ * @param data The vertex data
+ * @param[out] mvbo Where to keep its bounds
+ */
+static void sc_bound_mesh (const struct sc_mesh_data * data, struct model_vbo * mvbo)
+{
+    mvbo->box = bb_empty();
+    mvbo->radius = 0;
+    for (struct Point p : data->vertices) {
+        mvbo->radius = fmaxf(mvbo->radius, sqrtf(p.x * p.x + p.y * p.y + p.z * p.z));
+        bb_add(&mvbo->box, p);
+    }
+}
+
+/**
+ * @brief Upload a mesh's vertex data to new VBOs
+ * @param data The vertex data
+ * @param[out] mvbo The VBOs, and the mesh's bounds
+ */
+static void sc_upload_mesh (const struct sc_mesh_data * data, struct model_vbo * mvbo)
+{
+    struct model_vbo empty = {0};
+    *mvbo = empty;
+    mvbo->batch = -1;
+    mvbo->length = data->vertices.size();
+    sc_bound_mesh(data, mvbo);
+    float * rafar = (float *) calloc(mvbo->length * 3, sizeof(float));
+
+    unsigned i = 0;
+    for (struct Point p : data->vertices) {
+        rafar[i++] = p.x;
+        rafar[i++] = p.y;
+        rafar[i++] = p.z;
+    }
+
+    glGenBuffers(1, &mvbo->v_id);
+    gs_bind_buffer(mvbo->v_id);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mvbo->length * 3, rafar, GL_STATIC_DRAW);
+
+    i = 0;
+    for (struct Point p : data->normals) {
+        rafar[i++] = p.x;
+        rafar[i++] = p.y;
+        rafar[i++] = p.z;
+    }
+
+    glGenBuffers(1, &mvbo->n_id);
+    gs_bind_buffer(mvbo->n_id);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mvbo->length * 3, rafar, GL_STATIC_DRAW);
+
+    i = 0;
+    for (struct Point p : data->tcoords) {
+        rafar[i++] = p.x;
+        rafar[i++] = p.y;
+    }
+    glGenBuffers(1, &mvbo->t_id);
+    gs_bind_buffer(mvbo->t_id);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mvbo->length * 2, rafar, GL_STATIC_DRAW);
+
+    free(rafar);
+}
+
+/**
+ * @brief Register a model's mesh; meshes are only read once every one is
+ *        known, by `sc_launch_assets`, and it's empty until then
+ * @returns Its index in `scene::models`
+ */
+static unsigned sc_load_3d_model (struct scene * scene, const char * fname, struct sc_load_ctx * ctx)
+{
+    if (ctx->meshes.count(fname))
+        return ctx->meshes[fname];
+
+    struct model_vbo mvbo = {0};
+    mvbo.box = bb_empty();
+    mvbo.batch = -1;
+    scene->models.push_back(mvbo);
+    ctx->mesh_files.push_back(fname);
+    return ctx->meshes[fname] = scene->models.size() - 1;
+}
+
+/**
+ * @brief Register the coarse mesh of a model, to draw as an occluder;
+ *        it's read along with the models' meshes
+ * @returns Its index in `scene::occluder_meshes`
+ */
+static unsigned sc_load_occluder (struct scene * scene, const char * fname, struct sc_load_ctx * ctx)
+{
+    if (ctx->occluders.count(fname))
+        return ctx->occluders[fname];
+
+    scene->occluder_meshes.push_back(oc_mesh());
+    ctx->occluder_files.push_back(fname);
+    return ctx->occluders[fname] = scene->occluder_meshes.size() - 1;
+}
+
+/**
+ * @brief Read a mesh file
+ * @param fname The file
+ * @param[out] data Its vertex data, empty if it can't be read
+ */
+static void sc_read_mesh (const char * fname, struct sc_mesh_data * data)
+{
+    FILE * inf = fopen(fname, "r");
+    if (!inf) {
+        fprintf(stderr, "Error loading model `%s` (maybe it's missing?)\n", fname);
+        return;
+    }
+    gen_model_read(inf, &data->vertices, &data->normals, &data->tcoords);
+    fclose(inf);
+}
+
+/**
+ * @brief Task of `sc_launch_assets`: read an asset, the models' meshes
+ *        first, then the occluders', then the textures' images
+ */
+static void sc_read_asset (void * arg, unsigned i)
+{
+    struct sc_load_ctx * ctx = (struct sc_load_ctx *) arg;
+    unsigned meshes = ctx->mesh_files.size();
+    unsigned occluders = ctx->occluder_files.size();
+
+    if (i < meshes)
+        sc_read_mesh(ctx->mesh_files[i].c_str(), &ctx->mesh_data[i]);
+    else if (i - meshes < occluders)
+        sc_read_mesh(ctx->occluder_files[i - meshes].c_str(), &ctx->occluder_data[i - meshes]);
+    else
+        sc_read_texture(ctx, i - meshes - occluders, false);
+}
+
+/**
+ * @brief Start reading every mesh and image the scene uses, each once, in
+ *        the background on the workers
+ * @param ctx The loading context, with the assets' file names
+ */
+static void sc_launch_assets (struct sc_load_ctx * ctx)
+{
+    unsigned texts = ctx->text_files.size();
+    if (texts > 0) {
+        if (!ctx->cache_dir.empty() && !tc_init(ctx->cache_dir.c_str())) {
+            fprintf(stderr, "Error creating the texture cache `%s`\n", ctx->cache_dir.c_str());
+            ctx->cache_dir.clear();
+        }
+        ilEnable(IL_ORIGIN_SET);
+        ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+        ctx->images.resize(texts);
+        ctx->text_hashes.assign(texts, 0);
+        ctx->cached.resize(texts);
+    }
+
+    /* the vertex data is kept until the scene is batched */
+    ctx->mesh_data.resize(ctx->mesh_files.size());
+    ctx->occluder_data.resize(ctx->occluder_files.size());
+    ctx->uploads.reserve(ctx->mesh_files.size());
+    ctx->uploaded = 0;
+
+    ctx->stage = SC_LOAD_ASSETS;
+    ctx->tasks = ctx->mesh_files.size() + ctx->occluder_files.size() + texts;
+    ctx->taken = 0;
+    wk_launch(sc_read_asset, ctx, ctx->tasks);
+}
+
+/**
+ * @brief Compare two materials
+ */
+static bool sc_material_eq (const struct attribs * a, const struct attribs * b)
+{
+#define eq_(T) \
+    (a->has_ ## T == b->has_ ## T \
+     && (!a->has_ ## T || (a->T.x == b->T.x && a->T.y == b->T.y && a->T.z == b->T.z)))
+    return eq_(amb) && eq_(diff) && eq_(emi) && eq_(spec)
+        && a->has_text == b->has_text
+        && (!a->has_text || (a->text == b->text && a->vtex == b->vtex));
+#undef eq_
 }
 
-static void sc_load_model (pugi::xml_node node, struct scene * scene, struct group * group, std::map<std::string, unsigned> * texts)
+/**
+ * @brief Find the ID of a material, registering it if it's new
+ */
+static unsigned sc_load_material (struct scene * scene, const struct attribs * atr)
+{
+    for (unsigned i = 0; i < scene->materials.size(); i++)
+        if (sc_material_eq(&scene->materials[i], atr))
+            return i;
+    scene->materials.push_back(*atr);
+    return scene->materials.size() - 1;
+}
+
+static void sc_load_model (pugi::xml_node node, struct scene * scene, struct group * group, struct sc_load_ctx * ctx)
 {
     struct attribs atr;
 
@@ -381,19 +1542,30 @@ static void sc_load_model (pugi::xml_node node, struct scene * scene, struct gro
     read_(emi,  "emi");
 #undef read_
 
-    atr.has_text = node.attribute("texture")
-        && sc_load_texture(scene, node.attribute("texture").value(), texts, &atr.text);
+    const char * text = node.attribute("texture").value();
+    size_t text_len = strlen(text);
+    atr.vtex = -1;
+    if (text_len > 3 && strcmp(text + text_len - 3, ".vt") == 0)
+        atr.has_text = sc_load_virtual(scene, text, ctx, &atr);
+    else
+        atr.has_text = *text && sc_load_texture(scene, text, ctx, &atr.text);
 
-    const char * fname = node.attribute("FILE").value();
-    struct model model = sc_load_3d_model(scene, atr, fname);
+    struct model model;
+    model.mat = sc_load_material(scene, &atr);
+    model.mesh = sc_load_3d_model(scene, node.attribute("FILE").value(), ctx);
+
+    /* a coarse version of it, lying inside it, that hides what's behind */
+    model.occluder = (node.attribute("occluder")) ?
+        (int) sc_load_occluder(scene, node.attribute("occluder").value(), ctx):
+        -1;
     group->models.push_back(model);
 }
 
-static void sc_load_models (pugi::xml_node node, struct scene * scene, struct group * group, std::map<std::string, unsigned> * texts)
+static void sc_load_models (pugi::xml_node node, struct scene * scene, struct group * group, struct sc_load_ctx * ctx)
 {
     for (pugi::xml_node trans = node.first_child(); trans; trans = trans.next_sibling())
         if (strcmp("model", trans.name()) == 0)
-            sc_load_model(trans, scene, group, texts);
+            sc_load_model(trans, scene, group, ctx);
 }
 
 static void sc_load_rotate (pugi::xml_node node, struct scene * scene, struct group * group)
@@ -439,6 +1611,45 @@ static struct Point sc_load_translate_control_point (pugi::xml_node node)
             );
 }
 
+/**
+ * @brief Precompute the segments of a GT_TRANSLATE_ANIM and upload its
+ *        path to a VBO
+ * @param scene The scene
+ * @param[in,out] gt The Geometric Transformation
+ */
+static void sc_load_curve (struct scene * scene, struct gt * gt)
+{
+    const std::vector<struct Point> & cp = gt->control_points;
+    unsigned n = cp.size();
+
+    gt->segments.clear();
+    for (unsigned i = 0; i < n; i++)
+        gt->segments.push_back(sc_catmull_rom_segment(
+                    cp[(i + n - 1) % n],
+                    cp[i],
+                    cp[(i + 1) % n],
+                    cp[(i + 2) % n]));
+
+    struct curve curve;
+    curve.length = 100;
+    curve.world = m4_identity();
+
+    std::vector<float> path;
+    for (unsigned i = 0; i < curve.length; i++) {
+        struct Point pos = sc_catmull_rom_point(gt, ((float) i) / curve.length);
+        path.push_back(pos.x);
+        path.push_back(pos.y);
+        path.push_back(pos.z);
+    }
+
+    glGenBuffers(1, &curve.vbo);
+    gs_bind_buffer(curve.vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * path.size(), path.data(), GL_STATIC_DRAW);
+
+    gt->curve = scene->curves.size();
+    scene->curves.push_back(curve);
+}
+
 static void sc_load_translate (pugi::xml_node node, struct scene * scene, struct group * group)
 {
     bool is_anim = node.attribute("TIME");
@@ -455,6 +1666,7 @@ static void sc_load_translate (pugi::xml_node node, struct scene * scene, struct
             if (strcmp("point", trans.name()) == 0)
                 translate.control_points.push_back(sc_load_translate_control_point(trans));
         assert(translate.control_points.size() >= 4);
+        sc_load_curve(scene, &translate);
     } else {
         translate.p.x = maybe(node.attribute("X"), 0);
         translate.p.y = maybe(node.attribute("Y"), 0);
@@ -464,20 +1676,80 @@ static void sc_load_translate (pugi::xml_node node, struct scene * scene, struct
     group->gt.push_back(translate);
 }
 
-static void sc_load_group (pugi::xml_node node, struct scene * scene, struct group * group, std::map<std::string, unsigned> * texts)
+/**
+ * @brief Compile a group's Geometric Transformations into its transform
+ *        program, fusing consecutive static ones into a single matrix
+ * @param group The group
+ */
+static void sc_compile_program (struct group * group)
 {
+    group->program.clear();
+    group->matrices.clear();
+
+    struct mat4 fused = m4_identity();
+    bool has_fused = false;
+
+#define flush() \
+    do { \
+        if (has_fused) {                                      \
+            struct op op;                                     \
+            op.type = OP_MATRIX;                              \
+            op.arg = group->matrices.size();                  \
+            group->matrices.push_back(fused);                 \
+            group->program.push_back(op);                     \
+            fused = m4_identity();                            \
+            has_fused = false;                                \
+        }                                                     \
+    } while (0)
+
+    for (unsigned i = 0; i < group->gt.size(); i++) {
+        const struct gt * gt = &group->gt[i];
+        struct op op;
+        op.arg = i;
+
+        struct mat4 local;
+
+        switch (gt->type) {
+            case GT_ROTATE:    local = sc_rotate(gt); break;
+            case GT_SCALE:     local = sc_scale(gt); break;
+            case GT_TRANSLATE: local = sc_translate(gt); break;
+
+            case GT_ROTATE_ANIM:    op.type = OP_ROTATE_ANIM; break;
+            case GT_TRANSLATE_ANIM: op.type = OP_TRANSLATE_ANIM; break;
+            default: UNREACHABLE(); continue;
+        }
+
+        if (gt->type == GT_ROTATE || gt->type == GT_SCALE || gt->type == GT_TRANSLATE) {
+            fused = m4_mul(&fused, &local);
+            has_fused = true;
+        } else {
+            flush();
+            group->program.push_back(op);
+        }
+    }
+
+    flush();
+#undef flush
+}
+
+static void sc_load_group (pugi::xml_node node, struct scene * scene, struct group * group, struct sc_load_ctx * ctx)
+{
+    group->bake = maybe(node.attribute("BAKE"), 0);
+
     for (pugi::xml_node trans = node.first_child(); trans; trans = trans.next_sibling()) {
         match("translate", sc_load_translate);
         else match("rotate", sc_load_rotate);
         else match("scale", sc_load_scale);
         else if (strcmp("models", trans.name()) == 0) {
-            sc_load_models(trans, scene, group, texts);
+            sc_load_models(trans, scene, group, ctx);
         } else if (strcmp("group", trans.name()) == 0) {
             struct group * subgroup = (struct group*) calloc(1, sizeof(struct group));
-            sc_load_group(trans, scene, subgroup, texts);
+            sc_load_group(trans, scene, subgroup, ctx);
             group->subgroups.push_back(subgroup);
         }
     }
+
+    sc_compile_program(group);
 }
 
 static void sc_load_light (pugi::xml_node node, struct scene * scene, unsigned i)
@@ -518,36 +1790,921 @@ static void sc_load_lights (pugi::xml_node node, struct scene * scene)
             sc_load_light(trans, scene, i++);
 }
 
-bool sc_load_file (const char * path, struct scene * scene)
+/**
+ * @brief Local transform of a group's Geometric Transformations from
+ *        `first` onwards, at some point in time
+ * @param group The group
+ * @param first Index of the first Geometric Transformation
+ * @param elapsed Time in msecs
+ */
+static struct mat4 sc_local_at (const struct group * group, unsigned first, double elapsed)
+{
+    struct mat4 m = m4_identity();
+
+    for (unsigned i = first; i < group->gt.size(); i++) {
+        const struct gt * gt = &group->gt[i];
+        struct mat4 local;
+
+        switch (gt->type) {
+            case GT_ROTATE:    local = sc_rotate(gt); break;
+            case GT_SCALE:     local = sc_scale(gt); break;
+            case GT_TRANSLATE: local = sc_translate(gt); break;
+
+            case GT_ROTATE_ANIM: {
+                float angle = 360 * fmod(elapsed, gt->time) / gt->time;
+                local = m4_rotate(angle, gt->p.x, gt->p.y, gt->p.z);
+            } break;
+
+            case GT_TRANSLATE_ANIM: {
+                struct Point pos = sc_catmull_rom_point(gt, fmod(elapsed, gt->time) / gt->time);
+                local = m4_translate(pos.x, pos.y, pos.z);
+            } break;
+
+            default: UNREACHABLE(); continue;
+        }
+
+        m = m4_mul(&m, &local);
+    }
+
+    return m;
+}
+
+static uint64_t gcd (uint64_t a, uint64_t b)
+{
+    while (b != 0) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/**
+ * @brief Bake a group's animation: everything from its first animated
+ *        Geometric Transformation onwards is sampled over the period
+ *        after which it repeats, and replaced by a single OP_BAKED
+ * @param scene The scene
+ * @param group The group
+ * @returns Whether the group was baked. If so its operations have been
+ *          added to `scene->ops`, not relocated yet.
+ */
+static bool sc_bake_group (struct scene * scene, const struct group * group)
+{
+    unsigned p = 0;
+    while (p < group->program.size() && group->program[p].type == OP_MATRIX)
+        p++;
+    if (p == group->program.size())
+        return false;
+
+    unsigned first = group->program[p].arg;
+
+    /* the whole animation repeats after the LCM of the periods */
+    uint64_t period = 1;
+    for (unsigned i = first; i < group->gt.size(); i++) {
+        const struct gt * gt = &group->gt[i];
+        if (gt->type != GT_ROTATE_ANIM && gt->type != GT_TRANSLATE_ANIM)
+            continue;
+
+        /* a path is drawn where its animation starts, which would be lost */
+        if (gt->type == GT_TRANSLATE_ANIM && i != first)
+            return fprintf(stderr, "Not baking group: animated translate after another animation\n"), false;
+
+        if (gt->time == 0)
+            return false;
+        period = period / gcd(period, gt->time) * gt->time;
+        if (period > UINT_MAX)
+            return fprintf(stderr, "Not baking group: period too long\n"), false;
+    }
+
+    double keys = ceil(period * group->bake / 1000);
+    if (keys > an_bake_room(&scene->anim))
+        return fprintf(stderr, "Not baking group: %.0f keys over the budget\n", keys), false;
+
+    std::vector<struct mat4> samples(keys);
+    for (unsigned i = 0; i < samples.size(); i++)
+        samples[i] = sc_local_at(group, first, period * i / keys);
+
+    struct op op;
+    op.type = OP_BAKED;
+    if (!an_add_baked(&scene->anim, samples, period, &op.arg))
+        return fprintf(stderr, "Not baking group: it shears or changes scale\n"), false;
+
+    scene->ops.insert(scene->ops.end(), group->program.begin(), group->program.begin() + p);
+    scene->ops.push_back(op);
+
+    const struct gt * gt = &group->gt[first];
+    scene->baked_curves.push_back((gt->type == GT_TRANSLATE_ANIM) ? (int) gt->curve : -1);
+    return true;
+}
+
+/**
+ * @brief Bound a node's own models
+ * @param scene The scene, the node's instances in it
+ * @param[in,out] node The node
+ */
+static void sc_bound_node (const struct scene * scene, struct node * node)
+{
+    node->radius = 0;
+    node->box = bb_empty();
+    for (unsigned j = node->first_instance; j < node->first_instance + node->n_instances; j++) {
+        const struct model_vbo * mvbo = &scene->models[scene->instances[j].mesh];
+        node->radius = fmaxf(node->radius, mvbo->radius);
+        node->box = bb_union(&node->box, &mvbo->box);
+    }
+}
+
+/**
+ * @brief Box holding a box wherever an operation of a transform program
+ *        can take it, over the whole animation
+ * @param scene The scene, its channels added
+ * @param op The operation
+ * @param b The box, in the operation's output space
+ * @returns The box, in its input space
+ */
+static struct aabb sc_sweep_op (const struct scene * scene, const struct op * op, const struct aabb * b)
+{
+    const struct anim_tracks * anim = &scene->anim;
+    if (bb_is_empty(b))
+        return *b;
+
+    struct aabb ret = bb_empty();
+    switch (op->type) {
+        case OP_MATRIX:
+            return bb_transform(&scene->matrices[op->arg], b);
+
+        case OP_ROTATE_ANIM: {
+            /* each corner goes around a circle; the box goes no further than they do */
+            struct Point a = Point(anim->rot_x[op->arg], anim->rot_y[op->arg], anim->rot_z[op->arg]);
+            struct Point reach = Point(
+                    sqrtf(fmaxf(0, 1 - a.x * a.x)),
+                    sqrtf(fmaxf(0, 1 - a.y * a.y)),
+                    sqrtf(fmaxf(0, 1 - a.z * a.z)));
+            for (unsigned c = 0; c < 8; c++) {
+                struct Point p = Point((c & 1) ? b->max.x : b->min.x, (c & 2) ? b->max.y : b->min.y, (c & 4) ? b->max.z : b->min.z);
+                struct Point o = (p.x * a.x + p.y * a.y + p.z * a.z) * a;
+                struct Point d = p - o;
+                float r = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+                bb_add(&ret, o - r * reach);
+                bb_add(&ret, o + r * reach);
+            }
+        } return ret;
+
+        case OP_TRANSLATE_ANIM: {
+            /* each segment is within its Bezier control points */
+            const struct cr_segment * s = &anim->segments[anim->tr_first[op->arg]];
+            for (unsigned j = 0; j < (unsigned) anim->tr_segments[op->arg]; j++) {
+                bb_add(&ret, s[j].d);
+                bb_add(&ret, s[j].d + s[j].c / 3);
+                bb_add(&ret, s[j].d + (2 * s[j].c + s[j].b) / 3);
+                bb_add(&ret, s[j].a + s[j].b + s[j].c + s[j].d);
+            }
+            ret.min = ret.min + b->min;
+            ret.max = ret.max + b->max;
+        } return ret;
+
+        case OP_BAKED: {
+            /* any rotation, and positions between the keys' */
+            struct Point sc = anim->bk_scale[op->arg];
+            float r = 0;
+            for (unsigned c = 0; c < 8; c++) {
+                struct Point p = Point((c & 1) ? b->max.x : b->min.x, (c & 2) ? b->max.y : b->min.y, (c & 4) ? b->max.z : b->min.z);
+                p = Point(p.x * sc.x, p.y * sc.y, p.z * sc.z);
+                r = fmaxf(r, sqrtf(p.x * p.x + p.y * p.y + p.z * p.z));
+            }
+            const struct an_key * keys = &anim->bk_keys[anim->bk_first[op->arg]];
+            for (unsigned j = 0; j < anim->bk_n[op->arg]; j++)
+                bb_add(&ret, Point(keys[j].pos[0], keys[j].pos[1], keys[j].pos[2]));
+            ret.min = ret.min - Point(r, r, r);
+            ret.max = ret.max + Point(r, r, r);
+        } return ret;
+
+        default: UNREACHABLE();
+    }
+    return ret;
+}
+
+/**
+ * @brief Bound where a node's own models can go, through its program and
+ *        every ancestor's, so that one that's out of sight can tell
+ *        whether it may have come back without being updated
+ * @param scene The compiled scene, its channels added
+ * @param i The node
+ */
+static void sc_sweep_node (struct scene * scene, unsigned i)
+{
+    struct aabb b = scene->nodes[i].box;
+    for (int j = i; j >= 0; j = scene->nodes[j].parent) {
+        const struct node * node = &scene->nodes[j];
+        for (unsigned k = node->n_ops; k-- > 0; )
+            b = sc_sweep_op(scene, &scene->ops[node->first_op + k], &b);
+    }
+    scene->nodes[i].swept = b;
+}
+
+/**
+ * @brief Flatten a group and its subgroups into the compiled scene
+ * @param scene The scene
+ * @param group The group
+ * @param parent Index of the group's parent node, -1 if none
+ */
+static void sc_compile_group (struct scene * scene, const struct group * group, int parent)
+{
+    unsigned i = scene->nodes.size();
+
+    struct node node;
+    node.parent = parent;
+    node.end = i + 1;
+    node.first_gt = scene->gts.size();
+    node.n_gts = group->gt.size();
+    node.first_op = scene->ops.size();
+    node.first_instance = scene->instances.size();
+    node.n_instances = group->models.size();
+    node.first_batch = 0;
+    node.n_batches = 0;
+    node.flags = NODE_DIRTY;
+    node.rate = RATE_FULL;
+
+    bool baked = group->bake > 0 && sc_bake_group(scene, group);
+    if (!baked)
+        scene->ops.insert(scene->ops.end(), group->program.begin(), group->program.end());
+    node.n_ops = scene->ops.size() - node.first_op;
+
+    /*
+     * relocate the program's indices into the scene's arrays, and give
+     * each animated transformation its channel
+     */
+    for (unsigned j = node.first_op; j < scene->ops.size(); j++) {
+        struct op * op = &scene->ops[j];
+        switch (op->type) {
+            case OP_MATRIX:
+                op->arg += scene->matrices.size();
+                break;
+
+            case OP_ROTATE_ANIM: {
+                const struct gt * gt = &group->gt[op->arg];
+                op->arg = an_add_rotate(&scene->anim, gt->p, gt->time);
+            } break;
+
+            case OP_TRANSLATE_ANIM: {
+                const struct gt * gt = &group->gt[op->arg];
+                op->arg = an_add_translate(&scene->anim, gt->segments, gt->time);
+                scene->channel_curves.push_back(gt->curve);
+            } break;
+
+            case OP_BAKED: break;
+
+            default: UNREACHABLE();
+        }
+
+        if (op->type != OP_MATRIX)
+            node.flags |= NODE_ANIMATED;
+    }
+    if (!(node.flags & NODE_ANIMATED) && (parent < 0 || (scene->nodes[parent].flags & NODE_STATIC)))
+        node.flags |= NODE_STATIC;
+    scene->nodes.push_back(node);
+
+    scene->matrices.insert(scene->matrices.end(), group->matrices.begin(), group->matrices.end());
+    scene->gts.insert(scene->gts.end(), group->gt.begin(), group->gt.end());
+    scene->instances.insert(scene->instances.end(), group->models.begin(), group->models.end());
+    sc_bound_node(scene, &scene->nodes[i]);
+
+    for (const struct group * subgroup : group->subgroups)
+        sc_compile_group(scene, subgroup, i);
+
+    scene->nodes[i].end = scene->nodes.size();
+}
+
+/**
+ * @brief Make room for drawing every occluder's mesh, as they are now
+ * @param scene The compiled scene
+ */
+static void sc_reserve_occluders (struct scene * scene)
+{
+    size_t tris = 0;
+    for (const struct sc_occluder & occ : scene->occluders)
+        tris += scene->occluder_meshes[occ.mesh].vertices.size() / 3;
+    oc_reserve(&scene->hiz, tris);
+}
+
+/**
+ * @brief Build the compiled scene from the loaded groups, and make room
+ *        for everything drawing a frame needs
+ * @param scene The scene
+ */
+static void sc_compile (struct scene * scene)
+{
+    scene->nodes.clear();
+    scene->gts.clear();
+    scene->ops.clear();
+    scene->matrices.clear();
+    scene->instances.clear();
+    scene->channel_curves.clear();
+    scene->baked_curves.clear();
+    an_clear(&scene->anim);
+
+    for (const struct group * group : scene->groups)
+        sc_compile_group(scene, group, -1);
+
+    an_finish(&scene->anim);
+    for (unsigned i = 0; i < scene->nodes.size(); i++)
+        sc_sweep_node(scene, i);
+
+    scene->world.resize(scene->nodes.size());
+    scene->model_bounds.resize(scene->nodes.size());
+    scene->bounds.resize(scene->nodes.size());
+    scene->updated.reserve(scene->nodes.size());
+    scene->rebound.reserve(scene->nodes.size());
+    scene->cull_plane.assign(scene->nodes.size(), 0);
+    cl_reserve(&scene->candidates, scene->nodes.size());
+    ot_reserve(&scene->index, scene->nodes.size());
+
+    struct pv_lens none = {0};
+    pv_clear(&scene->pvs, scene->nodes.size(), sc_hash(scene), &none);
+    scene->pvs_set = -1;
+    scene->pvs_visible.assign(scene->nodes.size(), 1);
+    scene->pvs_subtree.assign(scene->nodes.size(), 1);
+
+    scene->occluders.clear();
+    for (unsigned i = 0; i < scene->nodes.size(); i++) {
+        const struct node * node = &scene->nodes[i];
+        for (unsigned j = 0; j < node->n_instances; j++) {
+            int mesh = scene->instances[node->first_instance + j].occluder;
+            if (mesh >= 0) {
+                struct sc_occluder occ = { i, (unsigned) mesh, };
+                scene->occluders.push_back(occ);
+            }
+        }
+    }
+    sc_reserve_occluders(scene);
+
+    rq_reserve(&scene->queue, scene->instances.size());
+}
+
+/**
+ * @brief Append a model instance's vertex data, in world space
+ * @param src The model's vertex data
+ * @param m Its world matrix
+ * @param[in,out] dst Where to append it
+ */
+static void sc_batch_append (const struct sc_mesh_data * src, const struct mat4 * m, struct sc_mesh_data * dst)
+{
+    /* normals go through the inverse transpose: the cofactors over the determinant */
+    struct Point a = Point(m->m[0], m->m[1], m->m[2]);
+    struct Point b = Point(m->m[4], m->m[5], m->m[6]);
+    struct Point c = Point(m->m[8], m->m[9], m->m[10]);
+    struct Point bc = crossProduct(b, c);
+    struct Point ca = crossProduct(c, a);
+    struct Point ab = crossProduct(a, b);
+    float sign = (a.x * bc.x + a.y * bc.y + a.z * bc.z < 0) ? -1 : 1;
+
+    for (struct Point p : src->vertices)
+        dst->vertices.push_back(m4_transform_point(m, p));
+    for (struct Point n : src->normals)
+        dst->normals.push_back(normalize(sign * (n.x * bc + n.y * ca + n.z * ab)));
+    dst->tcoords.insert(dst->tcoords.end(), src->tcoords.begin(), src->tcoords.end());
+}
+
+/**
+ * @brief Get ready to merge the models of each static subtree into a mesh
+ *        per material, already in world space, so that drawing it takes a
+ *        draw call per material instead of one per instance. A subtree is
+ *        static if none of its nodes is animated; only the largest ones
+ *        with more than one instance are batched, by `sc_batch_subtree`.
+ * @param scene The compiled scene
+ * @param ctx Its loading context, with the vertex data of every mesh
+ */
+static void sc_batch_begin (struct scene * scene, struct sc_load_ctx * ctx)
+{
+    unsigned n = scene->nodes.size();
+    scene->batches.clear();
+
+    /* static nodes never move, so their world matrices are already known */
+    std::vector<struct mat4> & world = ctx->world;
+    world.resize(n);
+    for (unsigned i = 0; i < n; i++) {
+        const struct node * node = &scene->nodes[i];
+        world[i] = (node->parent < 0) ? m4_identity() : world[node->parent];
+        if (node->flags & NODE_STATIC)
+            sc_run_program(scene, node, &world[i]);
+    }
+
+    /* whether every node of a subtree is static, leaves first */
+    std::vector<bool> & whole = ctx->whole;
+    whole.resize(n);
+    for (unsigned i = n; i-- > 0;) {
+        bool w = scene->nodes[i].flags & NODE_STATIC;
+        for (unsigned j = i + 1; w && j < scene->nodes[i].end; j = scene->nodes[j].end)
+            w = whole[j];
+        whole[i] = w;
+    }
+
+    ctx->next_root = 0;
+}
+
+/**
+ * @brief Batch the subtree of a node, if it's one of the largest static
+ *        ones. Until then, it's drawn model by model.
+ * @param scene The compiled scene
+ * @param ctx Its loading context, ready with `sc_batch_begin`
+ * @param i The node
+ */
+static void sc_batch_subtree (struct scene * scene, const struct sc_load_ctx * ctx, unsigned i)
+{
+    struct node * root = &scene->nodes[i];
+    if (!ctx->whole[i] || (root->parent >= 0 && ctx->whole[root->parent]))
+        return;
+
+    std::map<unsigned, struct sc_mesh_data> merged;
+    std::map<unsigned, unsigned> counts;
+    unsigned total = 0;
+    for (unsigned j = i; j < root->end; j++) {
+        const struct node * node = &scene->nodes[j];
+        for (unsigned k = 0; k < node->n_instances; k++) {
+            const struct model * model = &scene->instances[node->first_instance + k];
+            sc_batch_append(&ctx->mesh_data[model->mesh], &ctx->world[j], &merged[model->mat]);
+            counts[model->mat]++;
+            total++;
+        }
+    }
+    if (total < 2)
+        return;
+
+    root->first_batch = scene->batches.size();
+    root->n_batches = merged.size();
+    for (const auto & entry : merged) {
+        struct model_vbo mvbo;
+        sc_upload_mesh(&entry.second, &mvbo);
+
+        struct sc_batch batch;
+        batch.mesh = scene->models.size();
+        batch.mat = entry.first;
+        batch.n_instances = counts[entry.first];
+        batch.box = mvbo.box;
+        scene->models.push_back(mvbo);
+        scene->batches.push_back(batch);
+    }
+
+    for (unsigned j = i; j < root->end; j++)
+        scene->nodes[j].flags |= NODE_BATCHED;
+}
+
+/**
+ * @brief Internal format of the atlas's texture
+ */
+static GLenum sc_atlas_internal (const struct atlas * at)
+{
+    return (at->format == BC_BC1) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+        : (at->format == BC_BC3) ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+        : GL_RGBA;
+}
+
+/**
+ * @brief Pack every texture's image into one texture, and make it, with
+ *        no texels yet: tiles are built on the workers and uploaded as
+ *        they're done, by `sc_step_tiles`. Images that don't fit even at
+ *        their smallest get a texture each instead, as they did before
+ *        there was an atlas.
+ * @param ctx The loading context, with the images read
+ * @returns Whether there are textures to make
+ */
+static bool sc_pack_atlas (struct sc_load_ctx * ctx)
+{
+    struct atlas * at = &ctx->atlas;
+    if (ctx->images.empty())
+        return false;
+
+    for (struct at_image & img : ctx->images)
+        at_add(at, &img);
+
+    GLint gl_max = 0;
+    unsigned max_size = ctx->atlas_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &gl_max);
+    if (gl_max > 0)
+        max_size = std::min(max_size, (unsigned) gl_max);
+
+    /* room for a tile at its smallest */
+    max_size = std::max(max_size, 2u * AT_ALIGN);
+    ctx->atlas_size = max_size;
+
+    /* cached tiles were laid out for the atlas, so they're of no use then */
+    if (!at_pack(at, max_size)) {
+        fprintf(stderr, "Error packing %u textures into a %u atlas, giving each a texture of its own\n",
+                (unsigned) ctx->images.size(), max_size);
+        for (struct tc_map & m : ctx->cached)
+            tc_close(&m);
+        ctx->separate = true;
+        return true;
+    }
+
+    if (at->width == 0) {
+        for (struct tc_map & m : ctx->cached)
+            tc_close(&m);
+        return false;
+    }
+
+    /* the padding does what repeating would, and keeps mips from bleeding */
+    glGenTextures(1, &ctx->atlas_text);
+    gs_bind_texture(ctx->atlas_text);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, AT_LEVELS - 1);
+    for (unsigned l = 0; l < AT_LEVELS; l++)
+        glTexImage2D(GL_TEXTURE_2D, l, sc_atlas_internal(at), at->width >> l, at->height >> l, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    gs_bind_texture(0);
+    return true;
+}
+
+/**
+ * @brief Upload an image that didn't fit in the atlas to a texture of its
+ *        own, and free it. Materials with the image are textured from
+ *        then on.
+ * @param scene The scene
+ * @param ctx Its loading context
+ * @param id The image
+ */
+static void sc_upload_image (struct scene * scene, struct sc_load_ctx * ctx, unsigned id)
+{
+    struct at_image * img = &ctx->atlas.images[id];
+    unsigned text = 0;
+
+    /* models whose image didn't load are left untextured */
+    bool ok = !img->pixels.empty();
+
+    /* a texture of its own repeats, and needs no padding */
+    if (ok) {
+        glGenTextures(1, &text);
+        gs_bind_texture(text);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img->width, img->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, img->pixels.data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+        gs_bind_texture(0);
+        std::vector<unsigned char>().swap(img->pixels);
+    }
+
+    static const float whole[4] = { 0, 0, 1, 1, };
+    for (unsigned m = 0; m < scene->materials.size(); m++) {
+        struct attribs * atr = &scene->materials[m];
+        if (ctx->mat_images[m] != (int) id)
+            continue;
+        ctx->mat_images[m] = -1;
+        if (!ok)
+            continue;
+        memcpy(atr->text_rect, whole, sizeof(whole));
+        atr->text = text;
+        atr->has_text = true;
+    }
+}
+
+/**
+ * @brief Upload a built tile to the atlas, and free it. Cached tiles go
+ *        straight from the mapped file. Materials with its image are
+ *        textured from then on.
+ * @param scene The scene
+ * @param ctx Its loading context, the atlas packed
+ * @param id The tile
+ */
+static void sc_upload_tile (struct scene * scene, struct sc_load_ctx * ctx, unsigned id)
+{
+    if (ctx->separate) {
+        sc_upload_image(scene, ctx, id);
+        return;
+    }
+
+    struct atlas * at = &ctx->atlas;
+    const struct at_tile * t = &at->tiles[id];
+    const unsigned char * mips = ctx->cached[id].data ? ctx->cached[id].data : t->mips.data();
+    GLenum internal = sc_atlas_internal(at);
+
+    /* models whose image didn't load are left untextured */
+    bool ok = t->width > 0 && mips;
+    gs_bind_texture(ctx->atlas_text);
+    for (unsigned l = 0; ok && l < AT_LEVELS; l++) {
+        unsigned x = t->x >> l, y = t->y >> l, w = t->width >> l, h = t->height >> l;
+        const unsigned char * level = mips + at_level_offset(at, id, l);
+        if (at->format == BC_RGBA)
+            glTexSubImage2D(GL_TEXTURE_2D, l, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, level);
+        else
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, l, x, y, w, h, internal, bc_size(at->format, w, h), level);
+    }
+    gs_bind_texture(0);
+    at_release(at, id);
+    tc_close(&ctx->cached[id]);
+
+    for (unsigned m = 0; m < scene->materials.size(); m++) {
+        struct attribs * atr = &scene->materials[m];
+        if (ctx->mat_images[m] != (int) id)
+            continue;
+        ctx->mat_images[m] = -1;
+        if (!ok)
+            continue;
+        at_rect(at, id, atr->text_rect);
+        atr->text = ctx->atlas_text;
+        atr->has_text = true;
+    }
+}
+
+/**
+ * @brief Hand the meshes small enough to batch on the fly to the batcher,
+ *        and make room for every instance of them, and for the stream
+ *        they're batched into
+ * @param scene The compiled scene, static batches built
+ * @param ctx Its loading context, with the vertex data of every mesh
+ */
+static void sc_batch_dynamic (struct scene * scene, const struct sc_load_ctx * ctx)
+{
+    struct batcher * b = &scene->batcher;
+    size_t items = 0;
+    size_t vertices = 0;
+
+    for (const struct node & node : scene->nodes) {
+        if (node.flags & NODE_BATCHED)
+            continue;
+
+        for (unsigned j = 0; j < node.n_instances; j++) {
+            unsigned mesh = scene->instances[node.first_instance + j].mesh;
+            struct model_vbo * mvbo = &scene->models[mesh];
+            if (mvbo->length == 0 || mvbo->length > b->max_vertices)
+                continue;
+
+            if (mvbo->batch < 0) {
+                const struct sc_mesh_data * data = &ctx->mesh_data[mesh];
+                mvbo->batch = bt_add_mesh(b, &data->vertices, &data->normals, &data->tcoords);
+            }
+            items++;
+            vertices += mvbo->length;
+        }
+    }
+
+    if (items == 0)
+        return;
+    bt_reserve(b, items, scene->materials.size(), vertices);
+
+    struct model_vbo stream = {0};
+    stream.box = bb_empty();
+    stream.batch = -1;
+    stream.length = vertices;
+    glGenBuffers(1, &stream.v_id);
+    glGenBuffers(1, &stream.n_id);
+    glGenBuffers(1, &stream.t_id);
+    sc_stream_buffer(stream.v_id, NULL, 0, 3 * vertices);
+    sc_stream_buffer(stream.n_id, NULL, 0, 3 * vertices);
+    sc_stream_buffer(stream.t_id, NULL, 0, 2 * vertices);
+
+    scene->stream = scene->models.size();
+    scene->models.push_back(stream);
+}
+
+/**
+ * @brief Is it past a deadline? `time_point::max()` is none.
+ */
+static inline bool sc_past (sc_clock::time_point deadline)
+{
+    return deadline != sc_clock::time_point::max() && sc_clock::now() >= deadline;
+}
+
+/**
+ * @brief Bound every node again, with the meshes read so far, and have
+ *        those whose bounds changed placed again on the next frame
+ * @param scene The compiled scene
+ */
+static void sc_refresh_bounds (struct scene * scene)
+{
+    for (struct node & node : scene->nodes) {
+        struct aabb box = node.box;
+        sc_bound_node(scene, &node);
+        if (memcmp(&box, &node.box, sizeof(box)) != 0) {
+            node.flags |= NODE_DIRTY;
+            sc_sweep_node(scene, &node - scene->nodes.data());
+        }
+    }
+}
+
+/**
+ * @brief Start building the next run of tiles on the workers: a run at a
+ *        time, so that only a few are ever built and not yet uploaded
+ * @param ctx The loading context, the atlas packed
+ */
+static void sc_launch_tiles (struct sc_load_ctx * ctx)
+{
+    unsigned left = ctx->atlas.tiles.size() - ctx->first_tile;
+    ctx->stage = SC_LOAD_TILES;
+    ctx->tasks = std::min(std::max(wk_count(), 1u), left);
+    ctx->taken = 0;
+    wk_launch(sc_build_tile, ctx, ctx->tasks);
+}
+
+/**
+ * @brief Take the assets read by the workers. Each mesh is bounded as
+ *        soon as it's read, for its placeholder, and uploaded when there's
+ *        time. Once everything's in, the occluders are too, and the atlas
+ *        is packed.
+ * @param scene The scene
+ * @param ctx Its loading context
+ * @param deadline When to stop
+ */
+static void sc_step_assets (struct scene * scene, struct sc_load_ctx * ctx, sc_clock::time_point deadline)
+{
+    unsigned meshes = ctx->mesh_files.size();
+    bool wait = deadline == sc_clock::time_point::max();
+    bool bounded = false;
+
+    /* only wait for the workers when there's nothing else to do */
+    unsigned i;
+    while (!sc_past(deadline) && wk_next(&i, wait && ctx->uploaded == ctx->uploads.size())) {
+        ctx->taken++;
+        if (i < meshes) {
+            sc_bound_mesh(&ctx->mesh_data[i], &scene->models[i]);
+            ctx->uploads.push_back(i);
+            bounded = true;
+        }
+    }
+    if (bounded)
+        sc_refresh_bounds(scene);
+
+    while (ctx->uploaded < ctx->uploads.size()) {
+        unsigned mesh = ctx->uploads[ctx->uploaded++];
+        sc_upload_mesh(&ctx->mesh_data[mesh], &scene->models[mesh]);
+        if (sc_past(deadline))
+            return;
+    }
+    if (ctx->taken < ctx->tasks)
+        return;
+
+    for (unsigned j = 0; j < ctx->occluder_data.size(); j++)
+        scene->occluder_meshes[j].vertices.swap(ctx->occluder_data[j].vertices);
+    ctx->occluder_data.clear();
+    sc_reserve_occluders(scene);
+
+    if (sc_pack_atlas(ctx)) {
+        ctx->first_tile = 0;
+        sc_launch_tiles(ctx);
+    } else {
+        sc_batch_begin(scene, ctx);
+        ctx->stage = SC_LOAD_BATCHES;
+    }
+}
+
+/**
+ * @brief Upload the tiles built by the workers, and start on the next run
+ *        once this one is in
+ * @param scene The scene
+ * @param ctx Its loading context
+ * @param deadline When to stop
+ */
+static void sc_step_tiles (struct scene * scene, struct sc_load_ctx * ctx, sc_clock::time_point deadline)
+{
+    bool wait = deadline == sc_clock::time_point::max();
+
+    unsigned i;
+    while (!sc_past(deadline) && wk_next(&i, wait)) {
+        ctx->taken++;
+        sc_upload_tile(scene, ctx, ctx->first_tile + i);
+    }
+    if (ctx->taken < ctx->tasks)
+        return;
+
+    ctx->first_tile += ctx->tasks;
+    if (ctx->first_tile < ctx->atlas.tiles.size()) {
+        sc_launch_tiles(ctx);
+    } else {
+        sc_batch_begin(scene, ctx);
+        ctx->stage = SC_LOAD_BATCHES;
+    }
+}
+
+/**
+ * @brief Batch static subtrees, a root at a time, then hand the small
+ *        meshes to the batcher
+ * @param scene The scene
+ * @param ctx Its loading context
+ * @param deadline When to stop
+ */
+static void sc_step_batches (struct scene * scene, struct sc_load_ctx * ctx, sc_clock::time_point deadline)
+{
+    while (ctx->next_root < scene->nodes.size()) {
+        sc_batch_subtree(scene, ctx, ctx->next_root++);
+        if (sc_past(deadline))
+            return;
+    }
+
+    sc_batch_dynamic(scene, ctx);
+    ctx->stage = SC_LOAD_DONE;
+}
+
+/**
+ * @brief Load more of a scene's assets, a stage at a time
+ * @param scene The scene
+ * @param deadline When to stop; `time_point::max()` waits on the workers
+ *        and doesn't stop until everything's loaded
+ * @returns Whether there's more to load
+ */
+static bool sc_load_until (struct scene * scene, sc_clock::time_point deadline)
+{
+    struct sc_load_ctx * ctx = scene->loading;
+    if (!ctx)
+        return false;
+
+    while (ctx->stage != SC_LOAD_DONE) {
+        enum sc_load_stage stage = ctx->stage;
+        switch (stage) {
+            case SC_LOAD_ASSETS:  sc_step_assets(scene, ctx, deadline); break;
+            case SC_LOAD_TILES:   sc_step_tiles(scene, ctx, deadline); break;
+            case SC_LOAD_BATCHES: sc_step_batches(scene, ctx, deadline); break;
+            default: UNREACHABLE();
+        }
+
+        /* a stage still waiting on the workers is taken up on the next frame */
+        bool blocking = deadline == sc_clock::time_point::max();
+        if (sc_past(deadline) || (ctx->stage == stage && !blocking))
+            return true;
+    }
+
+    /* place every node again, in a region that fits the whole scene */
+    scene->index.cells.clear();
+    for (struct node & node : scene->nodes)
+        node.flags |= NODE_DIRTY;
+
+    delete ctx;
+    scene->loading = NULL;
+    return false;
+}
+
+bool sc_load_begin (const char * path, struct scene * scene)
 {
     pugi::xml_document doc;
     if (!doc.load_file(path))
         return false;
 
     /*
-     * There's no need to load the same texture more than once, so we
-     * the textures loaded so far here
+     * There's no need to load the same texture or model more than once,
+     * so we keep the ones loaded so far here
      */
-    std::map<std::string, unsigned> texts;
+    struct sc_load_ctx * ctx = new sc_load_ctx();
 
     pugi::xml_node models = doc.child("scene");
+
+    /* memory baked animations may take, in KiB */
+    scene->anim.bake_budget = maybe(models.attribute("BAKE_BUDGET"), AN_BAKE_BUDGET / 1024) * 1024;
+
+    /* largest size of the texture atlas, in texels */
+    ctx->atlas_size = maybe(models.attribute("ATLAS_SIZE"), 8192);
+
+    /* how textures are stored: BC1, BC3 (with alpha) or RGBA, which is all there is without S3TC */
+    ctx->atlas.format = bc_parse(models.attribute("TEXTURE_FORMAT").value(), BC_BC1);
+    if (ctx->atlas.format != BC_RGBA && !sc_has_s3tc())
+        ctx->atlas.format = BC_RGBA;
+
+    /* slots across the page cache of virtual textures, `VT_SLOT` texels each */
+    ctx->vtex_cache = maybe(models.attribute("VTEX_CACHE"), 16);
+
+    /* where its tiles are cached between runs; empty not to cache them */
+    pugi::xml_attribute cache_dir = models.attribute("TEXTURE_CACHE");
+    ctx->cache_dir = cache_dir ? cache_dir.value() : "texture_cache";
+
+    /* largest mesh to batch on the fly, in vertices */
+    bt_init(&scene->batcher, maybe(models.attribute("BATCH_VERTICES"), BT_MAX_VERTICES));
+
     for (pugi::xml_node trans = models.first_child(); trans; trans = trans.next_sibling()) {
         if (strcmp("group", trans.name()) == 0) {
             struct group * group = (struct group*) calloc(1, sizeof(struct group));
-            sc_load_group(trans, scene, group, &texts);
+            sc_load_group(trans, scene, group, ctx);
             scene->groups.push_back(group);
         } else if (strcmp("lights", trans.name()) == 0) {
             sc_load_lights(trans, scene);
         }
     }
 
+    /* materials from the atlas are untextured until their tile is in */
+    ctx->mat_images.assign(scene->materials.size(), -1);
+    for (unsigned m = 0; m < scene->materials.size(); m++) {
+        struct attribs * atr = &scene->materials[m];
+        if (atr->has_text && atr->vtex < 0) {
+            ctx->mat_images[m] = atr->text;
+            atr->has_text = false;
+        }
+    }
+
+    sc_compile(scene);
+    sc_launch_assets(ctx);
+    scene->loading = ctx;
     return true;
 }
 
-struct Plane Plane (struct Point p, struct Point n)
+bool sc_load_step (struct scene * scene, float budget)
 {
-    struct Plane ret;
-    ret.p = p;
-    ret.n = n;
-    return ret;
+    auto us = std::chrono::microseconds((long long) (budget * 1000));
+    return sc_load_until(scene, sc_clock::now() + us);
+}
+
+bool sc_load_file (const char * path, struct scene * scene)
+{
+    if (!sc_load_begin(path, scene))
+        return false;
+    sc_load_until(scene, sc_clock::time_point::max());
+    return true;
 }
@@ -2,6 +2,17 @@
 #define _SCENE_H
 
 #include "../generator/generators.h"
+#include "anim.h"
+#include "batcher.h"
+#include "bounds.h"
+#include "camera.h"
+#include "cull.h"
+#include "mat4.h"
+#include "occlusion.h"
+#include "octree.h"
+#include "pvs.h"
+#include "render_queue.h"
+#include "vtex.h"
 
 #include "pugixml/pugixml.hpp"
 
@@ -43,18 +54,49 @@ struct gt {
     /** GT_TRANSLATE_ANIM: Catmull-Rom Control Points */
     std::vector<struct Point> control_points;
 
+    /** GT_TRANSLATE_ANIM: Segments of the curve, one per control point */
+    std::vector<struct cr_segment> segments;
+
+    /** GT_TRANSLATE_ANIM: Index of its path in `scene::curves` */
+    unsigned curve;
+
     /** what kind of Geometric Transformation? */
     enum gt_type type;
 };
 
+/**
+ * Transform program operation type
+ */
+enum op_type {
+    OP_MATRIX,         /*< Multiply by a precomputed matrix */
+    OP_ROTATE_ANIM,    /*< Apply a channel of the rotation track */
+    OP_TRANSLATE_ANIM, /*< Apply a channel of the translation track */
+    OP_BAKED,          /*< Apply a channel of the baked track */
+};
+
+/**
+ * Transform program operation. A group's Geometric Transformations are
+ * compiled into a program when loaded: consecutive static ones are fused
+ * into a single matrix, and only the animated ones are left to evaluate
+ * every frame.
+ */
+struct op {
+    enum op_type type; /*< What kind of operation? */
+
+    /**
+     * OP_MATRIX: index of the matrix
+     * OP_*_ANIM, OP_BAKED: index of the animation channel
+     */
+    unsigned arg;
+};
+
 /**
  * An instance of a model
  */
 struct model {
-    /* TODO: remove all the strings! */
-    std::string fname; /*< Key to this model's IDs */
-    unsigned id;       /*< Index to this model's attributes */
-    float mm[4][4];
+    unsigned mesh; /*< Index into `scene::models` */
+    unsigned mat;  /*< Index into `scene::materials` */
+    int occluder;  /*< Index into `scene::occluder_meshes` of its coarse version, -1 if it hides nothing */
 };
 
 /**
@@ -62,12 +104,15 @@ struct model {
  */
 struct group {
     std::vector<struct gt> gt;            /*< Geometric Transformations */
+    std::vector<struct op> program;       /*< `gt` compiled, indices relative to the group */
+    std::vector<struct mat4> matrices;    /*< Matrices of `program` */
     std::vector<struct model> models;     /*< Model instances */
     std::vector<struct group*> subgroups; /*< Subgroups */
+    float bake;                           /*< Keys per second to bake its animation at, 0 if not baked */
 };
 
 /**
- * Attributes of an instance of a model
+ * Attributes of an instance of a model, i.e., its material
  */
 struct attribs {
     unsigned char has_amb  : 1; /*< Has ambient light? */
@@ -76,11 +121,13 @@ struct attribs {
     unsigned char has_spec : 1; /*< Has specular light? */
     unsigned char has_text : 1; /*< Has a texture? */
 
-    unsigned text;     /*< Texture ID */
-    struct Point amb;  /*< Ambient Light */
-    struct Point diff; /*< Diffuse Light */
-    struct Point emi;  /*< Emissive Light */
-    struct Point spec; /*< Specular Light */
+    unsigned text;      /*< Texture ID */
+    float text_rect[4]; /*< Where its image is in the texture: corner and size */
+    int vtex;           /*< Virtual texture, -1 if it isn't one */
+    struct Point amb;   /*< Ambient Light */
+    struct Point diff;  /*< Diffuse Light */
+    struct Point emi;   /*< Emissive Light */
+    struct Point spec;  /*< Specular Light */
 };
 
 /**
@@ -91,9 +138,92 @@ struct model_vbo {
     unsigned n_id; /*< Normals VBO ID */
     unsigned t_id; /*< Texture coordinates buffer ID */
     size_t length; /*< Vertex count */
+    float radius;  /*< Distance from the origin to the farthest vertex */
+    struct aabb box; /*< Bounds of its vertices */
+    int batch;       /*< Its mesh in the dynamic batcher, -1 if it isn't batched */
+};
 
-    /** Vector with the attributes of every instance of this model */
-    std::vector<struct attribs> attribs;
+/**
+ * Node flags
+ */
+enum node_flags {
+    NODE_ANIMATED = 1 << 0, /*< Has animated transformations */
+    NODE_DIRTY    = 1 << 1, /*< Has to be updated on the next frame */
+    NODE_UPDATED  = 1 << 2, /*< Was updated on this frame */
+    NODE_DUE      = 1 << 3, /*< Its animation is due on this frame */
+    NODE_HIDDEN   = 1 << 4, /*< Was out of sight when last scheduled */
+    NODE_CULLED   = 1 << 5, /*< Its models were outside the frustum on the last frame */
+    NODE_STATIC   = 1 << 6, /*< Neither it nor any of its ancestors is animated */
+    NODE_BATCHED  = 1 << 7, /*< Its models are drawn by the batches of its static subtree's root */
+    NODE_REBOUND  = 1 << 8, /*< Its subtree's bounds are recomputed on this frame */
+};
+
+/**
+ * How often a node's animation is updated, from how much of it shows
+ */
+enum node_rate {
+    RATE_FULL,    /*< Every frame */
+    RATE_REDUCED, /*< Every `SC_RATE_REDUCED` frames: small on screen */
+    RATE_HIDDEN,  /*< Every `SC_RATE_HIDDEN` frames: out of sight */
+};
+
+#define SC_RATE_REDUCED 4
+#define SC_RATE_HIDDEN  16
+
+/** Nodes smaller than this many pixels on screen are updated at RATE_REDUCED */
+#define SC_LOD_PIXELS 32
+
+/** Time `sc_load_step` may take per frame, in ms */
+#define SC_LOAD_BUDGET 4
+
+/**
+ * A group of the compiled scene. Nodes are stored depth-first, so a
+ * node's subtree is the range `[index + 1, end)`.
+ */
+struct node {
+    int parent;              /*< Index of the parent node, -1 for top level groups */
+    unsigned end;            /*< One past the last node of this subtree */
+    unsigned first_gt;       /*< First transformation in `scene::gts` */
+    unsigned n_gts;          /*< Number of transformations */
+    unsigned first_op;       /*< First operation in `scene::ops` */
+    unsigned n_ops;          /*< Number of operations */
+    unsigned first_instance; /*< First instance in `scene::instances` */
+    unsigned n_instances;    /*< Number of instances */
+    unsigned first_batch;    /*< First batch in `scene::batches` */
+    unsigned n_batches;      /*< Number of batches, 0 unless it's the root of a batched subtree */
+    unsigned flags;          /*< `enum node_flags` */
+    float radius;            /*< Bounding radius of its own models, 0 if none */
+    struct aabb box;         /*< Bounds of its own models, in its own space */
+    struct aabb swept;       /*< World bounds of its own models, wherever the animations take them */
+    enum node_rate rate;     /*< Rate of its subtree's animation */
+};
+
+/**
+ * The path of a GT_TRANSLATE_ANIM, tessellated once into a VBO
+ */
+struct curve {
+    unsigned vbo;     /*< Vertices VBO ID */
+    unsigned length;  /*< Vertex count */
+    struct mat4 world; /*< Where it's drawn: the transformation right before it */
+};
+
+/**
+ * The model instances of a static subtree that share a material, merged
+ * into one mesh with their world transforms already applied
+ */
+struct sc_batch {
+    unsigned mesh;        /*< Index into `scene::models` */
+    unsigned mat;         /*< Index into `scene::materials` */
+    unsigned n_instances; /*< Number of instances merged */
+    struct aabb box;      /*< World bounds */
+};
+
+/**
+ * A model instance drawn as an occluder
+ */
+struct sc_occluder {
+    unsigned node; /*< Index of its node */
+    unsigned mesh; /*< Index into `scene::occluder_meshes` */
 };
 
 /**
@@ -114,6 +244,16 @@ struct light {
     struct Point pos;   /*< Its position */
 };
 
+/**
+ * Per-frame statistics
+ */
+struct sc_stats {
+    unsigned nodes_updated; /*< Nodes whose world matrix was recomputed */
+    unsigned visible;       /*< Model instances inside the frustum */
+    unsigned culled;        /*< Model instances culled */
+    unsigned occluded;      /*< Model instances hidden behind occluders */
+};
+
 /**
  * The scene type. It contains all the info necessary to draw a scene
  */
@@ -121,29 +261,148 @@ struct scene {
     /** Static lights */
     std::vector<struct light*> lights;
 
-    /** Groups of objects */
+    /** Groups of objects, as loaded from the scene file */
     std::vector<struct group*> groups;
 
-    /** Models data */
-    std::map<std::string, struct model_vbo> models;
-};
+    /** Models data, indexed by `model::mesh` */
+    std::vector<struct model_vbo> models;
 
-struct Plane {
-	struct Point p;
-	struct Point n;
-};
+    /** Distinct materials, indexed by `model::mat` */
+    std::vector<struct attribs> materials;
+
+    /*
+     * The compiled scene: `groups` flattened into contiguous arrays, so
+     * that drawing a frame doesn't allocate or copy.
+     */
+    std::vector<struct node> nodes;       /*< Every group, depth-first */
+    std::vector<struct gt> gts;           /*< Transformations of every node */
+    std::vector<struct op> ops;           /*< Transform programs of every node */
+    std::vector<struct mat4> matrices;    /*< Matrices of `ops` */
+    std::vector<struct model> instances;  /*< Model instances of every node */
+    std::vector<struct sc_batch> batches; /*< Merged instances of static subtrees */
+
+    /** World matrix of every node, updated when needed */
+    std::vector<struct mat4> world;
+
+    /** World bounds of each node's own models, updated with `world` */
+    std::vector<struct aabb> model_bounds;
+
+    /** World bounds of each node's whole subtree */
+    std::vector<struct aabb> bounds;
+
+    /** Nodes updated on this frame, in order */
+    std::vector<unsigned> updated;
+
+    /** Nodes whose subtree's bounds changed on this frame, leaves first */
+    std::vector<unsigned> rebound;
+
+    /**
+     * Spatial index of `model_bounds`, for picking and other queries:
+     * nodes with models are its items, moved as they're updated
+     */
+    struct octree index;
+
+    /** Frustum cull the scene? */
+    bool cull;
+
+    /** Nodes whose models are left to cull, once the hierarchy is done */
+    struct cl_spheres candidates;
 
-struct frustum {
-    struct Plane top;
-    struct Plane bot;
-    struct Plane far;
-    struct Plane near;
-    struct Plane left;
-    struct Plane right;
+    /** Plane that last culled each node */
+    std::vector<unsigned char> cull_plane;
+
+    /** Occlusion cull the scene? */
+    bool occlusion;
+
+    /** Coarse meshes of the models that hide others */
+    std::vector<struct oc_mesh> occluder_meshes;
+
+    /** Every instance with a coarse mesh, drawn as an occluder */
+    std::vector<struct sc_occluder> occluders;
+
+    /** Depth of the occluders of the frame */
+    struct oc_buffer hiz;
+
+    /** Potentially visible sets of a camera path, if any */
+    struct pvs pvs;
+
+    /** Set in use, -1 if none */
+    int pvs_set;
+
+    /** The set in use: may each node's own models be seen? */
+    std::vector<unsigned char> pvs_visible;
+
+    /** The set in use: may anything of each node's subtree be seen? */
+    std::vector<unsigned char> pvs_subtree;
+
+    /** Animation channels of every node, evaluated once per frame */
+    struct anim_tracks anim;
+
+    /** Paths of the animated translations */
+    std::vector<struct curve> curves;
+
+    /** Index in `curves` of each translation channel's path */
+    std::vector<unsigned> channel_curves;
+
+    /** Index in `curves` of each baked channel's path, -1 if none */
+    std::vector<int> baked_curves;
+
+    /** Statistics of the last frame */
+    struct sc_stats stats;
+
+    /** Frames drawn so far, to schedule reduced rate animations */
+    unsigned frame;
+
+    /** Batch small models on the fly? */
+    bool batching;
+
+    /** Small models of the frame, batched by material */
+    struct batcher batcher;
+
+    /** Mesh of the batcher's stream, drawn a range at a time */
+    unsigned stream;
+
+    /** Draw packets of the frame being drawn */
+    struct render_queue queue;
+
+    /** Virtual textures, and the cache of their pages */
+    struct vt_cache vtex;
+
+    /** Assets still being loaded, `NULL` once they all are */
+    struct sc_load_ctx * loading;
 };
 
 /**
- * @brief Load a scene file
+ * @brief Find the node whose models' bounds a ray hits first, e.g. to
+ *        pick with the mouse
+ * @param scene The scene, drawn at least once
+ * @param origin Where the ray starts
+ * @param dir Its direction
+ * @returns The node, -1 if none
+ */
+int sc_pick (const struct scene * scene, struct Point origin, struct Point dir);
+
+/**
+ * @brief Find the nodes whose models are within a node's own size of its
+ *        models
+ * @param scene The scene, drawn at least once
+ * @param node The node
+ * @param[out] out Where the nodes found are appended, the node itself left out
+ * @returns How many were found
+ */
+unsigned sc_nearby (const struct scene * scene, unsigned node, std::vector<unsigned> * out);
+
+/**
+ * @brief Draw the bounds of a node's models, as they were on the last
+ *        frame. The view matrix has to be loaded.
+ * @param scene The scene
+ * @param node The node
+ * @param color Color of the lines
+ */
+void sc_draw_bounds (const struct scene * scene, unsigned node, struct Point color);
+
+/**
+ * @brief Load a scene file, and every asset it uses
  * @param path The path to the file
  * @param[out] scene Where to save loaded data
  * @returns `true` if successfully loaded the scene file
@@ -151,13 +410,77 @@ struct frustum {
 bool sc_load_file (const char * path, struct scene * scene);
 
 /**
- * @brief Draw a scene
+ * @brief Load a scene file, and start reading its assets on the workers.
+ *        The scene can be drawn right away: models whose mesh was read
+ *        are drawn as their boxes until it's uploaded, and untextured
+ *        until their tile of the atlas is; `sc_load_step` does the rest.
+ * @param path The path to the file
+ * @param[out] scene Where to save loaded data
+ * @returns `true` if successfully loaded the scene file
+ */
+bool sc_load_begin (const char * path, struct scene * scene);
+
+/**
+ * @brief Load more of a scene's assets: upload what the workers are done
+ *        with, and start them on what's next, for about as long as given.
+ *        Call it once a frame, before `sc_draw`.
+ * @param scene The scene, from `sc_load_begin`
+ * @param budget How long to take, in ms
+ * @returns Whether there's more to load
+ */
+bool sc_load_step (struct scene * scene, float budget);
+
+/**
+ * @brief Draw a scene. In debug builds, asserts that drawing didn't
+ *        allocate memory.
  * @param scene The scene
+ * @param cam The camera, up to date and with its view matrix already
+ *        loaded as the modelview
  * @param elapsed Number of ms since program start
  * @param draw_curves Draw Catmull-Rom curves?
  * @param draw_ligts Draw static lights?
  */
-void sc_draw (struct scene * scene, const struct frustum * frst, unsigned elapsed, bool draw_curves, bool draw_ligts);
+void sc_draw (struct scene * scene, const struct camera * cam, unsigned elapsed, bool draw_curves, bool draw_ligts);
+
+/**
+ * @brief Mark a node as changed, e.g. after editing its transformations
+ *        at runtime, so that it and its subtree are updated next frame
+ * @param scene The scene
+ * @param node Index of the node
+ */
+void sc_mark_dirty (struct scene * scene, unsigned node);
+
+/**
+ * @brief Compute the potentially visible sets of a camera path with the
+ *        scene's culling, a set per segment of the path. The scene's
+ *        animation is run along as the path is sampled, but only static
+ *        nodes can be hidden by a set and only static occluders are drawn.
+ * @param scene The scene
+ * @param lens Camera whose projection and up direction to use; the sets
+ *        only hold for cameras it covers, as `pv_covers` tells
+ * @param path The path
+ * @param[out] sets Where to save the sets
+ */
+void sc_bake_pvs (struct scene * scene, const struct camera * lens, const struct pv_path * path, struct pvs * sets);
+
+/**
+ * @brief Use a camera path's potentially visible sets to cull the scene
+ * @param scene The scene
+ * @param sets The sets, baked by `sc_bake_pvs`
+ * @returns `false` if they were baked for another scene
+ */
+bool sc_use_pvs (struct scene * scene, const struct pvs * sets);
+
+/**
+ * @brief Pick the set to cull with, from where the camera is on its path.
+ *        Nodes it hides are culled without testing them any further. No
+ *        set is used while the camera sees more than the sets were baked
+ *        with.
+ * @param scene The scene
+ * @param cam The camera, up to date
+ * @param set The segment of the path the camera is on, -1 for none
+ */
+void sc_set_pvs (struct scene * scene, const struct camera * cam, int set);
 
 /**
  * @brief Draw a scene's static lights
@@ -165,6 +488,4 @@ void sc_draw (struct scene * scene, const struct frustum * frst, unsigned elapse
  */
 void sc_draw_lights (const struct scene * scene);
 
-struct Plane Plane (struct Point p, struct Point n);
-
 #endif /* _SCENE_H */
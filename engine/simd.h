@@ -0,0 +1,181 @@
+#ifndef _SIMD_H
+#define _SIMD_H
+
+/*
+ * A thin layer over the widest float vectors the compiler targets: AVX
+ * (8 lanes), SSE2 (4 lanes) or plain floats (1 lane). Kernels are written
+ * once against `vf` and process `VF_WIDTH` elements per operation.
+ */
+
+#include <math.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define VF_WIDTH 8
+typedef __m256 vf;
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VF_WIDTH 4
+typedef __m128 vf;
+#else
+#define VF_WIDTH 1
+typedef float vf;
+#endif
+
+#if defined(__AVX__)
+
+static inline vf vf_set1 (float a)                { return _mm256_set1_ps(a); }
+static inline vf vf_load (const float * p)        { return _mm256_loadu_ps(p); }
+static inline void vf_store (float * p, vf a)     { _mm256_storeu_ps(p, a); }
+static inline vf vf_add (vf a, vf b)              { return _mm256_add_ps(a, b); }
+static inline vf vf_sub (vf a, vf b)              { return _mm256_sub_ps(a, b); }
+static inline vf vf_mul (vf a, vf b)              { return _mm256_mul_ps(a, b); }
+static inline vf vf_div (vf a, vf b)              { return _mm256_div_ps(a, b); }
+static inline vf vf_sqrt (vf a)                   { return _mm256_sqrt_ps(a); }
+static inline vf vf_min (vf a, vf b)              { return _mm256_min_ps(a, b); }
+static inline vf vf_max (vf a, vf b)              { return _mm256_max_ps(a, b); }
+static inline vf vf_and (vf a, vf b)              { return _mm256_and_ps(a, b); }
+static inline vf vf_or (vf a, vf b)               { return _mm256_or_ps(a, b); }
+static inline vf vf_lt (vf a, vf b)               { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vf vf_gt (vf a, vf b)               { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline vf vf_select (vf m, vf a, vf b)     { return _mm256_blendv_ps(b, a, m); }
+static inline vf vf_floor (vf a)                  { return _mm256_floor_ps(a); }
+static inline int vf_mask (vf m)                  { return _mm256_movemask_ps(m); }
+#if defined(__FMA__)
+static inline vf vf_fmadd (vf a, vf b, vf c)      { return _mm256_fmadd_ps(a, b, c); }
+#else
+static inline vf vf_fmadd (vf a, vf b, vf c)      { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+
+#elif VF_WIDTH == 4
+
+static inline vf vf_set1 (float a)                { return _mm_set1_ps(a); }
+static inline vf vf_load (const float * p)        { return _mm_loadu_ps(p); }
+static inline void vf_store (float * p, vf a)     { _mm_storeu_ps(p, a); }
+static inline vf vf_add (vf a, vf b)              { return _mm_add_ps(a, b); }
+static inline vf vf_sub (vf a, vf b)              { return _mm_sub_ps(a, b); }
+static inline vf vf_mul (vf a, vf b)              { return _mm_mul_ps(a, b); }
+static inline vf vf_div (vf a, vf b)              { return _mm_div_ps(a, b); }
+static inline vf vf_sqrt (vf a)                   { return _mm_sqrt_ps(a); }
+static inline vf vf_min (vf a, vf b)              { return _mm_min_ps(a, b); }
+static inline vf vf_max (vf a, vf b)              { return _mm_max_ps(a, b); }
+static inline vf vf_and (vf a, vf b)              { return _mm_and_ps(a, b); }
+static inline vf vf_or (vf a, vf b)               { return _mm_or_ps(a, b); }
+static inline vf vf_lt (vf a, vf b)               { return _mm_cmplt_ps(a, b); }
+static inline vf vf_gt (vf a, vf b)               { return _mm_cmpgt_ps(a, b); }
+static inline vf vf_select (vf m, vf a, vf b)     { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+static inline int vf_mask (vf m)                  { return _mm_movemask_ps(m); }
+static inline vf vf_fmadd (vf a, vf b, vf c)      { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+static inline vf vf_floor (vf a)
+{
+    /* truncate, then step down where that rounded up (negative numbers) */
+    vf t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1)));
+}
+
+#else
+
+static inline vf vf_set1 (float a)                { return a; }
+static inline vf vf_load (const float * p)        { return *p; }
+static inline void vf_store (float * p, vf a)     { *p = a; }
+static inline vf vf_add (vf a, vf b)              { return a + b; }
+static inline vf vf_sub (vf a, vf b)              { return a - b; }
+static inline vf vf_mul (vf a, vf b)              { return a * b; }
+static inline vf vf_div (vf a, vf b)              { return a / b; }
+static inline vf vf_sqrt (vf a)                   { return sqrtf(a); }
+static inline vf vf_min (vf a, vf b)              { return (a < b) ? a : b; }
+static inline vf vf_max (vf a, vf b)              { return (a > b) ? a : b; }
+static inline vf vf_floor (vf a)                  { return floorf(a); }
+static inline vf vf_fmadd (vf a, vf b, vf c)      { return a * b + c; }
+
+/* masks are floats that are either 0 or 1 */
+static inline vf vf_and (vf a, vf b)              { return (a != 0 && b != 0) ? 1 : 0; }
+static inline vf vf_or (vf a, vf b)               { return (a != 0 || b != 0) ? 1 : 0; }
+static inline vf vf_lt (vf a, vf b)               { return (a < b) ? 1 : 0; }
+static inline vf vf_gt (vf a, vf b)               { return (a > b) ? 1 : 0; }
+static inline vf vf_select (vf m, vf a, vf b)     { return (m != 0) ? a : b; }
+static inline int vf_mask (vf m)                  { return m != 0; }
+
+#endif
+
+/** Mask with every lane set */
+#define VF_ALL ((1 << VF_WIDTH) - 1)
+
+/**
+ * @brief Load `VF_WIDTH` floats from scattered places
+ * @param base Array to read from
+ * @param idx `VF_WIDTH` indices into `base`
+ */
+static inline vf vf_gather (const float * base, const unsigned * idx)
+{
+    float tmp[VF_WIDTH];
+    for (unsigned i = 0; i < VF_WIDTH; i++)
+        tmp[i] = base[idx[i]];
+    return vf_load(tmp);
+}
+
+/*
+ * Byte vectors, for 8 bit texels: `VB_WIDTH` bytes per operation. AVX has
+ * no 256 bit integer operations, so it uses SSE2's; without SSE2 they're
+ * packed in a 64 bit integer.
+ */
+
+#if defined(__SSE2__) || defined(_M_X64)
+
+#define VB_WIDTH 16
+typedef __m128i vb;
+
+static inline vb vb_load (const unsigned char * p)     { return _mm_loadu_si128((const __m128i *) p); }
+static inline void vb_store (unsigned char * p, vb a)  { _mm_storeu_si128((__m128i *) p, a); }
+static inline vb vb_avg (vb a, vb b)                   { return _mm_avg_epu8(a, b); }
+static inline vb vb_min (vb a, vb b)                   { return _mm_min_epu8(a, b); }
+static inline vb vb_max (vb a, vb b)                   { return _mm_max_epu8(a, b); }
+
+/* the even and the odd 32 bit lanes of `a`, then those of `b` */
+static inline vb vb_even32 (vb a, vb b)
+{
+    return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+static inline vb vb_odd32 (vb a, vb b)
+{
+    return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+#else
+
+#include <stdint.h>
+#include <string.h>
+
+#define VB_WIDTH 8
+typedef uint64_t vb;
+
+static inline vb vb_load (const unsigned char * p)     { vb a; memcpy(&a, p, sizeof(a)); return a; }
+static inline void vb_store (unsigned char * p, vb a)  { memcpy(p, &a, sizeof(a)); }
+
+/* rounding up, as SSE2 does */
+static inline vb vb_avg (vb a, vb b)                   { return (a | b) - (((a ^ b) >> 1) & UINT64_C(0x7f7f7f7f7f7f7f7f)); }
+
+static inline vb vb_min (vb a, vb b)
+{
+    vb r = 0;
+    for (unsigned i = 0; i < 64; i += 8)
+        r |= ((((a >> i) & 0xff) < ((b >> i) & 0xff)) ? a : b) & (UINT64_C(0xff) << i);
+    return r;
+}
+
+static inline vb vb_max (vb a, vb b)
+{
+    vb r = 0;
+    for (unsigned i = 0; i < 64; i += 8)
+        r |= ((((a >> i) & 0xff) > ((b >> i) & 0xff)) ? a : b) & (UINT64_C(0xff) << i);
+    return r;
+}
+
+static inline vb vb_even32 (vb a, vb b)                { return (a & 0xffffffff) | (b << 32); }
+static inline vb vb_odd32 (vb a, vb b)                 { return (a >> 32) | (b & ~UINT64_C(0xffffffff)); }
+
+#endif
+
+#endif /* _SIMD_H */
@@ -0,0 +1,168 @@
+#include "texcache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <direct.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/** Identifies a cached texture, and its version */
+static const char tc_magic[4] = { 'T', 'E', 'X', '1', };
+
+/*
+ * A cached texture is the header and the texels, in the machine's byte
+ * order: like baked sets, it's only meant to be read where it was built.
+ */
+
+uint64_t tc_hash (const void * data, size_t size, uint64_t h)
+{
+    const unsigned char * bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ bytes[i]) * 1099511628211ull;
+    return h;
+}
+
+bool tc_init (const char * dir)
+{
+#ifdef _WIN32
+    return _mkdir(dir) == 0 || errno == EEXIST;
+#else
+    return mkdir(dir, 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+std::string tc_path (const char * dir, const char * source)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.tex", (unsigned long long) tc_hash(source, strlen(source), TC_HASH_SEED));
+    return std::string(dir) + name;
+}
+
+/**
+ * @brief Map a whole file, read only
+ * @param[out] length Its length
+ * @returns The mapping, NULL if it fails
+ */
+static void * tc_map_file (const char * fname, size_t * length)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return NULL;
+
+    /* the view keeps the mapping open */
+    void * base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    *length = (size_t) size.QuadPart;
+    return base;
+#else
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && st.st_size > 0;
+    void * base = ok ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    /* it's about to be uploaded from start to end */
+    posix_madvise(base, st.st_size, POSIX_MADV_WILLNEED);
+    *length = st.st_size;
+    return base;
+#endif
+}
+
+static void tc_unmap_file (void * base, size_t length)
+{
+#ifdef _WIN32
+    (void) length;
+    UnmapViewOfFile(base);
+#else
+    munmap(base, length);
+#endif
+}
+
+bool tc_open (struct tc_map * m, const char * fname, uint64_t source, uint64_t options)
+{
+    m->base = NULL;
+    m->length = 0;
+    m->data = NULL;
+
+    size_t length = 0;
+    void * base = tc_map_file(fname, &length);
+    if (!base)
+        return false;
+
+    const struct tc_header * h = (const struct tc_header *) base;
+    bool ok = length >= sizeof(struct tc_header)
+        && memcmp(h->magic, tc_magic, sizeof(tc_magic)) == 0
+        && h->source == source
+        && h->options == options
+        && h->size == length - sizeof(struct tc_header);
+    if (!ok) {
+        tc_unmap_file(base, length);
+        return false;
+    }
+
+    m->base = base;
+    m->length = length;
+    m->header = *h;
+    m->data = (const unsigned char *) base + sizeof(struct tc_header);
+    return true;
+}
+
+void tc_close (struct tc_map * m)
+{
+    if (m->base)
+        tc_unmap_file(m->base, m->length);
+    m->base = NULL;
+    m->length = 0;
+    m->data = NULL;
+}
+
+bool tc_save (const char * fname, const struct tc_header * header, const unsigned char * data)
+{
+    std::string tmp = std::string(fname) + ".tmp";
+    FILE * outf = fopen(tmp.c_str(), "wb");
+    if (!outf)
+        return false;
+
+    struct tc_header h = *header;
+    memcpy(h.magic, tc_magic, sizeof(tc_magic));
+    bool ok = fwrite(&h, sizeof(h), 1, outf) == 1
+        && fwrite(data, 1, h.size, outf) == h.size;
+
+    /* Windows' rename doesn't replace a file that's there */
+#ifdef _WIN32
+    ok = fclose(outf) == 0 && ok && MoveFileExA(tmp.c_str(), fname, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = fclose(outf) == 0 && ok && rename(tmp.c_str(), fname) == 0;
+#endif
+    if (!ok)
+        remove(tmp.c_str());
+    return ok;
+}
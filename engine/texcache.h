@@ -0,0 +1,85 @@
+#ifndef _TEXCACHE_H
+#define _TEXCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+/** Seed of `tc_hash` */
+#define TC_HASH_SEED 14695981039346656037ull
+
+/**
+ * What a cached texture was built from, and how
+ */
+struct tc_header {
+    char magic[4];                    /*< Identifies the file and its version */
+    uint32_t width, height;           /*< Size of the source image */
+    uint32_t shrink;                  /*< Times it was halved */
+    uint32_t tile_width, tile_height; /*< Size of the texture built from it */
+    uint64_t source;                  /*< Hash of the source file */
+    uint64_t options;                 /*< Hash of the options it was built with */
+    uint64_t size;                    /*< Bytes of texels after the header */
+};
+
+/**
+ * A cached texture, mapped into memory
+ */
+struct tc_map {
+    void * base;                /*< The mapping, NULL if there's none */
+    size_t length;              /*< Its length */
+    struct tc_header header;    /*< The file's header */
+    const unsigned char * data; /*< Texels, ready to upload */
+};
+
+/**
+ * @brief Hash bytes (FNV-1a, 64 bits)
+ * @param data The bytes
+ * @param size How many
+ * @param h The hash so far, to hash several runs as one, or `TC_HASH_SEED`
+ * @returns The hash
+ */
+uint64_t tc_hash (const void * data, size_t size, uint64_t h);
+
+/**
+ * @brief Make a cache directory, if it isn't there already
+ * @returns Whether it's there now
+ */
+bool tc_init (const char * dir);
+
+/**
+ * @brief Where a source file's texture is cached: one file per source,
+ *        overwritten when the source changes
+ * @param dir The cache directory
+ * @param source The source file
+ * @returns The cache file
+ */
+std::string tc_path (const char * dir, const char * source);
+
+/**
+ * @brief Map a cached texture, if it was built from the same source with
+ *        the same options
+ * @param[out] m The mapping, with no mapping if it fails
+ * @param fname The cache file
+ * @param source Hash of the source file
+ * @param options Hash of the options
+ * @returns Whether it's mapped
+ */
+bool tc_open (struct tc_map * m, const char * fname, uint64_t source, uint64_t options);
+
+/**
+ * @brief Unmap a cached texture, if it's mapped
+ */
+void tc_close (struct tc_map * m);
+
+/**
+ * @brief Cache a texture. It's written aside and renamed into place, so
+ *        that an interrupted write never leaves a broken file behind.
+ * @param fname The cache file
+ * @param header Its header; the magic is filled in
+ * @param data `header->size` bytes of texels
+ * @returns Whether it was written
+ */
+bool tc_save (const char * fname, const struct tc_header * header, const unsigned char * data);
+
+#endif /* _TEXCACHE_H */
@@ -0,0 +1,698 @@
+#include "vtex.h"
+#include "gl_state.h"
+#include "workers.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+/** Identifies a tiled texture file, and its version */
+static const char vt_magic[4] = { 'V', 'T', 'X', '1', };
+
+/*
+ * Both programs are fragment programs only: vertices, lighting included,
+ * still go through the fixed function pipeline, and the texture
+ * coordinates through the texture matrix.
+ */
+
+/** Finds each texel's page in the cache, through the indirection */
+static const char vt_draw_src[] =
+    "uniform sampler2D cache;\n"
+    "uniform sampler2D indirection;\n"
+    "uniform vec2 size;\n"
+    "void main (void)\n"
+    "{\n"
+    "    /* a texel per page: biased by a page, its level is the texture's */\n"
+    "    vec4 page = floor(texture2D(indirection, gl_TexCoord[0].st, log2(PAGE)) * 255.0 + 0.5);\n"
+    "    vec2 texel = fract(gl_TexCoord[0].st) * max(size / exp2(page.b), 1.0);\n"
+    "    vec2 st = page.rg * SLOT + BORDER + mod(texel, PAGE);\n"
+    "    gl_FragColor = texture2D(cache, st / (ACROSS * SLOT)) * gl_Color;\n"
+    "}\n";
+
+/** Writes the page each texel would like: x, y, level and texture */
+static const char vt_feedback_src[] =
+    "uniform vec2 size;\n"
+    "uniform float levels;\n"
+    "uniform float id;\n"
+    "void main (void)\n"
+    "{\n"
+    "    /* the level it'd be sampled from in the window, which is bigger */\n"
+    "    vec2 texel = gl_TexCoord[0].st * size;\n"
+    "    float rho = max(length(dFdx(texel)), length(dFdy(texel))) / SCALE;\n"
+    "    float level = clamp(floor(log2(max(rho, 1e-6)) + 0.5), 0.0, levels - 1.0);\n"
+    "    vec2 page = floor(fract(gl_TexCoord[0].st) * max(size / exp2(level), 1.0) / PAGE);\n"
+    "    gl_FragColor = vec4(page, level, id) / 255.0;\n"
+    "}\n";
+
+/**
+ * @brief Pages across a side of a level
+ */
+static inline unsigned vt_pages (unsigned n, unsigned level)
+{
+    return std::max(1u, (n >> level) / VT_PAGE);
+}
+
+/**
+ * @brief Levels of a virtual texture, down to a single page
+ */
+static unsigned vt_levels (unsigned width, unsigned height)
+{
+    unsigned levels = 1;
+    while (vt_pages(width, levels - 1) > 1 || vt_pages(height, levels - 1) > 1)
+        levels++;
+    return levels;
+}
+
+/**
+ * @brief Size of a page in a file, and in the cache
+ */
+static inline size_t vt_page_size (enum bc_format format)
+{
+    return bc_size(format, VT_SLOT, VT_SLOT);
+}
+
+/**
+ * @brief Internal format of textures of pages
+ */
+static GLenum vt_internal (enum bc_format format)
+{
+    return (format == BC_BC1) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+        : (format == BC_BC3) ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+        : GL_RGBA;
+}
+
+bool vt_supported (void)
+{
+#ifdef __APPLE__
+    return true;
+#else
+    return GLEW_VERSION_2_1 && GLEW_ARB_framebuffer_object;
+#endif
+}
+
+/**
+ * @brief Compile and link a fragment program
+ * @param defines Constants, ahead of the source
+ * @param src The source
+ * @returns The program, 0 if it didn't compile
+ */
+static unsigned vt_program (const char * defines, const char * src)
+{
+    const char * srcs[2] = { defines, src, };
+    GLuint shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(shader, 2, srcs, NULL);
+    glCompileShader(shader);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+
+    GLint ok = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024] = "";
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "Error compiling a virtual texturing program:\n%s\n", log);
+        glDeleteProgram(program);
+        program = 0;
+    }
+    glDeleteShader(shader);
+    return program;
+}
+
+bool vt_init (struct vt_cache * vc, unsigned across, enum bc_format format)
+{
+    GLint gl_max = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &gl_max);
+    across = std::max(2u, std::min(across, (unsigned) gl_max / VT_SLOT));
+
+    char defines[256];
+    snprintf(defines, sizeof(defines),
+            "#version 120\n"
+            "#define PAGE %d.0\n"
+            "#define BORDER %d.0\n"
+            "#define SLOT %d.0\n"
+            "#define ACROSS %u.0\n"
+            "#define SCALE %d.0\n",
+            VT_PAGE, VT_BORDER, VT_SLOT, across, VT_FEEDBACK_SCALE);
+
+    vc->program = vt_program(defines, vt_draw_src);
+    vc->feedback_program = vt_program(defines, vt_feedback_src);
+    if (!vc->program || !vc->feedback_program) {
+        glDeleteProgram(vc->program);
+        glDeleteProgram(vc->feedback_program);
+        vc->program = vc->feedback_program = 0;
+        return false;
+    }
+
+    vc->size_loc = glGetUniformLocation(vc->program, "size");
+    vc->fb_size_loc = glGetUniformLocation(vc->feedback_program, "size");
+    vc->fb_levels_loc = glGetUniformLocation(vc->feedback_program, "levels");
+    vc->fb_id_loc = glGetUniformLocation(vc->feedback_program, "id");
+    gs_use_program(vc->program);
+    glUniform1i(glGetUniformLocation(vc->program, "cache"), 0);
+    glUniform1i(glGetUniformLocation(vc->program, "indirection"), 1);
+    gs_use_program(0);
+
+    /* pages have their own border, and no mips: each is a level */
+    vc->across = across;
+    vc->format = format;
+    glGenTextures(1, &vc->cache);
+    gs_bind_texture(vc->cache);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, vt_internal(format), across * VT_SLOT, across * VT_SLOT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    gs_bind_texture(0);
+
+    struct vt_slot free_slot = { -1, 0, 0, false, };
+    vc->slots.assign(across * across, free_slot);
+    vc->textures.clear();
+
+    /* the feedback's buffers are made once its size is known */
+    glGenFramebuffers(1, &vc->fbo);
+    glGenBuffers(1, &vc->pbo);
+    vc->color = vc->depth = 0;
+    vc->fb_width = vc->fb_height = 0;
+    vc->pending = false;
+
+    vc->bound = -1;
+    vc->frame = 0;
+    vc->stamp = 0;
+    vc->requests.reserve(VT_REQUESTS);
+    vc->staging.resize(VT_LOADS * vt_page_size(format));
+    memset(&vc->stats, 0, sizeof(vc->stats));
+    return true;
+}
+
+/**
+ * @brief Upload a page to a slot of the cache
+ */
+static void vt_upload (struct vt_cache * vc, unsigned slot, const unsigned char * data)
+{
+    unsigned x = slot % vc->across * VT_SLOT, y = slot / vc->across * VT_SLOT;
+    gs_bind_texture(vc->cache);
+    if (vc->format == BC_RGBA)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, VT_SLOT, VT_SLOT, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    else
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, VT_SLOT, VT_SLOT,
+                vt_internal(vc->format), vt_page_size(vc->format), data);
+}
+
+/*
+ * Tiled files are read at offsets, without seeking, so that workers can
+ * read pages of the same file at once.
+ */
+
+static int vt_open_file (const char * fname)
+{
+#ifdef _WIN32
+    return _open(fname, _O_RDONLY | _O_BINARY);
+#else
+    return open(fname, O_RDONLY);
+#endif
+}
+
+static void vt_close_file (int fd)
+{
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+/**
+ * @brief Read bytes of a file at an offset
+ * @returns Whether they were all there
+ */
+static bool vt_read_at (int fd, void * out, size_t size, uint64_t offset)
+{
+#ifdef _WIN32
+    /* an OVERLAPPED offset reads from there, as pread does */
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD) offset;
+    ov.OffsetHigh = (DWORD) (offset >> 32);
+    DWORD n = 0;
+    return ReadFile((HANDLE) _get_osfhandle(fd), out, (DWORD) size, &n, &ov) && n == size;
+#else
+    return pread(fd, out, size, (off_t) offset) == (ssize_t) size;
+#endif
+}
+
+/**
+ * @brief Size of a file
+ * @returns Whether it could tell
+ */
+static bool vt_file_size (int fd, uint64_t * size)
+{
+#ifdef _WIN32
+    __int64 n = _filelengthi64(fd);
+#else
+    struct stat st;
+    off_t n = (fstat(fd, &st) == 0) ? st.st_size : -1;
+#endif
+    *size = n;
+    return n >= 0;
+}
+
+/**
+ * @brief Read a page of a virtual texture
+ * @returns Whether it could
+ */
+static bool vt_read (const struct vt_cache * vc, const struct vt_texture * t, unsigned page, unsigned char * out)
+{
+    size_t size = vt_page_size(vc->format);
+    return vt_read_at(t->fd, out, size, sizeof(struct vt_header) + (uint64_t) page * size);
+}
+
+/**
+ * @brief Point every page of a virtual texture at the page to draw it
+ *        with: itself if it's in the cache, or else whatever its parent
+ *        is drawn with. Then upload the indirection.
+ */
+static void vt_update_table (struct vt_cache * vc, struct vt_texture * t)
+{
+    const struct vt_header * h = &t->header;
+
+    for (unsigned l = h->levels; l-- > 0; ) {
+        unsigned pw = vt_pages(h->width, l), ph = vt_pages(h->height, l);
+        unsigned qw = vt_pages(h->width, l + 1), qh = vt_pages(h->height, l + 1);
+        for (unsigned y = 0; y < ph; y++) {
+            for (unsigned x = 0; x < pw; x++) {
+                unsigned page = t->first[l] + y * pw + x;
+                unsigned char * e = &t->table[4 * page];
+                int slot = t->slots[page];
+
+                /* the coarsest page is always there */
+                if (slot >= 0 || l + 1 == h->levels) {
+                    e[0] = slot % vc->across;
+                    e[1] = slot / vc->across;
+                    e[2] = l;
+                    e[3] = 255;
+                } else {
+                    unsigned parent = t->first[l + 1] + std::min(y / 2, qh - 1) * qw + std::min(x / 2, qw - 1);
+                    memcpy(e, &t->table[4 * parent], 4);
+                }
+            }
+        }
+    }
+
+    gs_bind_texture(t->indirection);
+    for (unsigned l = 0; l < h->levels; l++)
+        glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, vt_pages(h->width, l), vt_pages(h->height, l),
+                GL_RGBA, GL_UNSIGNED_BYTE, &t->table[4 * t->first[l]]);
+    t->dirty = false;
+}
+
+/**
+ * @brief Make room in the cache for a page: a free slot, or else the one
+ *        wanted least recently, but not by this update. The slot is the
+ *        page's from then on, so that it isn't handed out twice, though
+ *        the page is only looked up there once it's placed.
+ * @param texture Virtual texture of the page
+ * @param page The page
+ * @returns The slot, -1 if every slot is wanted
+ */
+static int vt_evict (struct vt_cache * vc, unsigned texture, unsigned page)
+{
+    int best = -1;
+    for (unsigned s = 0; s < vc->slots.size(); s++) {
+        const struct vt_slot * slot = &vc->slots[s];
+        if (slot->texture < 0) {
+            best = s;
+            break;
+        }
+        if (slot->pinned || slot->stamp == vc->stamp)
+            continue;
+        if (best < 0 || slot->stamp < vc->slots[best].stamp)
+            best = s;
+    }
+    if (best < 0)
+        return -1;
+
+    struct vt_slot * slot = &vc->slots[best];
+    if (slot->texture >= 0) {
+        struct vt_texture * t = &vc->textures[slot->texture];
+        t->slots[slot->page] = -1;
+        t->dirty = true;
+    }
+    slot->texture = texture;
+    slot->page = page;
+    slot->stamp = vc->stamp;
+    return best;
+}
+
+/**
+ * @brief Put a page in a slot
+ */
+static void vt_place (struct vt_cache * vc, unsigned texture, unsigned page, unsigned slot, const unsigned char * data)
+{
+    vt_upload(vc, slot, data);
+    vc->slots[slot].texture = texture;
+    vc->slots[slot].page = page;
+    vc->slots[slot].stamp = vc->stamp;
+    vc->textures[texture].slots[page] = slot;
+    vc->textures[texture].dirty = true;
+}
+
+int vt_open (struct vt_cache * vc, const char * fname)
+{
+    int fd = vt_open_file(fname);
+    if (fd < 0)
+        return -1;
+
+    struct vt_texture t;
+    t.fd = fd;
+    struct vt_header * h = &t.header;
+    uint64_t length = 0;
+    bool ok = vt_read_at(fd, h, sizeof(*h), 0)
+        && memcmp(h->magic, vt_magic, sizeof(vt_magic)) == 0
+        && h->format == (uint32_t) vc->format
+        && h->width >= VT_PAGE && h->width <= VT_MAX_SIZE && (h->width & (h->width - 1)) == 0
+        && h->height >= VT_PAGE && h->height <= VT_MAX_SIZE && (h->height & (h->height - 1)) == 0
+        && h->levels == vt_levels(h->width, h->height)
+        && vt_file_size(fd, &length);
+
+    unsigned pages = 0;
+    for (unsigned l = 0; ok && l < h->levels; l++) {
+        t.first.push_back(pages);
+        pages += vt_pages(h->width, l) * vt_pages(h->height, l);
+    }
+    ok = ok && length >= sizeof(*h) + (uint64_t) pages * vt_page_size(vc->format);
+
+    /* the coarsest page goes in for good: every other falls back to it */
+    ok = ok && vc->textures.size() < VT_MAX_TEXTURES;
+    int slot = ok ? vt_evict(vc, vc->textures.size(), pages - 1) : -1;
+    ok = slot >= 0 && vt_read(vc, &t, pages - 1, vc->staging.data());
+    if (!ok) {
+        if (slot >= 0)
+            vc->slots[slot].texture = -1;
+        vt_close_file(fd);
+        return -1;
+    }
+
+    t.slots.assign(pages, -1);
+    t.wanted.assign(pages, 0);
+    t.table.assign(4 * pages, 0);
+
+    glGenTextures(1, &t.indirection);
+    gs_bind_texture(t.indirection);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, h->levels - 1);
+    for (unsigned l = 0; l < h->levels; l++)
+        glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA, vt_pages(h->width, l), vt_pages(h->height, l), 0,
+                GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    vc->textures.push_back(t);
+    unsigned id = vc->textures.size() - 1;
+    vt_place(vc, id, pages - 1, slot, vc->staging.data());
+    vc->slots[slot].pinned = true;
+    vt_update_table(vc, &vc->textures[id]);
+    gs_bind_texture(0);
+    return id;
+}
+
+void vt_bind (struct vt_cache * vc, int vtex)
+{
+    if (vtex == vc->bound || vc->textures.empty())
+        return;
+
+    vc->bound = vtex;
+    if (vtex < 0) {
+        gs_use_program(0);
+        return;
+    }
+
+    const struct vt_texture * t = &vc->textures[vtex];
+    gs_use_program(vc->program);
+    glUniform2f(vc->size_loc, t->header.width, t->header.height);
+
+    /* the state cache only covers unit 0, which has the cache */
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, t->indirection);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+bool vt_feedback_begin (struct vt_cache * vc)
+{
+    if (vc->textures.empty() || vc->frame++ % VT_FEEDBACK_FRAMES != 0)
+        return false;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    int width = std::max(1, viewport[2] / VT_FEEDBACK_SCALE);
+    int height = std::max(1, viewport[3] / VT_FEEDBACK_SCALE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, vc->fbo);
+    if (width != vc->fb_width || height != vc->fb_height) {
+        if (!vc->color) {
+            glGenRenderbuffers(1, &vc->color);
+            glGenRenderbuffers(1, &vc->depth);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, vc->color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, vc->depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, vc->color);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, vc->depth);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, vc->pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4 * (size_t) width * height, NULL, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        vc->fb_width = width;
+        vc->fb_height = height;
+        vc->pending = false;
+    }
+
+    glPushAttrib(GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT);
+    glViewport(0, 0, width, height);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    gs_use_program(vc->feedback_program);
+    vc->bound = -2; /* none yet */
+    return true;
+}
+
+void vt_feedback_texture (struct vt_cache * vc, int vtex)
+{
+    if (vtex == vc->bound)
+        return;
+
+    /* an ID of 0 is no texture */
+    vc->bound = vtex;
+    const struct vt_header * h = (vtex >= 0) ? &vc->textures[vtex].header : NULL;
+    glUniform2f(vc->fb_size_loc, h ? h->width : 1, h ? h->height : 1);
+    glUniform1f(vc->fb_levels_loc, h ? h->levels : 1);
+    glUniform1f(vc->fb_id_loc, vtex + 1);
+}
+
+void vt_feedback_end (struct vt_cache * vc)
+{
+    /* into the buffer: it's mapped a couple of frames later, without waiting */
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, vc->pbo);
+    glReadPixels(0, 0, vc->fb_width, vc->fb_height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glPopAttrib();
+    gs_use_program(0);
+    vc->bound = -1;
+    vc->pending = true;
+}
+
+/**
+ * @brief Want a page, and the pages it falls back to, for this update
+ * @param vc The cache
+ * @param texture Its virtual texture
+ * @param level Its level
+ * @param x Its column, in that level
+ * @param y Its row
+ */
+static void vt_want (struct vt_cache * vc, unsigned texture, unsigned level, unsigned x, unsigned y)
+{
+    struct vt_texture * t = &vc->textures[texture];
+    const struct vt_header * h = &t->header;
+
+    for (; level < h->levels; level++, x /= 2, y /= 2) {
+        unsigned pw = vt_pages(h->width, level), ph = vt_pages(h->height, level);
+        if (x >= pw || y >= ph)
+            return;
+
+        /* the rest of the way was already taken */
+        unsigned page = t->first[level] + y * pw + x;
+        if (t->wanted[page] == vc->stamp)
+            return;
+        t->wanted[page] = vc->stamp;
+        vc->stats.wanted++;
+
+        int slot = t->slots[page];
+        if (slot >= 0) {
+            vc->slots[slot].stamp = vc->stamp;
+        } else {
+            vc->stats.missing++;
+            struct vt_load load = { texture, page, level, -1, };
+            if (vc->requests.size() < vc->requests.capacity())
+                vc->requests.push_back(load);
+        }
+    }
+}
+
+/**
+ * @brief Task of `vt_update`: read a page into the staging buffer
+ */
+static void vt_read_task (void * ctx, unsigned i)
+{
+    struct vt_cache * vc = (struct vt_cache *) ctx;
+    const struct vt_load * load = &vc->requests[i];
+    unsigned char * out = &vc->staging[i * vt_page_size(vc->format)];
+
+    /* a page that can't be read is left black */
+    if (!vt_read(vc, &vc->textures[load->texture], load->page, out))
+        memset(out, 0, vt_page_size(vc->format));
+}
+
+void vt_update (struct vt_cache * vc)
+{
+    /* the feedback was read a frame ago: it's surely there by now */
+    if (!vc->pending || vc->frame % VT_FEEDBACK_FRAMES != VT_FEEDBACK_FRAMES / 2)
+        return;
+    vc->pending = false;
+    vc->stamp++;
+    vc->requests.clear();
+    memset(&vc->stats, 0, sizeof(vc->stats));
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, vc->pbo);
+    const unsigned char * px = (const unsigned char *) glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (px) {
+        for (size_t i = 0; i < (size_t) vc->fb_width * vc->fb_height; i++) {
+            const unsigned char * f = &px[4 * i];
+            if (f[3] > 0 && f[3] <= vc->textures.size())
+                vt_want(vc, f[3] - 1, f[2], f[0], f[1]);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    /* coarsest first: they're drawn with until the finer ones are in */
+    std::sort(vc->requests.begin(), vc->requests.end(), [] (const struct vt_load & a, const struct vt_load & b) {
+        return a.level > b.level;
+    });
+
+    unsigned n = std::min((size_t) VT_LOADS, vc->requests.size());
+    for (unsigned i = 0; i < n; i++) {
+        vc->requests[i].slot = vt_evict(vc, vc->requests[i].texture, vc->requests[i].page);
+        if (vc->requests[i].slot < 0)
+            n = i;
+    }
+
+    if (n > 0)
+        wk_run(vt_read_task, vc, n);
+    for (unsigned i = 0; i < n; i++) {
+        const struct vt_load * load = &vc->requests[i];
+        vt_place(vc, load->texture, load->page, load->slot, &vc->staging[i * vt_page_size(vc->format)]);
+    }
+    vc->stats.loaded = n;
+
+    for (struct vt_texture & t : vc->textures)
+        if (t.dirty)
+            vt_update_table(vc, &t);
+    gs_bind_texture(0);
+
+    for (const struct vt_slot & slot : vc->slots)
+        vc->stats.resident += slot.texture >= 0;
+}
+
+/**
+ * A row of pages of a level being tiled
+ */
+struct vt_row {
+    const struct at_image * img; /*< The level */
+    unsigned y;                  /*< The row */
+    enum bc_format format;       /*< Format of the pages */
+    unsigned char * out;         /*< The row's pages */
+};
+
+/**
+ * @brief Task of `vt_write`: cut a page out of a level, its border
+ *        wrapping around the level as `GL_REPEAT` would
+ */
+static void vt_tile_page (void * ctx, unsigned x)
+{
+    const struct vt_row * row = (const struct vt_row *) ctx;
+    const struct at_image * img = row->img;
+    unsigned char texels[4 * VT_SLOT * VT_SLOT];
+
+    for (unsigned j = 0; j < VT_SLOT; j++) {
+        unsigned sy = (row->y * VT_PAGE + j + img->height - VT_BORDER % img->height) % img->height;
+        for (unsigned i = 0; i < VT_SLOT; i++) {
+            unsigned sx = (x * VT_PAGE + i + img->width - VT_BORDER % img->width) % img->width;
+            memcpy(&texels[4 * (j * VT_SLOT + i)], &img->pixels[4 * ((size_t) sy * img->width + sx)], 4);
+        }
+    }
+
+    unsigned char * out = &row->out[x * vt_page_size(row->format)];
+    if (row->format == BC_RGBA)
+        memcpy(out, texels, sizeof(texels));
+    else
+        bc_encode(row->format, texels, VT_SLOT, VT_SLOT, out);
+}
+
+bool vt_write (const char * fname, struct at_image * img, enum bc_format format)
+{
+    unsigned width = img->width, height = img->height;
+    if (width < VT_PAGE || width > VT_MAX_SIZE || (width & (width - 1)) != 0
+            || height < VT_PAGE || height > VT_MAX_SIZE || (height & (height - 1)) != 0)
+        return false;
+
+    FILE * outf = fopen(fname, "wb");
+    if (!outf)
+        return false;
+
+    struct vt_header h;
+    memcpy(h.magic, vt_magic, sizeof(vt_magic));
+    h.width = width;
+    h.height = height;
+    h.levels = vt_levels(width, height);
+    h.format = format;
+    bool ok = fwrite(&h, sizeof(h), 1, outf) == 1;
+
+    /* a row of pages at a time, so that only the image has to fit in memory */
+    std::vector<unsigned char> pages;
+    for (unsigned l = 0; ok && l < h.levels; l++) {
+        unsigned pw = vt_pages(width, l), ph = vt_pages(height, l);
+        pages.resize(pw * vt_page_size(format));
+        for (unsigned y = 0; ok && y < ph; y++) {
+            struct vt_row row = { img, y, format, pages.data(), };
+            wk_run(vt_tile_page, &row, pw);
+            ok = fwrite(pages.data(), 1, pages.size(), outf) == pages.size();
+        }
+        if (l + 1 < h.levels)
+            at_halve(img);
+    }
+
+    return fclose(outf) == 0 && ok;
+}
@@ -0,0 +1,196 @@
+#ifndef _VTEX_H
+#define _VTEX_H
+
+#include "atlas.h"
+#include "bcn.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+/** Texels of a page, across */
+#define VT_PAGE 128
+
+/** Texels around each page, repeating its level, for filtering */
+#define VT_BORDER 4
+
+/** Texels of a page and its border, across: a slot of the page cache */
+#define VT_SLOT (VT_PAGE + 2 * VT_BORDER)
+
+/** Largest width or height of a virtual texture: page numbers fit a byte */
+#define VT_MAX_SIZE (256 * VT_PAGE)
+
+/** The feedback is drawn this many times smaller than the window */
+#define VT_FEEDBACK_SCALE 8
+
+/** Frames between feedback passes */
+#define VT_FEEDBACK_FRAMES 4
+
+/** Most pages loaded per frame */
+#define VT_LOADS 16
+
+/** Most missing pages considered per frame */
+#define VT_REQUESTS 4096
+
+/** Most virtual textures: their IDs in the feedback fit a byte */
+#define VT_MAX_TEXTURES 255
+
+/**
+ * A tiled texture file: the header, then every page of every level, the
+ * largest level first and each one rows first. Pages are `VT_SLOT`
+ * texels across, in the file's format.
+ */
+struct vt_header {
+    char magic[4];   /*< Identifies the file and its version */
+    uint32_t width;  /*< Width of the source image, a power of 2 */
+    uint32_t height; /*< Height, likewise */
+    uint32_t levels; /*< Levels, down to one page */
+    uint32_t format; /*< `enum bc_format` of the pages */
+};
+
+/**
+ * A virtual texture: only the pages that were recently seen are in
+ * memory, in slots of the page cache
+ */
+struct vt_texture {
+    int fd;                           /*< The tiled file */
+    struct vt_header header;          /*< Its header */
+    std::vector<unsigned> first;      /*< First page of each level */
+    std::vector<int> slots;           /*< Slot of every page, -1 if it isn't in the cache */
+    std::vector<unsigned> wanted;     /*< Last update that wanted every page */
+    std::vector<unsigned char> table; /*< Indirection, a texel per page: slot and level of the page to use */
+    unsigned indirection;             /*< The indirection texture */
+    bool dirty;                       /*< Has the table changed since it was uploaded? */
+};
+
+/**
+ * A slot of the page cache
+ */
+struct vt_slot {
+    int texture;    /*< Virtual texture of its page, -1 if it's free */
+    unsigned page;  /*< The page */
+    unsigned stamp; /*< Last update that wanted it */
+    bool pinned;    /*< Never evicted: the page every other falls back to */
+};
+
+/**
+ * A page being loaded
+ */
+struct vt_load {
+    unsigned texture; /*< Its virtual texture */
+    unsigned page;    /*< The page */
+    unsigned level;   /*< Its level */
+    int slot;         /*< Where it's going */
+};
+
+/**
+ * Statistics of the last update
+ */
+struct vt_stats {
+    unsigned wanted;   /*< Pages seen in the feedback, and the pages they fall back to */
+    unsigned missing;  /*< Those that weren't in the cache */
+    unsigned loaded;   /*< Pages loaded */
+    unsigned resident; /*< Slots in use */
+};
+
+/**
+ * Virtual textures, and the page cache they share. Models with a virtual
+ * texture are drawn with a fragment program that finds each texel's page
+ * in the cache through the texture's indirection; every few frames, the
+ * scene is also drawn small with the pages it would like, which are
+ * loaded for the next frames, the least recently wanted making room.
+ */
+struct vt_cache {
+    std::vector<struct vt_texture> textures; /*< Virtual textures */
+    std::vector<struct vt_slot> slots;       /*< Slots of the page cache */
+    unsigned across;                         /*< Slots across the cache texture */
+    enum bc_format format;                   /*< Format of the pages */
+    unsigned cache;                          /*< The cache texture */
+
+    unsigned program;                        /*< Draws with a virtual texture */
+    int size_loc;                            /*< Its uniforms */
+    unsigned feedback_program;               /*< Draws the pages wanted */
+    int fb_size_loc, fb_levels_loc, fb_id_loc;
+    unsigned fbo, color, depth;              /*< Where the feedback is drawn */
+    unsigned pbo;                            /*< Where it's read back to */
+    int fb_width, fb_height;                 /*< Its size */
+    bool pending;                            /*< Is a feedback being read back? */
+
+    int bound;                               /*< Virtual texture being drawn with, -1 if none */
+    unsigned frame;                          /*< Frames drawn */
+    unsigned stamp;                          /*< Updates made */
+    std::vector<struct vt_load> requests;    /*< Missing pages of the update */
+    std::vector<unsigned char> staging;      /*< Pages being loaded */
+    struct vt_stats stats;                   /*< Statistics of the last update */
+};
+
+/**
+ * @brief Can virtual textures be drawn? They need GLSL 1.20 and frame
+ *        buffer objects.
+ */
+bool vt_supported (void);
+
+/**
+ * @brief Set the page cache up
+ * @param vc The cache
+ * @param across Slots across the cache texture; there are `across * across`
+ * @param format Format of the pages; virtual textures in others are refused
+ * @returns Whether it could; if not, nothing's left to free
+ */
+bool vt_init (struct vt_cache * vc, unsigned across, enum bc_format format);
+
+/**
+ * @brief Open a tiled texture file, and load its coarsest page for good
+ * @param vc The cache
+ * @param fname The file
+ * @returns Its index in `vt_cache::textures`, -1 if it couldn't
+ */
+int vt_open (struct vt_cache * vc, const char * fname);
+
+/**
+ * @brief Draw with a virtual texture, or go back to the fixed function
+ *        pipeline. The cache texture has to be bound too.
+ * @param vc The cache
+ * @param vtex The virtual texture, -1 for none
+ */
+void vt_bind (struct vt_cache * vc, int vtex);
+
+/**
+ * @brief Start drawing the feedback, if it's time to
+ * @param vc The cache
+ * @returns Whether the scene has to be drawn, with `vt_feedback_texture`
+ *          before each model
+ */
+bool vt_feedback_begin (struct vt_cache * vc);
+
+/**
+ * @brief Set the virtual texture of what's drawn in the feedback
+ * @param vc The cache
+ * @param vtex The virtual texture, -1 for none
+ */
+void vt_feedback_texture (struct vt_cache * vc, int vtex);
+
+/**
+ * @brief Finish drawing the feedback, and start reading it back
+ */
+void vt_feedback_end (struct vt_cache * vc);
+
+/**
+ * @brief Load the pages of the last feedback read back, once it's there,
+ *        evicting the least recently wanted, and update the indirections.
+ *        Pages are read on the workers. Doesn't allocate.
+ * @param vc The cache
+ */
+void vt_update (struct vt_cache * vc);
+
+/**
+ * @brief Tile an image into a file, with every level
+ * @param fname The file
+ * @param img The image, whose sides are powers of 2 from `VT_PAGE` to
+ *            `VT_MAX_SIZE`; it's halved into every level
+ * @param format Format of the pages
+ * @returns Whether it could
+ */
+bool vt_write (const char * fname, struct at_image * img, enum bc_format format);
+
+#endif /* _VTEX_H */
@@ -0,0 +1,191 @@
+#include "workers.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A batch of tasks
+ */
+struct wk_batch {
+    wk_fn fn;
+    void * ctx;
+    unsigned n;
+    std::atomic<unsigned> next; /*< Next task to hand out */
+    unsigned finished;          /*< Tasks run so far */
+};
+
+/**
+ * The worker pool, and the batches it's running: the one `wk_run` waits
+ * for comes first, and the launched one fills the time in between
+ */
+static struct {
+    std::vector<std::thread> threads;
+
+    std::mutex lock;
+    std::condition_variable wake; /*< A batch was started, or the pool stopped */
+    std::condition_variable done; /*< A worker left a batch, or finished a launched task */
+
+    struct wk_batch run;             /*< The batch `wk_run` waits for */
+    unsigned busy;                   /*< Workers in it */
+    struct wk_batch launched;        /*< The batch `wk_launch`ed */
+    std::vector<unsigned> completed; /*< Its finished tasks, in order */
+    unsigned taken;                  /*< Those taken by `wk_next` */
+    bool stop;
+} wk;
+
+/**
+ * @brief Does a batch have tasks left to hand out?
+ */
+static inline bool wk_pending (const struct wk_batch * b)
+{
+    return b->next < b->n;
+}
+
+/**
+ * @brief Run tasks of the `wk_run` batch until there are none left
+ * @returns Number of tasks run
+ */
+static unsigned wk_work (wk_fn fn, void * ctx, unsigned n)
+{
+    unsigned ret = 0;
+    for (unsigned t; (t = wk.run.next.fetch_add(1)) < n; ret++)
+        fn(ctx, t);
+    return ret;
+}
+
+/**
+ * @brief Run the next task of the launched batch, and queue it for
+ *        `wk_next`. The lock is held, but not while the task runs.
+ */
+static void wk_work_launched (std::unique_lock<std::mutex> & l)
+{
+    wk_fn fn = wk.launched.fn;
+    void * ctx = wk.launched.ctx;
+    unsigned t = wk.launched.next++;
+
+    l.unlock();
+    fn(ctx, t);
+    l.lock();
+
+    wk.launched.finished++;
+    wk.completed.push_back(t);
+}
+
+static void wk_worker (void)
+{
+    std::unique_lock<std::mutex> l(wk.lock);
+
+    for (;;) {
+        wk.wake.wait(l, [] { return wk.stop || wk_pending(&wk.run) || wk_pending(&wk.launched); });
+        if (wk.stop)
+            break;
+
+        if (wk_pending(&wk.run)) {
+            /* the batch can't change while we're in it, see `wk_run` */
+            wk_fn fn = wk.run.fn;
+            void * ctx = wk.run.ctx;
+            unsigned n = wk.run.n;
+            wk.busy++;
+
+            l.unlock();
+            unsigned ran = wk_work(fn, ctx, n);
+            l.lock();
+
+            wk.busy--;
+            wk.run.finished += ran;
+        } else {
+            /* a task at a time, to be back for `wk_run` as soon as it needs us */
+            wk_work_launched(l);
+        }
+        wk.done.notify_all();
+    }
+}
+
+void wk_start (unsigned n)
+{
+    wk_stop();
+    wk.stop = false;
+    for (unsigned i = 0; i < n; i++)
+        wk.threads.emplace_back(wk_worker);
+}
+
+void wk_stop (void)
+{
+    {
+        std::lock_guard<std::mutex> l(wk.lock);
+        wk.stop = true;
+    }
+    wk.wake.notify_all();
+
+    for (std::thread & t : wk.threads)
+        t.join();
+    wk.threads.clear();
+}
+
+unsigned wk_count (void)
+{
+    return wk.threads.size() + 1;
+}
+
+void wk_run (wk_fn fn, void * ctx, unsigned n)
+{
+    if (wk.threads.empty()) {
+        for (unsigned t = 0; t < n; t++)
+            fn(ctx, t);
+        return;
+    }
+
+    {
+        /* a worker late for the last batch may still be in it */
+        std::unique_lock<std::mutex> l(wk.lock);
+        wk.done.wait(l, [] { return wk.busy == 0; });
+        wk.run.fn = fn;
+        wk.run.ctx = ctx;
+        wk.run.n = n;
+        wk.run.next = 0;
+        wk.run.finished = 0;
+    }
+    wk.wake.notify_all();
+
+    unsigned ran = wk_work(fn, ctx, n);
+
+    std::unique_lock<std::mutex> l(wk.lock);
+    wk.run.finished += ran;
+    wk.done.wait(l, [=] { return wk.run.finished == n; });
+}
+
+void wk_launch (wk_fn fn, void * ctx, unsigned n)
+{
+    {
+        std::unique_lock<std::mutex> l(wk.lock);
+        wk.done.wait(l, [] { return wk.launched.finished == wk.launched.n; });
+        wk.launched.fn = fn;
+        wk.launched.ctx = ctx;
+        wk.launched.n = n;
+        wk.launched.next = 0;
+        wk.launched.finished = 0;
+        wk.completed.clear();
+        wk.completed.reserve(n);
+        wk.taken = 0;
+    }
+    wk.wake.notify_all();
+}
+
+bool wk_next (unsigned * task, bool wait)
+{
+    std::unique_lock<std::mutex> l(wk.lock);
+
+    /* without workers, it's up to us */
+    if (wk.threads.empty() && wk.taken == wk.completed.size() && wk_pending(&wk.launched))
+        wk_work_launched(l);
+
+    if (wait)
+        wk.done.wait(l, [] { return wk.taken < wk.completed.size() || wk.taken >= wk.launched.n; });
+    if (wk.taken >= wk.completed.size())
+        return false;
+    *task = wk.completed[wk.taken++];
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef _WORKERS_H
+#define _WORKERS_H
+
+/**
+ * A task: `task` is its index in its batch
+ */
+typedef void (*wk_fn) (void * ctx, unsigned task);
+
+/**
+ * @brief Start the worker threads. Without any, batches run on the
+ *        calling thread alone.
+ * @param n Number of threads, besides the calling one
+ */
+void wk_start (unsigned n);
+
+/**
+ * @brief Stop and join the worker threads
+ */
+void wk_stop (void);
+
+/**
+ * @brief Number of threads a batch runs on, the calling one included
+ */
+unsigned wk_count (void);
+
+/**
+ * @brief Run a batch of tasks on the workers and wait for all of them.
+ *        The calling thread runs tasks too, and running a batch doesn't
+ *        allocate. Workers busy with a launched batch join in as soon as
+ *        they finish the task they're on. Only one thread may run batches.
+ * @param fn The task
+ * @param ctx Passed to every task
+ * @param n Number of tasks
+ */
+void wk_run (wk_fn fn, void * ctx, unsigned n);
+
+/**
+ * @brief Start a batch of tasks on the workers in the background: they
+ *        run it whenever `wk_run` has no tasks for them, a task at a time.
+ *        The calling thread is free to take each task as it's finished,
+ *        with `wk_next`. Without workers, `wk_next` runs the tasks. The
+ *        next batch launched waits for this one to finish.
+ * @param fn The task
+ * @param ctx Passed to every task
+ * @param n Number of tasks
+ */
+void wk_launch (wk_fn fn, void * ctx, unsigned n);
+
+/**
+ * @brief Take a finished task of the launched batch, in the order they
+ *        finished. Without workers, runs the next one first.
+ * @param[out] task The task
+ * @param wait Wait for one, if none has finished since the last one taken?
+ * @returns Whether there was one; never, once every task was taken
+ */
+bool wk_next (unsigned * task, bool wait);
+
+#endif /* _WORKERS_H */